@@ -6,7 +6,9 @@
 #include "app.h"
 #include "geometry/util.h"
 #include "platform/platform.h"
+#include "rays/bvh_cache.h"
 #include "scene/renderer.h"
+#include "util/tiled_image.h"
 
 App::App(Settings set, Platform* plt)
     : window_dim(plt ? plt->window_draw() : Vec2{1.0f}),
@@ -18,6 +20,15 @@ App::App(Settings set, Platform* plt)
     std::string err;
     bool loaded_scene = true;
 
+    if(!set.bvh_cache_dir.empty()) {
+        PT::BVH_Cache::get().configure(set.bvh_cache_dir,
+                                       (size_t)std::max(set.bvh_cache_mb, 0) * 1024 * 1024,
+                                       !set.bvh_cache_no_verify);
+    }
+    if(!set.texture_cache_dir.empty()) {
+        Tiled_Image::configure_cache(set.texture_cache_dir);
+    }
+
     if(!set.scene_file.empty()) {
         info("Loading scene file...");
         Scene::Load_Opts opts;
@@ -44,6 +55,13 @@ App::App(Settings set, Platform* plt)
     } else if(loaded_scene) {
 
         info("Rendering scene...");
+        gui.get_render().set_compressed(set.compress_meshes);
+
+        std::string ext = ".exr";
+        bool exr_file = set.output_file.size() >= ext.size() &&
+                        set.output_file.compare(set.output_file.size() - ext.size(), ext.size(),
+                                                ext) == 0;
+        gui.get_render().set_output(set.exr || exr_file, set.exr_half, set.exr_layers);
         err = gui.get_render().headless_render(gui.get_animate(), scene, set.output_file,
                                                set.animate, set.w, set.h, set.s, set.ls, set.d,
                                                set.exp, set.w_from_ar);
@@ -32,6 +32,18 @@ public:
         bool animate = false;
         float exp = 1.0f;
         bool w_from_ar = false;
+        bool compress_meshes = false;
+        bool exr = false;
+        bool exr_half = false;
+        bool exr_layers = false;
+
+        // BVH cache is disabled if no directory is given
+        std::string bvh_cache_dir;
+        int bvh_cache_mb = 2048;
+        bool bvh_cache_no_verify = false;
+
+        // Environment maps are converted on every load if no directory is given
+        std::string texture_cache_dir;
     };
 
     App(Settings set, Platform* plt = nullptr);
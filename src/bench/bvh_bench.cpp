@@ -0,0 +1,291 @@
+
+#include "geometry/util.h"
+#include "gui/manager.h"
+#include "rays/object.h"
+#include "scene/scene.h"
+#include "scene/undo.h"
+#include "util/thread_pool.h"
+
+#include <chrono>
+#include <random>
+#include <sf_libs/CLI11.hpp>
+
+// Benchmarks the BVH builders and traversal on the repository scenes and on
+// generated meshes, with full and compressed mesh storage, writing the results as JSON.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Settings {
+    std::vector<std::string> scenes = {"media/cbox.dae", "media/bunny.dae", "media/cow.dae",
+                                       "media/dragon2.dae"};
+    int sphere_subdivisions = 7;
+    int torus_segments = 512;
+    int w = 256, h = 256;
+    int threads = (int)std::thread::hardware_concurrency();
+    std::string output_file = "bvh_bench.json";
+};
+
+struct Item {
+    const GL::Mesh* mesh = nullptr;
+    PT::Shape shape;
+    Mat4 transform;
+    Scene_ID id = 0;
+};
+
+struct Input {
+    std::string name;
+    std::vector<Item> items;
+};
+
+struct Batch {
+    size_t rays = 0, hits = 0;
+    double ms = 0.0;
+};
+
+struct Result {
+    PT::BVH_Builder builder;
+    bool compressed = false;
+    size_t triangles = 0, mesh_nodes = 0, scene_nodes = 0, mesh_bytes = 0, bytes = 0;
+    double mesh_build_ms = 0.0, scene_build_ms = 0.0;
+    float mesh_sah_cost = 0.0f, scene_sah_cost = 0.0f;
+    Batch primary, diffuse;
+};
+
+std::string json_string(const std::string& str) {
+    std::string ret = "\"";
+    for(char c : str) {
+        if(c == '"' || c == '\\') ret += '\\';
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+// Traces rays in parallel chunks, returning the closest hit of each
+Batch trace(const PT::BVH<PT::Object>& scene, const std::vector<Ray>& rays,
+            std::vector<PT::Trace>& hits, Thread_Pool& pool) {
+
+    const size_t chunk = 1024;
+    hits.resize(rays.size());
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::future<size_t>> tasks;
+    for(size_t i = 0; i < rays.size(); i += chunk) {
+        tasks.push_back(pool.enqueue([&, i]() {
+            size_t n_hits = 0;
+            for(size_t r = i; r < std::min(i + chunk, rays.size()); r++) {
+                hits[r] = scene.hit(rays[r]);
+                if(hits[r].hit) n_hits++;
+            }
+            return n_hits;
+        }));
+    }
+
+    Batch batch;
+    for(auto& task : tasks) batch.hits += task.get();
+    batch.ms = ms_since(start);
+    batch.rays = rays.size();
+    return batch;
+}
+
+Result run(const Input& input, PT::BVH_Builder builder, bool compress, const Settings& set,
+           Thread_Pool& pool) {
+
+    Result result;
+    result.builder = builder;
+    result.compressed = compress;
+
+    // Meshes are built one at a time so the timings only include the builder's own parallelism
+    std::vector<PT::Object> objects;
+    for(const Item& item : input.items) {
+        if(!item.mesh) {
+            objects.push_back(PT::Object(PT::Shape(item.shape), item.id, 0, item.transform));
+            continue;
+        }
+
+        Clock::time_point start = Clock::now();
+        PT::Tri_Mesh mesh(*item.mesh, builder, compress);
+        result.mesh_build_ms += ms_since(start);
+
+        const PT::BVH<PT::Triangle>& bvh = mesh.bvh();
+        size_t tris = item.mesh->indices().size() / 3;
+        result.triangles += tris;
+        result.mesh_nodes += bvh.n_nodes();
+        result.mesh_sah_cost += bvh.sah_cost() * tris;
+        result.mesh_bytes += mesh.bytes();
+
+        objects.push_back(PT::Object(std::move(mesh), item.id, 0, item.transform));
+    }
+    if(result.triangles) result.mesh_sah_cost /= result.triangles;
+
+    Clock::time_point start = Clock::now();
+    PT::BVH<PT::Object> scene;
+    scene.build(std::move(objects), 1, builder, &pool);
+    result.scene_build_ms = ms_since(start);
+    result.scene_nodes = scene.n_nodes();
+    result.scene_sah_cost = scene.sah_cost();
+    result.bytes = result.mesh_bytes + scene.bytes();
+
+    // Primary rays from a fixed pinhole camera looking at the scene
+    BBox box = scene.bbox();
+    Vec3 center = box.center();
+    float radius = std::max((box.max - box.min).norm() * 0.5f, EPS_F);
+    Vec3 eye = center + Vec3(0.3f, 0.5f, 1.0f).unit() * radius * 2.5f;
+    Mat4 look = Mat4::look_at(eye, center, Vec3(0.0f, 1.0f, 0.0f)).inverse();
+    float fov = std::tan(Radians(30.0f));
+    float aspect = (float)set.w / set.h;
+
+    std::vector<Ray> rays;
+    rays.reserve((size_t)set.w * set.h);
+    for(int y = 0; y < set.h; y++) {
+        for(int x = 0; x < set.w; x++) {
+            Vec3 dir((2.0f * (x + 0.5f) / set.w - 1.0f) * fov * aspect,
+                     (2.0f * (y + 0.5f) / set.h - 1.0f) * fov, -1.0f);
+            rays.push_back(Ray(eye, look.rotate(dir)));
+        }
+    }
+
+    std::vector<PT::Trace> hits;
+    result.primary = trace(scene, rays, hits, pool);
+
+    // One cosine-distributed bounce off every primary hit, with fixed seeds
+    std::vector<Ray> bounces;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for(const PT::Trace& hit : hits) {
+        if(!hit.hit) continue;
+        float phi = 2.0f * PI_F * unit(rng), r2 = unit(rng), r = std::sqrt(r2);
+        Vec3 n = hit.normal;
+        Vec3 t = std::abs(n.x) > 0.5f ? cross(n, Vec3(0.0f, 1.0f, 0.0f)).unit()
+                                      : cross(n, Vec3(1.0f, 0.0f, 0.0f)).unit();
+        Vec3 b = cross(n, t);
+        Vec3 dir = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(1.0f - r2);
+        Ray ray(hit.position, dir);
+        ray.dist_bounds.x = EPS_F;
+        bounces.push_back(ray);
+    }
+    result.diffuse = trace(scene, bounces, hits, pool);
+
+    return result;
+}
+
+void write_batch(FILE* out, const char* name, const Batch& batch) {
+    double mrays = batch.ms > 0.0 ? batch.rays / (batch.ms * 1000.0) : 0.0;
+    fprintf(out, "\"%s\": {\"rays\": %zu, \"hits\": %zu, \"ms\": %.3f, \"mrays_per_s\": %.4f}",
+            name, batch.rays, batch.hits, batch.ms, mrays);
+}
+
+void write_result(FILE* out, const Result& r) {
+    fprintf(out, "        {\"builder\": %s, \"compressed\": %s, \"triangles\": %zu, ",
+            json_string(PT::BVH_Builder_Names[(int)r.builder]).c_str(),
+            r.compressed ? "true" : "false", r.triangles);
+    fprintf(out, "\"mesh_build_ms\": %.3f, \"scene_build_ms\": %.3f, ", r.mesh_build_ms,
+            r.scene_build_ms);
+    fprintf(out, "\"mesh_nodes\": %zu, \"scene_nodes\": %zu, ", r.mesh_nodes, r.scene_nodes);
+    fprintf(out, "\"mesh_sah_cost\": %.4f, \"scene_sah_cost\": %.4f, ", r.mesh_sah_cost,
+            r.scene_sah_cost);
+    fprintf(out, "\"mesh_bytes\": %zu, \"bytes\": %zu, ", r.mesh_bytes, r.bytes);
+    write_batch(out, "primary", r.primary);
+    fprintf(out, ", ");
+    write_batch(out, "diffuse", r.diffuse);
+    fprintf(out, "}");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+
+    Settings set;
+    CLI::App args{"Cardinal3D - BVH benchmark"};
+
+    args.add_option("-s,--scene", set.scenes, "Scene files to load");
+    args.add_option("--sphere", set.sphere_subdivisions, "Subdivisions of the generated sphere");
+    args.add_option("--torus", set.torus_segments, "Segments of the generated torus");
+    args.add_option("--width", set.w, "Width of the primary ray grid");
+    args.add_option("--height", set.h, "Height of the primary ray grid");
+    args.add_option("--threads", set.threads, "Threads used to build and trace");
+    args.add_option("-o,--output", set.output_file, "JSON file to write");
+
+    CLI11_PARSE(args, argc, argv);
+
+    set.w = std::max(set.w, 1);
+    set.h = std::max(set.h, 1);
+    Thread_Pool pool((size_t)std::max(set.threads, 1));
+
+    FILE* out = fopen(set.output_file.c_str(), "w");
+    if(!out) die("Failed to open %s for writing", set.output_file.c_str());
+
+    fprintf(out, "{\n    \"threads\": %d, \"width\": %d, \"height\": %d,\n    \"inputs\": [",
+            std::max(set.threads, 1), set.w, set.h);
+
+    bool first_input = true;
+    auto bench = [&](const Input& input) {
+        fprintf(out, "%s\n    {\"name\": %s, \"objects\": %zu, \"results\": [",
+                first_input ? "" : ",", json_string(input.name).c_str(), input.items.size());
+        first_input = false;
+
+        bool first_result = true;
+        for(int b = 0; b < (int)PT::BVH_Builder::count; b++) {
+            for(bool compress : {false, true}) {
+                Result result = run(input, (PT::BVH_Builder)b, compress, set, pool);
+                fprintf(out, "%s\n", first_result ? "" : ",");
+                first_result = false;
+                write_result(out, result);
+                info("%s, %s%s: built in %.1fms, %.2f Mrays/s primary, %.1f MB of meshes",
+                     input.name.c_str(), PT::BVH_Builder_Names[b], compress ? " (compressed)" : "",
+                     result.mesh_build_ms + result.scene_build_ms,
+                     result.primary.ms > 0.0 ? result.primary.rays / (result.primary.ms * 1000.0)
+                                             : 0.0,
+                     result.mesh_bytes / (1024.0 * 1024.0));
+            }
+        }
+        fprintf(out, "\n    ]}");
+        fflush(out);
+    };
+
+    {
+        GL::Mesh sphere = Util::sphere_mesh(1.0f, set.sphere_subdivisions);
+        GL::Mesh torus = Util::torus_mesh(0.5f, 1.0f, set.torus_segments, set.torus_segments / 2);
+        bench({"sphere_" + std::to_string(set.sphere_subdivisions), {{&sphere, {}, Mat4::I, 1}}});
+        bench({"torus_" + std::to_string(set.torus_segments), {{&torus, {}, Mat4::I, 1}}});
+    }
+
+    for(const std::string& file : set.scenes) {
+
+        Scene scene(Gui::n_Widget_IDs);
+        Gui::Manager gui(scene, Vec2{1.0f});
+        Undo undo(scene, gui);
+
+        Scene::Load_Opts opts;
+        opts.new_scene = true;
+        std::string err = scene.load(opts, undo, gui, file);
+        if(!err.empty()) {
+            warn("Error loading scene %s: %s", file.c_str(), err.c_str());
+            continue;
+        }
+
+        Input input;
+        input.name = file;
+        scene.for_items([&](Scene_Item& item) {
+            if(!item.is<Scene_Object>()) return;
+            Scene_Object& obj = item.get<Scene_Object>();
+            if(obj.is_shape()) {
+                input.items.push_back({nullptr, obj.opt.shape, obj.pose.transform(), obj.id()});
+            } else {
+                input.items.push_back({&obj.posed_mesh(), {}, obj.pose.transform(), obj.id()});
+            }
+        });
+        if(input.items.empty()) continue;
+        bench(input);
+    }
+
+    fprintf(out, "\n    ]\n}\n");
+    fclose(out);
+    pool.stop();
+    return 0;
+}
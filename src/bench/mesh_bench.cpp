@@ -0,0 +1,238 @@
+
+#include "geometry/halfedge.h"
+#include "geometry/util.h"
+
+#include <chrono>
+#include <unordered_set>
+#include <sf_libs/CLI11.hpp>
+
+// Benchmarks the halfedge mesh: construction, traversal, local operations, copying and
+// validation on generated meshes, writing the results as JSON.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Settings {
+    std::vector<int> sphere_subdivisions = {4, 6};
+    std::vector<int> torus_segments = {128, 512};
+    int passes = 10;
+    std::string output_file = "mesh_bench.json";
+};
+
+struct Timing {
+    std::string name;
+    size_t ops = 0;
+    double ms = 0.0;
+};
+
+struct Result {
+    std::string name;
+    size_t vertices = 0, edges = 0, faces = 0;
+    std::vector<Timing> timings;
+    std::string error;
+};
+
+std::string json_string(const std::string& str) {
+    std::string ret = "\"";
+    for(char c : str) {
+        if(c == '"' || c == '\\') ret += '\\';
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+// Walks every vertex's one-ring and every face's boundary. The weight differs per pass so
+// repeated passes can't be merged into one.
+float traverse(const Halfedge_Mesh& mesh, float weight) {
+    float sum = 0.0f;
+    for(auto v = mesh.vertices_begin(); v != mesh.vertices_end(); v++) {
+        auto h = v->halfedge();
+        do {
+            sum += weight * h->twin()->vertex()->pos.x;
+            h = h->twin()->next();
+        } while(h != v->halfedge());
+    }
+    for(auto f = mesh.faces_begin(); f != mesh.faces_end(); f++) {
+        auto h = f->halfedge();
+        do {
+            sum += weight * h->vertex()->pos.y;
+            h = h->next();
+        } while(h != f->halfedge());
+    }
+    return sum;
+}
+
+// Picks edges whose neighborhoods don't overlap, so collapsing one leaves the others valid
+std::vector<Halfedge_Mesh::EdgeRef> independent_edges(Halfedge_Mesh& mesh, size_t stride) {
+    std::vector<Halfedge_Mesh::EdgeRef> ret;
+    std::unordered_set<unsigned int> touched;
+    size_t i = 0;
+    for(auto e = mesh.edges_begin(); e != mesh.edges_end(); e++, i++) {
+        if(i % stride || e->on_boundary()) continue;
+        auto v0 = e->halfedge()->vertex(), v1 = e->halfedge()->twin()->vertex();
+        if(touched.count(v0->id()) || touched.count(v1->id())) continue;
+        for(auto v : {v0, v1}) {
+            auto h = v->halfedge();
+            do {
+                touched.insert(h->twin()->vertex()->id());
+                h = h->twin()->next();
+            } while(h != v->halfedge());
+        }
+        ret.push_back(e);
+    }
+    return ret;
+}
+
+Result run(const std::string& name, const GL::Mesh& input, const Settings& set) {
+
+    Result result;
+    result.name = name;
+
+    auto time = [&](const std::string& op, size_t ops, auto&& f) {
+        Clock::time_point start = Clock::now();
+        f();
+        result.timings.push_back({op, ops, ms_since(start)});
+    };
+    auto check = [&](Halfedge_Mesh& mesh, const char* op) {
+        auto err = mesh.validate();
+        if(err.has_value() && result.error.empty()) result.error = op + (": " + err->second);
+        return !err.has_value();
+    };
+    auto all_edges = [](Halfedge_Mesh& mesh) {
+        std::vector<Halfedge_Mesh::EdgeRef> edges;
+        for(auto e = mesh.edges_begin(); e != mesh.edges_end(); e++) edges.push_back(e);
+        return edges;
+    };
+
+    Halfedge_Mesh mesh;
+    time("from_mesh", input.indices().size() / 3, [&]() {
+        std::string err = mesh.from_mesh(input);
+        if(!err.empty()) result.error = err;
+    });
+    if(!result.error.empty()) return result;
+
+    result.vertices = mesh.n_vertices();
+    result.edges = mesh.n_edges();
+    result.faces = mesh.n_faces();
+
+    float sum = 0.0f;
+    time("traverse", set.passes * mesh.n_halfedges() * 2, [&]() {
+        for(int i = 0; i < set.passes; i++) sum += traverse(mesh, (float)(i + 1));
+    });
+
+    Halfedge_Mesh copy;
+    time("copy_to", set.passes * mesh.n_halfedges(), [&]() {
+        for(int i = 0; i < set.passes; i++) mesh.copy_to(copy);
+    });
+    time("validate", set.passes * mesh.n_halfedges(), [&]() {
+        for(int i = 0; i < set.passes; i++) check(copy, "validate");
+    });
+
+    // Each local operation starts from a fresh copy of the input
+    mesh.copy_to(copy);
+    std::vector<Halfedge_Mesh::EdgeRef> edges = all_edges(copy);
+    time("flip_edge", edges.size(), [&]() {
+        for(auto e : edges) copy.flip_edge(e);
+    });
+    check(copy, "flip_edge");
+
+    mesh.copy_to(copy);
+    edges = all_edges(copy);
+    edges.resize(edges.size() / 2);
+    time("split_edge", edges.size(), [&]() {
+        for(auto e : edges) copy.split_edge(e);
+    });
+    check(copy, "split_edge");
+
+    // Collapse edges spread over the mesh, then erase the removed elements
+    mesh.copy_to(copy);
+    edges = independent_edges(copy, 3);
+    time("collapse_edge", edges.size(), [&]() {
+        for(auto e : edges) copy.collapse_edge(e);
+        copy.do_erase();
+    });
+    if(!check(copy, "collapse_edge")) return result;
+
+    // Splitting again fills the slots freed by the collapses
+    edges = all_edges(copy);
+    edges.resize(edges.size() / 4);
+    time("split_after_collapse", edges.size(), [&]() {
+        for(auto e : edges) copy.split_edge(e);
+    });
+    if(!check(copy, "split_after_collapse")) return result;
+
+    time("traverse_after_edits", copy.n_halfedges() * 2, [&]() { sum += traverse(copy, 1.0f); });
+
+    // Also keeps the traversals from being optimized out
+    if(!std::isfinite(sum)) result.error = "traverse: non-finite positions";
+
+    return result;
+}
+
+void write_result(FILE* out, const Result& r) {
+    fprintf(out, "        {\"name\": %s, \"vertices\": %zu, \"edges\": %zu, \"faces\": %zu, ",
+            json_string(r.name).c_str(), r.vertices, r.edges, r.faces);
+    fprintf(out, "\"error\": %s, \"timings\": [", json_string(r.error).c_str());
+    for(size_t i = 0; i < r.timings.size(); i++) {
+        const Timing& t = r.timings[i];
+        double mops = t.ms > 0.0 ? t.ops / (t.ms * 1000.0) : 0.0;
+        fprintf(out, "%s\n            {\"op\": %s, \"count\": %zu, ", i ? "," : "",
+                json_string(t.name).c_str(), t.ops);
+        fprintf(out, "\"ms\": %.3f, \"mops_per_s\": %.4f}", t.ms, mops);
+    }
+    fprintf(out, "\n        ]}");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+
+    Settings set;
+    CLI::App args{"Cardinal3D - halfedge mesh benchmark"};
+
+    args.add_option("--sphere", set.sphere_subdivisions, "Subdivisions of the generated spheres");
+    args.add_option("--torus", set.torus_segments, "Segments of the generated tori");
+    args.add_option("--passes", set.passes, "Repetitions of the traversal, copy and validation");
+    args.add_option("-o,--output", set.output_file, "JSON file to write");
+
+    CLI11_PARSE(args, argc, argv);
+
+    set.passes = std::max(set.passes, 1);
+
+    FILE* out = fopen(set.output_file.c_str(), "w");
+    if(!out) die("Failed to open %s for writing", set.output_file.c_str());
+
+    fprintf(out, "{\n    \"passes\": %d,\n    \"inputs\": [", set.passes);
+
+    bool first = true;
+    auto bench = [&](const std::string& name, const GL::Mesh& mesh) {
+        Result result = run(name, mesh, set);
+        fprintf(out, "%s\n", first ? "" : ",");
+        first = false;
+        write_result(out, result);
+        fflush(out);
+
+        if(!result.error.empty()) warn("%s: %s", name.c_str(), result.error.c_str());
+        for(const Timing& t : result.timings) {
+            info("%s, %s: %.2fms (%.2f Mops/s)", name.c_str(), t.name.c_str(), t.ms,
+                 t.ms > 0.0 ? t.ops / (t.ms * 1000.0) : 0.0);
+        }
+    };
+
+    for(int subdivisions : set.sphere_subdivisions) {
+        bench("sphere_" + std::to_string(subdivisions), Util::sphere_mesh(1.0f, subdivisions));
+    }
+    for(int segments : set.torus_segments) {
+        bench("torus_" + std::to_string(segments),
+              Util::torus_mesh(0.5f, 1.0f, segments, std::max(segments / 2, 3)));
+    }
+
+    fprintf(out, "\n    ]\n}\n");
+    fclose(out);
+    return 0;
+}
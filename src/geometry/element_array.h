@@ -0,0 +1,349 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template<typename T> class Element_Array;
+
+/*
+    Reference to an element of an Element_Array, which doubles as an iterator over it.
+    It is just a pointer: elements never move, and the chunk holding an element can be
+    found from its address, so incrementing skips to the next live element (and index()
+    finds the element's index) without a reference to the array.
+*/
+template<typename T> class Element_Ref {
+    using Value = std::remove_const_t<T>;
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Value;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    Element_Ref() = default;
+    // References to mutable elements convert to references to const ones
+    template<typename U, typename = std::enable_if_t<std::is_same_v<const U, T>>>
+    Element_Ref(const Element_Ref<U>& ref) : ptr(ref.ptr) {
+    }
+
+    T& operator*() const {
+        return *ptr;
+    }
+    T* operator->() const {
+        return ptr;
+    }
+
+    Element_Ref& operator++() {
+        ptr = Element_Array<Value>::next_live(ptr);
+        return *this;
+    }
+    Element_Ref operator++(int) {
+        Element_Ref ret = *this;
+        ++*this;
+        return ret;
+    }
+
+    // Dense index of the element in its array, valid until the array is compacted
+    uint32_t index() const {
+        return Element_Array<Value>::index_of(ptr);
+    }
+
+    template<typename U> bool operator==(const Element_Ref<U>& ref) const {
+        return ptr == ref.ptr;
+    }
+    template<typename U> bool operator!=(const Element_Ref<U>& ref) const {
+        return ptr != ref.ptr;
+    }
+    // Orders references by address, for use as keys of ordered containers
+    template<typename U> bool operator<(const Element_Ref<U>& ref) const {
+        return ptr < ref.ptr;
+    }
+
+private:
+    explicit Element_Ref(T* ptr) : ptr(ptr) {
+    }
+    T* ptr = nullptr;
+
+    template<typename U> friend class Element_Ref;
+    friend class Element_Array<Value>;
+};
+
+/*
+    Storage for one type of mesh element. Elements are allocated from fixed-size chunks,
+    so there is one allocation per chunk rather than per element, and elements created
+    together sit next to each other in memory. Erased slots go on a free list and are
+    reused by later insertions, so unlike a linked list, new elements are not necessarily
+    visited last when iterating. compact() on the owning mesh removes the holes left
+    by erased elements.
+
+    Elements may also be marked for erasure, which keeps them alive (and visited by
+    iteration) until erase_marked() is called.
+*/
+template<typename T> class Element_Array {
+public:
+    using iterator = Element_Ref<T>;
+    using const_iterator = Element_Ref<const T>;
+
+    Element_Array() = default;
+    ~Element_Array() {
+        clear();
+    }
+
+    Element_Array(const Element_Array&) = delete;
+    Element_Array& operator=(const Element_Array&) = delete;
+
+    Element_Array(Element_Array&& src) noexcept {
+        *this = std::move(src);
+    }
+    Element_Array& operator=(Element_Array&& src) noexcept {
+        if(this == &src) return *this;
+        clear();
+        std::swap(chunks, src.chunks);
+        std::swap(free_slots, src.free_slots);
+        std::swap(marked, src.marked);
+        std::swap(n_live, src.n_live);
+        std::swap(n_slots, src.n_slots);
+        return *this;
+    }
+
+    template<typename... Args> iterator emplace(Args&&... args) {
+        T* slot = allocate();
+        new(slot) T(std::forward<Args>(args)...);
+        state_of(slot) = State::live;
+        n_live++;
+        return iterator(slot);
+    }
+
+    // Destroys an element right away, putting its slot on the free list
+    void erase(const_iterator it) {
+        T* item = const_cast<T*>(it.ptr);
+        assert(state_of(item) != State::free);
+        item->~T();
+        state_of(item) = State::free;
+        free_slots.push_back(item);
+        n_live--;
+    }
+
+    // Marks an element to be erased by the next call to erase_marked
+    void mark_erased(const_iterator it) {
+        T* item = const_cast<T*>(it.ptr);
+        State& state = state_of(item);
+        if(state != State::live) return;
+        state = State::erased;
+        marked.push_back(item);
+    }
+    bool is_marked(const_iterator it) const {
+        return state_of(it.ptr) == State::erased;
+    }
+    void erase_marked() {
+        for(T* item : marked) {
+            if(state_of(item) == State::erased) erase(iterator(item));
+        }
+        marked.clear();
+    }
+
+    void clear() {
+        for(Chunk* chunk : chunks) {
+            for(uint32_t i = 0; i < chunk->used; i++) {
+                if(chunk->state[i] != State::free) chunk->item(i)->~T();
+            }
+            chunk->~Chunk();
+            ::operator delete(chunk, std::align_val_t(chunk_align));
+        }
+        chunks.clear();
+        free_slots.clear();
+        marked.clear();
+        n_live = n_slots = 0;
+    }
+
+    /*
+        Makes this array a slot-for-slot copy of src, holes included, so every element keeps
+        its index. Chunks are copied wholesale (with memcpy when the element type allows),
+        and a reference into src is moved over to the copy with translate(). src must not
+        have elements marked for erasure.
+    */
+    void clone_from(const Element_Array& src) {
+        assert(src.marked.empty());
+        clear();
+        reserve(src.n_slots);
+        for(size_t c = 0; c < chunks.size(); c++) {
+            const Chunk* from = src.chunks[c];
+            Chunk* to = chunks[c];
+            to->used = from->used;
+            std::memcpy(to->state, from->state, from->used * sizeof(State));
+            if constexpr(std::is_trivially_copyable_v<T>) {
+                std::memcpy(to->storage, from->storage, from->used * sizeof(T));
+            } else {
+                for(uint32_t i = 0; i < from->used; i++) {
+                    if(from->state[i] != State::free) new(to->item(i)) T(*from->item(i));
+                }
+            }
+        }
+        free_slots.reserve(src.free_slots.size());
+        for(const T* slot : src.free_slots) free_slots.push_back(translate_ptr(slot));
+        n_live = src.n_live;
+        n_slots = src.n_slots;
+    }
+
+    // The element at the same index in this array as ref is in the array this was cloned
+    // from: the same offset into the corresponding chunk.
+    template<typename U> iterator translate(const Element_Ref<U>& ref) const {
+        return iterator(ref.ptr ? translate_ptr(ref.ptr) : nullptr);
+    }
+
+    // Allocates chunks up front for n elements in total
+    void reserve(size_t n) {
+        chunks.reserve((n + chunk_items - 1) / chunk_items);
+        while(chunks.size() * chunk_items < n) add_chunk();
+    }
+
+    // Number of elements, including those marked for erasure
+    size_t size() const {
+        return n_live;
+    }
+    bool empty() const {
+        return n_live == 0;
+    }
+    // Number of slots handed out so far: element indices are always below this
+    size_t slots() const {
+        return n_slots;
+    }
+    // Number of free slots left behind by erased elements
+    size_t holes() const {
+        return free_slots.size();
+    }
+
+    // Element with the given index, or end() if that slot is free
+    iterator at(size_t index) {
+        return iterator(item_at(index));
+    }
+    const_iterator at(size_t index) const {
+        return const_iterator(item_at(index));
+    }
+
+    iterator begin() {
+        return iterator(first_live());
+    }
+    const_iterator begin() const {
+        return const_iterator(first_live());
+    }
+    iterator end() {
+        return iterator();
+    }
+    const_iterator end() const {
+        return const_iterator();
+    }
+
+private:
+    enum class State : uint8_t { free, live, erased };
+
+    // Chunks are allocated aligned to their (power of two) size, so the chunk holding an
+    // element is found by rounding its address down. As many elements as fit are packed
+    // in after the header and the per-slot states.
+    static constexpr size_t chunk_bytes = 16384;
+    static constexpr uint32_t chunk_items =
+        (uint32_t)((chunk_bytes - 2 * sizeof(void*) - alignof(T)) / (sizeof(T) + 1));
+    static_assert(chunk_items >= 16, "Element type is too large for Element_Array chunks");
+
+    struct Chunk {
+        Chunk* next = nullptr;
+        uint32_t base = 0, used = 0;
+        State state[chunk_items] = {};
+        alignas(T) unsigned char storage[chunk_items * sizeof(T)];
+
+        T* item(uint32_t i) {
+            return std::launder(reinterpret_cast<T*>(storage + i * sizeof(T)));
+        }
+        uint32_t slot(const T* item) const {
+            return (uint32_t)((reinterpret_cast<const unsigned char*>(item) - storage) /
+                              sizeof(T));
+        }
+    };
+
+    static constexpr size_t chunk_align = chunk_bytes;
+    static_assert(sizeof(Chunk) <= chunk_bytes);
+
+    static Chunk* chunk_of(const T* item) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(item);
+        return reinterpret_cast<Chunk*>(addr & ~(uintptr_t)(chunk_align - 1));
+    }
+    static State& state_of(const T* item) {
+        Chunk* chunk = chunk_of(item);
+        return chunk->state[chunk->slot(item)];
+    }
+    static uint32_t index_of(const T* item) {
+        Chunk* chunk = chunk_of(item);
+        return chunk->base + chunk->slot(item);
+    }
+
+    template<typename P> static P* next_live(P* item) {
+        Chunk* chunk = chunk_of(item);
+        uint32_t i = chunk->slot(item) + 1;
+        for(; chunk; chunk = chunk->next, i = 0) {
+            for(; i < chunk->used; i++) {
+                if(chunk->state[i] != State::free) return chunk->item(i);
+            }
+        }
+        return nullptr;
+    }
+
+    T* translate_ptr(const T* item) const {
+        const Chunk* from = chunk_of(item);
+        auto offset = reinterpret_cast<const unsigned char*>(item) -
+                      reinterpret_cast<const unsigned char*>(from);
+        Chunk* to = chunks[from->base / chunk_items];
+        return std::launder(reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(to) + offset));
+    }
+
+    T* item_at(size_t index) const {
+        if(index >= n_slots) return nullptr;
+        Chunk* chunk = chunks[index / chunk_items];
+        uint32_t i = (uint32_t)(index % chunk_items);
+        return chunk->state[i] != State::free ? chunk->item(i) : nullptr;
+    }
+
+    T* first_live() const {
+        if(chunks.empty() || chunks[0]->used == 0) return nullptr;
+        T* first = chunks[0]->item(0);
+        return chunks[0]->state[0] != State::free ? first : next_live(first);
+    }
+
+    void add_chunk() {
+        void* mem = ::operator new(chunk_align, std::align_val_t(chunk_align));
+        // Not value-initialized: the element storage is left untouched until it is used
+        Chunk* chunk = new(mem) Chunk;
+        chunk->base = (uint32_t)(chunks.size() * chunk_items);
+        if(!chunks.empty()) chunks.back()->next = chunk;
+        chunks.push_back(chunk);
+    }
+
+    T* allocate() {
+        if(!free_slots.empty()) {
+            T* slot = free_slots.back();
+            free_slots.pop_back();
+            return slot;
+        }
+        // Chunks past the last used one may have been reserved already
+        size_t c = n_slots++ / chunk_items;
+        if(c == chunks.size()) add_chunk();
+        Chunk* chunk = chunks[c];
+        return chunk->item(chunk->used++);
+    }
+
+    std::vector<Chunk*> chunks;
+    std::vector<T*> free_slots;
+    std::vector<T*> marked;
+    size_t n_live = 0, n_slots = 0;
+
+    friend class Element_Ref<T>;
+    friend class Element_Ref<const T>;
+};
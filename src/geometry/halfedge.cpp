@@ -1,12 +1,14 @@
 
 #include "halfedge.h"
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <set>
 #include <sstream>
-#include <unordered_map>
 
 #include "../gui/widgets.h"
+#include "../util/thread_pool.h"
 
 Halfedge_Mesh::Halfedge_Mesh() {
     next_id = Gui::n_Widget_IDs;
@@ -28,8 +30,12 @@ void Halfedge_Mesh::clear() {
     vertices.clear();
     edges.clear();
     faces.clear();
+    layout.reset();
+    attributes.all_dirty = true;
+    last_snapshot.reset();
     render_dirty_flag = true;
     next_id = Gui::n_Widget_IDs;
+    end_local_check();
 }
 
 void Halfedge_Mesh::copy_to(Halfedge_Mesh& mesh) {
@@ -37,64 +43,71 @@ void Halfedge_Mesh::copy_to(Halfedge_Mesh& mesh) {
 }
 
 Halfedge_Mesh::ElementRef Halfedge_Mesh::copy_to(Halfedge_Mesh& mesh, unsigned int eid) {
-
-    // Erase erase lists
     do_erase();
+    clone_to(mesh);
+    return mesh.element_with_id(eid);
+}
 
-    // Clear any existing elements.
-    mesh.clear();
-    ElementRef ret = vertices_begin();
-
-    // These maps will be used to identify elements of the old mesh
-    // with elements of the new mesh.  (Note that we can use a single
-    // map for both interior and boundary faces, because the map
-    // doesn't care which list of faces these iterators come from.)
-    std::unordered_map<unsigned int, HalfedgeRef> halfedgeOldToNew(n_halfedges());
-    std::unordered_map<unsigned int, VertexRef> vertexOldToNew(n_vertices());
-    std::unordered_map<unsigned int, EdgeRef> edgeOldToNew(n_edges());
-    std::unordered_map<unsigned int, FaceRef> faceOldToNew(n_faces());
-
-    // Copy geometry from the original mesh and create a map from
-    // pointers in the original mesh to those in the new mesh.
-    for(HalfedgeCRef h = halfedges_begin(); h != halfedges_end(); h++) {
-        auto hn = mesh.halfedges.insert(mesh.halfedges.end(), *h);
-        if(h->id() == eid) ret = hn;
-        halfedgeOldToNew[h->id()] = hn;
-    }
-    for(VertexCRef v = vertices_begin(); v != vertices_end(); v++) {
-        auto vn = mesh.vertices.insert(mesh.vertices.end(), *v);
-        if(v->id() == eid) ret = vn;
-        vertexOldToNew[v->id()] = vn;
-    }
-    for(EdgeCRef e = edges_begin(); e != edges_end(); e++) {
-        auto en = mesh.edges.insert(mesh.edges.end(), *e);
-        if(e->id() == eid) ret = en;
-        edgeOldToNew[e->id()] = en;
-    }
-    for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
-        auto fn = mesh.faces.insert(mesh.faces.end(), *f);
-        if(f->id() == eid) ret = fn;
-        faceOldToNew[f->id()] = fn;
-    }
+void Halfedge_Mesh::clone_to(Halfedge_Mesh& mesh) const {
 
-    // "Search and replace" old pointers with new ones.
-    for(HalfedgeRef he = mesh.halfedges_begin(); he != mesh.halfedges_end(); he++) {
-        he->next() = halfedgeOldToNew[he->next()->id()];
-        he->twin() = halfedgeOldToNew[he->twin()->id()];
-        he->vertex() = vertexOldToNew[he->vertex()->id()];
-        he->edge() = edgeOldToNew[he->edge()->id()];
-        he->face() = faceOldToNew[he->face()->id()];
+    mesh.clear();
+    mesh.halfedges.clone_from(halfedges);
+    mesh.vertices.clone_from(vertices);
+    mesh.edges.clone_from(edges);
+    mesh.faces.clone_from(faces);
+
+    // Every element kept its index, so each reference just moves over to the same slot
+    // in the copy's arrays. No lookup tables or hashing needed.
+    for(HalfedgeRef h = mesh.halfedges_begin(); h != mesh.halfedges_end(); h++) {
+        h->_next = mesh.halfedges.translate(h->_next);
+        h->_twin = mesh.halfedges.translate(h->_twin);
+        h->_vertex = mesh.vertices.translate(h->_vertex);
+        h->_edge = mesh.edges.translate(h->_edge);
+        h->_face = mesh.faces.translate(h->_face);
     }
     for(VertexRef v = mesh.vertices_begin(); v != mesh.vertices_end(); v++)
-        v->halfedge() = halfedgeOldToNew[v->halfedge()->id()];
+        v->_halfedge = mesh.halfedges.translate(v->_halfedge);
     for(EdgeRef e = mesh.edges_begin(); e != mesh.edges_end(); e++)
-        e->halfedge() = halfedgeOldToNew[e->halfedge()->id()];
+        e->_halfedge = mesh.halfedges.translate(e->_halfedge);
     for(FaceRef f = mesh.faces_begin(); f != mesh.faces_end(); f++)
-        f->halfedge() = halfedgeOldToNew[f->halfedge()->id()];
+        f->_halfedge = mesh.halfedges.translate(f->_halfedge);
 
     mesh.render_dirty_flag = true;
     mesh.next_id = next_id;
-    return ret;
+}
+
+Halfedge_Mesh::ElementRef Halfedge_Mesh::element_with_id(unsigned int id) {
+    if(id) {
+        for(VertexRef v = vertices_begin(); v != vertices_end(); v++)
+            if(v->id() == id) return v;
+        for(EdgeRef e = edges_begin(); e != edges_end(); e++)
+            if(e->id() == id) return e;
+        for(FaceRef f = faces_begin(); f != faces_end(); f++)
+            if(f->id() == id) return f;
+        for(HalfedgeRef h = halfedges_begin(); h != halfedges_end(); h++)
+            if(h->id() == id) return h;
+    }
+    return vertices_begin();
+}
+
+Halfedge_Mesh::Snapshot Halfedge_Mesh::snapshot() {
+    do_erase();
+    if(!last_snapshot) {
+        auto copy = std::make_shared<Halfedge_Mesh>();
+        clone_to(*copy);
+        last_snapshot = std::move(copy);
+    }
+    return last_snapshot;
+}
+
+void Halfedge_Mesh::restore(const Snapshot& snap) {
+    snap->clone_to(*this);
+    last_snapshot = snap;
+}
+
+Halfedge_Mesh::ElementRef Halfedge_Mesh::restore(const Snapshot& snap, unsigned int eid) {
+    restore(snap);
+    return element_with_id(eid);
 }
 
 Vec3 Halfedge_Mesh::Vertex::neighborhood_center() const {
@@ -203,6 +216,16 @@ Vec3 Halfedge_Mesh::Face::normal() const {
     return n.unit();
 }
 
+float Halfedge_Mesh::Face::area() const {
+    Vec3 n;
+    HalfedgeCRef h = halfedge();
+    do {
+        n += cross(h->vertex()->pos, h->next()->vertex()->pos);
+        h = h->next();
+    } while(h != halfedge());
+    return 0.5f * n.norm();
+}
+
 Vec3 Halfedge_Mesh::Vertex::center() const {
     return pos;
 }
@@ -260,81 +283,518 @@ Vec3 Halfedge_Mesh::center_of(Halfedge_Mesh::ElementRef elem) {
     return pos;
 }
 
+// Marks a triangle, vertex slot or face without a place in the render layout
+static const uint32_t no_index = std::numeric_limits<uint32_t>::max();
+
 void Halfedge_Mesh::to_mesh(GL::Mesh& mesh, bool split_faces) const {
+    Mesh_Data data;
+    export_mesh(data, split_faces);
+    mesh = GL::Mesh(std::move(data.verts), std::move(data.idxs));
+}
 
-    std::vector<GL::Mesh::Vert> verts;
-    std::vector<GL::Mesh::Index> idxs;
+void Halfedge_Mesh::export_mesh(Mesh_Data& data, bool split_faces) const {
+
+    std::vector<GL::Mesh::Vert>& verts = data.verts;
+    std::vector<GL::Mesh::Index>& idxs = data.idxs;
+
+    // Remember where everything goes, so update_mesh can patch it later
+    layout.reset();
+    layout.split_faces = split_faces;
+    layout.flipped = flip_orientation;
+    layout.face_tri.assign(faces.slots(), no_index);
+
+    if(!split_faces) {
+        update_attributes();
+        layout.vertex_slot.assign(vertices.slots(), no_index);
+        layout.slot_vertex.reserve(vertices.size());
+        verts.reserve(vertices.size());
+        for(VertexCRef v = vertices_begin(); v != vertices_end(); v++) {
+            layout.vertex_slot[v.index()] = (uint32_t)verts.size();
+            layout.slot_vertex.push_back(v.index());
+            Vec3 n = cached_normal(v);
+            if(flip_orientation) n = -n;
+            verts.push_back({v->pos, n, v->_id});
+        }
+    }
 
-    if(split_faces) {
+    for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+        if(!f->is_boundary()) layout_face(f, verts, idxs);
+    }
 
-        std::vector<GL::Mesh::Vert> face_verts;
-        for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+    layout.valid = true;
+    layout.n_verts = verts.size();
+    layout.n_idxs = idxs.size();
+    // Past this many changes, rebuilding is about as cheap as patching
+    layout.max_changes = (vertices.size() + faces.size()) / 4 + 64;
+}
 
-            if(f->is_boundary()) continue;
+std::vector<Halfedge_Mesh::Mesh_Data> Halfedge_Mesh::lod_levels(const std::vector<float>& fractions,
+                                                                 bool split_faces,
+                                                                 const Cancel_Token& cancel) const {
+
+    if(cancel.cancelled()) return {};
+
+    Halfedge_Mesh mesh;
+    clone_to(mesh);
+    mesh.flip_orientation = flip_orientation;
+
+    // Besides the levels, stop at checkpoints every 1/64th of the faces to see whether
+    // the build was cancelled
+    Size n = n_faces() - n_boundaries();
+    Size step = std::max(n / 64, Size(1));
+    constexpr size_t checkpoint = std::numeric_limits<size_t>::max();
+    std::vector<Size> targets;
+    std::vector<size_t> level_of;
+    for(size_t l = 0, left = n; l < fractions.size(); l++) {
+        Size target = (Size)(n * fractions[l]);
+        for(; left > target + step; left -= step) {
+            targets.push_back(left - step);
+            level_of.push_back(checkpoint);
+        }
+        targets.push_back(target);
+        level_of.push_back(l);
+        left = target;
+    }
 
-            HalfedgeCRef h = f->halfedge();
-            face_verts.clear();
-            do {
-                VertexCRef v = h->vertex();
-                Vec3 n = v->normal();
-                if(flip_orientation) n = -n;
-                face_verts.push_back({v->pos, n, f->id()});
-                h = h->next();
-            } while(h != f->halfedge());
+    // Every level comes out of the same run, so later ones keep the error quadrics
+    // accumulated for the earlier ones
+    std::vector<Mesh_Data> levels(fractions.size());
+    bool ok = mesh.simplify(targets, std::numeric_limits<float>::infinity(), [&](size_t i) {
+        if(level_of[i] != checkpoint) mesh.export_mesh(levels[level_of[i]], split_faces);
+        return !cancel.cancelled();
+    });
+    if(!ok || cancel.cancelled()) return {};
+    return levels;
+}
+
+void Halfedge_Mesh::update_mesh(GL::Mesh& mesh, bool split_faces) const {
 
-            Vec3 v0 = face_verts[0].pos;
-            for(size_t i = 1; i <= face_verts.size() - 2; i++) {
-                Vec3 v1 = face_verts[i].pos;
-                Vec3 v2 = face_verts[i + 1].pos;
-                Vec3 n = cross(v1 - v0, v2 - v0).unit();
-                if(flip_orientation) n = -n;
-                GL::Mesh::Index idx = (GL::Mesh::Index)verts.size();
-                verts.push_back({v0, n, f->_id});
-                verts.push_back({v1, n, f->_id});
-                verts.push_back({v2, n, f->_id});
-                idxs.push_back(idx);
-                idxs.push_back(idx + 1);
-                idxs.push_back(idx + 2);
+    Render_Layout& L = layout;
+    if(!L.valid || L.split_faces != split_faces || L.flipped != flip_orientation ||
+       L.n_verts != mesh.verts().size() || L.n_idxs != mesh.indices().size()) {
+        to_mesh(mesh, split_faces);
+        return;
+    }
+    if(L.changed_vertices.empty() && L.changed_faces.empty()) return;
+
+    std::vector<GL::Mesh::Vert>& verts = mesh.patch_verts();
+    std::vector<GL::Mesh::Index>& idxs = mesh.patch_indices();
+    L.patching = true;
+    L.face_tri.resize(faces.slots(), no_index);
+    if(!split_faces) L.vertex_slot.resize(vertices.slots(), no_index);
+
+    auto dedup = [](std::vector<uint32_t>& list) {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    };
+    // Logged elements may have been erased (or be about to be) since
+    auto live_vertex = [&](uint32_t i) {
+        VertexCRef v = vertices.at(i);
+        return v != vertices_end() && !vertices.is_marked(v) ? v : vertices_end();
+    };
+    auto live_face = [&](uint32_t i) {
+        FaceCRef f = faces.at(i);
+        return f != faces_end() && !faces.is_marked(f) ? f : faces_end();
+    };
+
+    // Every face around a changed vertex has to be redone: its shape (and so its normals)
+    // may have changed, and with smooth normals, its vertices may have moved in the buffer
+    std::vector<uint32_t> redo_faces = std::move(L.changed_faces);
+    std::vector<uint32_t> redo_verts, moved;
+    auto faces_around = [&](VertexCRef v) {
+        HalfedgeCRef h = v->halfedge();
+        do {
+            redo_faces.push_back(h->face().index());
+            h = h->twin()->next();
+        } while(h != v->halfedge());
+    };
+
+    dedup(L.changed_vertices);
+    for(uint32_t i : L.changed_vertices) {
+        VertexCRef v = live_vertex(i);
+        if(v != vertices_end()) {
+            faces_around(v);
+            if(split_faces) continue;
+            if(L.vertex_slot[i] == no_index) {
+                L.vertex_slot[i] = (uint32_t)L.slot_vertex.size();
+                L.slot_vertex.push_back(i);
+                verts.emplace_back();
             }
+            redo_verts.push_back(i);
+            continue;
+        }
+        if(split_faces || L.vertex_slot[i] == no_index) continue;
+
+        // Fill the erased vertex's slot with the last one, whose faces then need new indices
+        uint32_t slot = L.vertex_slot[i];
+        uint32_t last = (uint32_t)L.slot_vertex.size() - 1;
+        L.vertex_slot[i] = no_index;
+        if(slot != last) {
+            uint32_t w = L.slot_vertex[last];
+            verts[slot] = verts[last];
+            L.slot_vertex[slot] = w;
+            L.vertex_slot[w] = slot;
+            L.touched_verts.push_back(slot);
+            moved.push_back(w);
+        }
+        L.slot_vertex.pop_back();
+        verts.pop_back();
+    }
+    for(uint32_t w : moved) {
+        VertexCRef v = live_vertex(w);
+        if(v != vertices_end()) faces_around(v);
+    }
+
+    dedup(redo_faces);
+    for(uint32_t i : redo_faces) {
+        FaceCRef f = live_face(i);
+        if(f == faces_end() || f->is_boundary()) {
+            while(L.face_tri[i] != no_index) remove_tri(L.face_tri[i], verts, idxs);
+            continue;
+        }
+        layout_face(f, verts, idxs);
+        if(!split_faces) {
+            for(VertexCRef v : L.corners) redo_verts.push_back(v.index());
         }
+    }
 
-    } else {
+    // With smooth normals, a vertex's normal depends on all the faces around it
+    dedup(redo_verts);
+    if(!redo_verts.empty()) update_attributes();
+    for(uint32_t i : redo_verts) {
+        VertexCRef v = vertices.at(i);
+        Vec3 n = cached_normal(v);
+        if(flip_orientation) n = -n;
+        verts[L.vertex_slot[i]] = {v->pos, n, v->_id};
+        L.touched_verts.push_back(L.vertex_slot[i]);
+    }
 
-        // Need to build this map to get vertex's linear index in O(lg n)
-        std::map<VertexCRef, Index> vref_to_idx;
-        Index i = 0;
-        for(VertexCRef v = vertices_begin(); v != vertices_end(); v++, i++) {
-            vref_to_idx[v] = i;
-            Vec3 n = v->normal();
-            if(flip_orientation) n = -n;
-            verts.push_back({v->pos, n, v->_id});
+    // Hand the GL mesh each run of neighbouring slots that changed
+    auto patch = [&](std::vector<uint32_t>& touched, size_t scale, auto&& patched) {
+        dedup(touched);
+        for(size_t j = 0; j < touched.size();) {
+            size_t k = j + 1;
+            while(k < touched.size() && touched[k] == touched[k - 1] + 1) k++;
+            patched(scale * touched[j], scale * (touched[k - 1] + 1));
+            j = k;
         }
+        touched.clear();
+    };
+    auto patch_verts = [&](size_t b, size_t e) { mesh.patched_verts(b, e); };
+    auto patch_idxs = [&](size_t b, size_t e) { mesh.patched_indices(b, e); };
+    if(split_faces) patch(L.touched_tris, 3, patch_verts);
+    patch(L.touched_verts, 1, patch_verts);
+    patch(L.touched_tris, 3, patch_idxs);
+    // Also picks up the new index count when triangles were only removed
+    mesh.patched_indices(0, 0);
+
+    L.patching = false;
+    L.n_verts = verts.size();
+    L.n_idxs = idxs.size();
+    L.changed_vertices.clear();
+    L.changed_faces.clear();
+}
 
-        for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+void Halfedge_Mesh::layout_face(FaceCRef f, std::vector<GL::Mesh::Vert>& verts,
+                                std::vector<GL::Mesh::Index>& idxs) const {
 
-            if(f->is_boundary()) continue;
+    Render_Layout& L = layout;
 
-            std::vector<Index> face_verts;
-            HalfedgeCRef h = f->halfedge();
-            do {
-                face_verts.push_back(vref_to_idx[h->vertex()]);
-                h = h->next();
-            } while(h != f->halfedge());
+    L.corners.clear();
+    HalfedgeCRef h = f->halfedge();
+    do {
+        L.corners.push_back(h->vertex());
+        h = h->next();
+    } while(h != f->halfedge());
+    assert(L.corners.size() >= 3);
+
+    // Fan the face into triangles, reusing the ones it had before
+    uint32_t face = f.index();
+    uint32_t t = L.face_tri[face];
+    for(size_t j = 1; j + 1 < L.corners.size(); j++) {
+
+        uint32_t tri = t;
+        if(tri == no_index) {
+            tri = (uint32_t)L.tri_face.size();
+            L.tri_face.push_back(face);
+            L.tri_next.push_back(L.face_tri[face]);
+            L.tri_prev.push_back(no_index);
+            if(L.face_tri[face] != no_index) L.tri_prev[L.face_tri[face]] = tri;
+            L.face_tri[face] = tri;
+            idxs.resize(3 * (tri + 1));
+            if(L.split_faces) verts.resize(3 * (tri + 1));
+        } else {
+            t = L.tri_next[t];
+        }
+        if(L.patching) L.touched_tris.push_back(tri);
 
-            assert(face_verts.size() >= 3);
-            for(size_t j = 1; j <= face_verts.size() - 2; j++) {
-                idxs.push_back((GL::Mesh::Index)face_verts[0]);
-                idxs.push_back((GL::Mesh::Index)face_verts[j]);
-                idxs.push_back((GL::Mesh::Index)face_verts[j + 1]);
+        VertexCRef v[] = {L.corners[0], L.corners[j], L.corners[j + 1]};
+        if(L.split_faces) {
+            Vec3 n = cross(v[1]->pos - v[0]->pos, v[2]->pos - v[0]->pos).unit();
+            if(flip_orientation) n = -n;
+            for(uint32_t k = 0; k < 3; k++) {
+                verts[3 * tri + k] = {v[k]->pos, n, f->_id};
+                idxs[3 * tri + k] = 3 * tri + k;
+            }
+        } else {
+            for(uint32_t k = 0; k < 3; k++) {
+                uint32_t& slot = L.vertex_slot[v[k].index()];
+                if(slot == no_index) {
+                    // A vertex created while nothing was logged; update_mesh fills it in
+                    // along with the rest of the face's corners
+                    slot = (uint32_t)L.slot_vertex.size();
+                    L.slot_vertex.push_back(v[k].index());
+                    verts.emplace_back();
+                }
+                idxs[3 * tri + k] = slot;
             }
         }
     }
 
-    mesh = GL::Mesh(std::move(verts), std::move(idxs));
+    // Drop the triangles left over from a face that lost corners
+    if(t != no_index) {
+        std::vector<uint32_t> extra;
+        for(; t != no_index; t = L.tri_next[t]) extra.push_back(t);
+        std::sort(extra.rbegin(), extra.rend());
+        for(uint32_t tri : extra) remove_tri(tri, verts, idxs);
+    }
+}
+
+void Halfedge_Mesh::remove_tri(uint32_t t, std::vector<GL::Mesh::Vert>& verts,
+                               std::vector<GL::Mesh::Index>& idxs) const {
+
+    Render_Layout& L = layout;
+
+    uint32_t prev = L.tri_prev[t], next = L.tri_next[t];
+    if(prev != no_index)
+        L.tri_next[prev] = next;
+    else
+        L.face_tri[L.tri_face[t]] = next;
+    if(next != no_index) L.tri_prev[next] = prev;
+
+    // Move the last triangle into the hole
+    uint32_t last = (uint32_t)L.tri_face.size() - 1;
+    if(t != last) {
+        for(uint32_t k = 0; k < 3; k++) {
+            if(L.split_faces)
+                verts[3 * t + k] = verts[3 * last + k];
+            else
+                idxs[3 * t + k] = idxs[3 * last + k];
+        }
+        prev = L.tri_prev[last];
+        next = L.tri_next[last];
+        L.tri_face[t] = L.tri_face[last];
+        L.tri_prev[t] = prev;
+        L.tri_next[t] = next;
+        if(prev != no_index)
+            L.tri_next[prev] = t;
+        else
+            L.face_tri[L.tri_face[t]] = t;
+        if(next != no_index) L.tri_prev[next] = t;
+        if(L.patching) L.touched_tris.push_back(t);
+    }
+
+    L.tri_face.pop_back();
+    L.tri_prev.pop_back();
+    L.tri_next.pop_back();
+    idxs.resize(3 * last);
+    if(L.split_faces) verts.resize(3 * last);
+}
+
+void Halfedge_Mesh::mark_changed(ElementRef elem) {
+    last_snapshot.reset();
+    if(!layout.valid && !attributes.tracking()) return;
+    // update_mesh redoes the faces around each changed vertex
+    auto vertex = [&](VertexCRef v) {
+        changed(v);
+        if(attributes.tracking()) invalidate_around(v);
+    };
+    auto edge = [&](EdgeRef e) {
+        vertex(e->halfedge()->vertex());
+        vertex(e->halfedge()->twin()->vertex());
+    };
+    std::visit(overloaded{[&](VertexRef vert) { vertex(vert); }, edge,
+                          [&](FaceRef face) {
+                              HalfedgeRef h = face->halfedge();
+                              do {
+                                  vertex(h->vertex());
+                                  h = h->next();
+                              } while(h != face->halfedge());
+                          },
+                          [&](HalfedgeRef he) { edge(he->edge()); }},
+               elem);
+}
+
+void Halfedge_Mesh::log_change(std::vector<uint32_t>& log, uint32_t index) {
+    log.push_back(index);
+    if(layout.changed_vertices.size() + layout.changed_faces.size() > layout.max_changes) {
+        // Too much to patch: stop keeping track, update_mesh will rebuild everything
+        layout.reset();
+    }
+}
+
+void Halfedge_Mesh::Render_Layout::reset() {
+    valid = false;
+    n_verts = n_idxs = max_changes = 0;
+    for(std::vector<uint32_t>* list : {&vertex_slot, &slot_vertex, &face_tri, &tri_face,
+                                       &tri_next, &tri_prev, &changed_vertices, &changed_faces}) {
+        std::vector<uint32_t>().swap(*list);
+    }
 }
 
 void Halfedge_Mesh::mark_dirty() {
     render_dirty_flag = true;
+    last_snapshot.reset();
+    attributes.all_dirty = true;
+}
+
+void Halfedge_Mesh::cache_attributes(bool enable) {
+    if(attributes.enabled == enable) return;
+    attributes = {};
+    attributes.enabled = enable;
+}
+
+void Halfedge_Mesh::update_attributes() const {
+
+    Attribute_Cache& A = attributes;
+    if(!A.enabled) return;
+
+    // Logged elements may have been erased (or be about to be) since
+    auto live = [](const auto& array, size_t i) {
+        auto elem = array.at(i);
+        return elem != array.end() && !array.is_marked(elem) ? elem : array.end();
+    };
+    auto vertex = [&](size_t i) {
+        VertexCRef v = live(vertices, i);
+        if(v == vertices_end()) return;
+        A.vertex_normal[i] = v->normal();
+        A.vertex_dirty[i] = 0;
+    };
+    auto face = [&](size_t i) {
+        FaceCRef f = live(faces, i);
+        if(f == faces_end()) return;
+        A.face_normal[i] = f->normal();
+        A.face_center[i] = f->center();
+        A.face_area[i] = f->area();
+        A.face_dirty[i] = 0;
+    };
+    auto edge = [&](size_t i) {
+        EdgeCRef e = live(edges, i);
+        if(e == edges_end()) return;
+        A.edge_length[i] = e->length();
+        A.edge_dirty[i] = 0;
+    };
+
+    size_t n_v = vertices.slots(), n_f = faces.slots(), n_e = edges.slots();
+    A.vertex_normal.resize(n_v);
+    A.face_normal.resize(n_f);
+    A.face_center.resize(n_f);
+    A.face_area.resize(n_f);
+    A.edge_length.resize(n_e);
+
+    if(A.all_dirty) {
+        A.vertex_dirty.assign(n_v, 1);
+        A.face_dirty.assign(n_f, 1);
+        A.edge_dirty.assign(n_e, 1);
+        A.dirty_vertices.clear();
+        A.dirty_faces.clear();
+        A.dirty_edges.clear();
+
+        auto each = [](auto&& f) {
+            return [&f](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; i++) f(i);
+            };
+        };
+        Thread_Pool& pool = Thread_Pool::shared();
+        pool.parallel_for(0, n_v, 4096, each(vertex));
+        pool.parallel_for(0, n_f, 4096, each(face));
+        pool.parallel_for(0, n_e, 4096, each(edge));
+        A.all_dirty = false;
+        return;
+    }
+
+    // Elements created since the last update are past the end of the flags
+    auto grow = [](std::vector<uint8_t>& dirty, std::vector<uint32_t>& list, size_t n) {
+        for(size_t i = dirty.size(); i < n; i++) list.push_back((uint32_t)i);
+        if(n > dirty.size()) dirty.resize(n, 1);
+    };
+    grow(A.vertex_dirty, A.dirty_vertices, n_v);
+    grow(A.face_dirty, A.dirty_faces, n_f);
+    grow(A.edge_dirty, A.dirty_edges, n_e);
+
+    for(uint32_t i : A.dirty_vertices) vertex(i);
+    for(uint32_t i : A.dirty_faces) face(i);
+    for(uint32_t i : A.dirty_edges) edge(i);
+    A.dirty_vertices.clear();
+    A.dirty_faces.clear();
+    A.dirty_edges.clear();
+}
+
+Vec3 Halfedge_Mesh::cached_normal(VertexCRef v) const {
+    uint32_t i = v.index();
+    return attributes.fresh(attributes.vertex_dirty, i) ? attributes.vertex_normal[i]
+                                                        : v->normal();
+}
+
+Vec3 Halfedge_Mesh::cached_normal(FaceCRef f) const {
+    uint32_t i = f.index();
+    return attributes.fresh(attributes.face_dirty, i) ? attributes.face_normal[i] : f->normal();
+}
+
+Vec3 Halfedge_Mesh::cached_center(FaceCRef f) const {
+    uint32_t i = f.index();
+    return attributes.fresh(attributes.face_dirty, i) ? attributes.face_center[i] : f->center();
+}
+
+float Halfedge_Mesh::cached_area(FaceCRef f) const {
+    uint32_t i = f.index();
+    return attributes.fresh(attributes.face_dirty, i) ? attributes.face_area[i] : f->area();
+}
+
+float Halfedge_Mesh::cached_length(EdgeCRef e) const {
+    uint32_t i = e.index();
+    return attributes.fresh(attributes.edge_dirty, i) ? attributes.edge_length[i]
+                                                      : e->length();
+}
+
+void Halfedge_Mesh::Attribute_Cache::invalidate(std::vector<uint8_t>& dirty,
+                                                std::vector<uint32_t>& list, uint32_t index) {
+    // Elements past the end are new, and picked up by update_attributes anyway
+    if(index >= dirty.size() || dirty[index]) return;
+    dirty[index] = 1;
+    list.push_back(index);
+    // Past this point, recomputing everything in parallel is cheaper
+    if(list.size() > dirty.size() / 4 + 64) all_dirty = true;
+}
+
+void Halfedge_Mesh::invalidate_around(VertexCRef v) {
+
+    Attribute_Cache& A = attributes;
+    auto vertex = [&](VertexCRef u) { A.invalidate(A.vertex_dirty, A.dirty_vertices, u.index()); };
+
+    // Faces and edges touching v change shape, and so do the normals of vertices that see v
+    // as one of the next two corners around a face (see Vertex::normal)
+    vertex(v);
+    HalfedgeCRef h = v->halfedge();
+    do {
+        A.invalidate(A.edge_dirty, A.dirty_edges, h->edge().index());
+        FaceCRef f = h->face();
+        A.invalidate(A.face_dirty, A.dirty_faces, f.index());
+        HalfedgeCRef c = f->halfedge();
+        if(f->is_boundary()) {
+            // Boundary loops can be long: just find the two corners before v
+            c = h;
+            while(c->next()->next() != h) c = c->next();
+            vertex(c->vertex());
+            vertex(c->next()->vertex());
+        } else {
+            do {
+                vertex(c->vertex());
+                c = c->next();
+            } while(c != f->halfedge());
+        }
+        h = h->twin()->next();
+    } while(h != v->halfedge());
 }
 
 std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::warnings() {
@@ -375,32 +835,33 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
         if(!finite) return {{v, "A vertex position was set to a non-finite value."}};
     }
 
-    std::set<HalfedgeRef> permutation;
+    // Marks which halfedges are the next of some halfedge, by index
+    std::vector<bool> permutation(halfedges.slots());
 
     // Check valid halfedge permutation
     for(HalfedgeRef h = halfedges_begin(); h != halfedges_end(); h++) {
 
-        if(herased.find(h) != herased.end()) continue;
+        if(halfedges.is_marked(h)) continue;
 
-        if(herased.find(h->next()) != herased.end()) {
+        if(halfedges.is_marked(h->next())) {
             return {{h, "A live halfedge's next was erased!"}};
         }
-        if(herased.find(h->twin()) != herased.end()) {
+        if(halfedges.is_marked(h->twin())) {
             return {{h, "A live halfedge's twin was erased!"}};
         }
-        if(verased.find(h->vertex()) != verased.end()) {
+        if(vertices.is_marked(h->vertex())) {
             return {{h, "A live halfedge's vertex was erased!"}};
         }
-        if(ferased.find(h->face()) != ferased.end()) {
+        if(faces.is_marked(h->face())) {
             return {{h, "A live halfedge's face was erased!"}};
         }
-        if(eerased.find(h->edge()) != eerased.end()) {
+        if(edges.is_marked(h->edge())) {
             return {{h, "A live halfedge's edge was erased!"}};
         }
 
         // Check whether each halfedge's next points to a unique halfedge
-        if(permutation.find(h->next()) == permutation.end()) {
-            permutation.insert(h->next());
+        if(!permutation[h->next().index()]) {
+            permutation[h->next().index()] = true;
         } else {
             return {{h->next(), "A halfedge is the next of multiple halfedges!"}};
         }
@@ -408,10 +869,10 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
 
     for(HalfedgeRef h = halfedges_begin(); h != halfedges_end(); h++) {
 
-        if(herased.find(h) != herased.end()) continue;
+        if(halfedges.is_marked(h)) continue;
 
         // Check whether each halfedge was pointed to by a halfedge
-        if(permutation.find(h) == permutation.end()) {
+        if(!permutation[h.index()]) {
             return {{h, "A halfedge is the next of zero halfedges!"}};
         }
 
@@ -427,10 +888,10 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
     // Check whether each halfedge incident on a vertex points to that vertex
     for(VertexRef v = vertices_begin(); v != vertices_end(); v++) {
 
-        if(verased.find(v) != verased.end()) continue;
+        if(vertices.is_marked(v)) continue;
 
         HalfedgeRef h = v->halfedge();
-        if(herased.find(h) != herased.end()) {
+        if(halfedges.is_marked(h)) {
             return {{v, "A vertex's halfedge is erased!"}};
         }
 
@@ -445,10 +906,10 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
     // Check whether each halfedge incident on an edge points to that edge
     for(EdgeRef e = edges_begin(); e != edges_end(); e++) {
 
-        if(eerased.find(e) != eerased.end()) continue;
+        if(edges.is_marked(e)) continue;
 
         HalfedgeRef h = e->halfedge();
-        if(herased.find(h) != herased.end()) {
+        if(halfedges.is_marked(h)) {
             return {{e, "An edge's halfedge is erased!"}};
         }
 
@@ -463,10 +924,10 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
     // Check whether each halfedge incident on a face points to that face
     for(FaceRef f = faces_begin(); f != faces_end(); f++) {
 
-        if(ferased.find(f) != ferased.end()) continue;
+        if(faces.is_marked(f)) continue;
 
         HalfedgeRef h = f->halfedge();
-        if(herased.find(h) != herased.end()) {
+        if(halfedges.is_marked(h)) {
             return {{f, "A face's halfedge is erased!"}};
         }
 
@@ -482,23 +943,277 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
     return std::nullopt;
 }
 
-void Halfedge_Mesh::do_erase() {
-    for(auto& v : verased) {
-        vertices.erase(v);
+void Halfedge_Mesh::begin_local_check(ElementRef elem) {
+
+    end_local_check();
+    local.active = true;
+
+    std::vector<VertexRef> seeds;
+    auto edge = [&](EdgeRef e) {
+        seeds.push_back(e->halfedge()->vertex());
+        seeds.push_back(e->halfedge()->twin()->vertex());
+    };
+    std::visit(overloaded{[&](VertexRef vert) { seeds.push_back(vert); }, edge,
+                          [&](FaceRef face) {
+                              HalfedgeRef h = face->halfedge();
+                              do {
+                                  seeds.push_back(h->vertex());
+                                  h = h->next();
+                              } while(h != face->halfedge());
+                          },
+                          [&](HalfedgeRef he) { edge(he->edge()); }},
+               elem);
+
+    // The operation may rewire any face around these vertices
+    for(VertexRef v : seeds) {
+        HalfedgeRef h = v->halfedge();
+        do {
+            HalfedgeRef c = h;
+            do {
+                local.halfedges.push_back(c);
+                c = c->next();
+            } while(c != h);
+            h = h->twin()->next();
+        } while(h != v->halfedge());
     }
-    for(auto& e : eerased) {
-        edges.erase(e);
+}
+
+std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::validate_local() {
+
+    // Along with the recorded elements, check whatever the recorded halfedges point to now
+    for(size_t i = 0, n = local.halfedges.size(); i < n; i++) {
+        HalfedgeRef h = local.halfedges[i];
+        if(halfedges.is_marked(h)) continue;
+        local.vertices.push_back(h->vertex());
+        local.edges.push_back(h->edge());
+        local.faces.push_back(h->face());
     }
-    for(auto& f : ferased) {
-        faces.erase(f);
+    auto dedup = [](auto& list) {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    };
+    dedup(local.halfedges);
+    dedup(local.vertices);
+    dedup(local.edges);
+    dedup(local.faces);
+
+    // Walks longer than this have gone around in a loop that misses their start
+    size_t bound = halfedges.size();
+
+    for(VertexRef v : local.vertices) {
+        Vec3 p = v->pos;
+        bool finite = std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+        if(!finite) return {{v, "A vertex position was set to a non-finite value."}};
     }
-    for(auto& h : herased) {
-        halfedges.erase(h);
+
+    for(HalfedgeRef h : local.halfedges) {
+
+        if(halfedges.is_marked(h)) continue;
+
+        if(halfedges.is_marked(h->next())) {
+            return {{h, "A live halfedge's next was erased!"}};
+        }
+        if(halfedges.is_marked(h->twin())) {
+            return {{h, "A live halfedge's twin was erased!"}};
+        }
+        if(vertices.is_marked(h->vertex())) {
+            return {{h, "A live halfedge's vertex was erased!"}};
+        }
+        if(faces.is_marked(h->face())) {
+            return {{h, "A live halfedge's face was erased!"}};
+        }
+        if(edges.is_marked(h->edge())) {
+            return {{h, "A live halfedge's edge was erased!"}};
+        }
+
+        // Stands in for counting how many halfedges each one is the next of: following
+        // next from h must come back to h, which it doesn't if h is the next of none or
+        // if the loop runs into a halfedge that is also the next of another one
+        HalfedgeRef c = h->next();
+        for(size_t n = 0; c != h; n++, c = c->next()) {
+            if(n == bound) return {{h, "A halfedge's next loop does not lead back to it!"}};
+        }
+
+        if(h->twin() == h) {
+            return {{h, "A halfedge's twin is itself!"}};
+        }
+        if(h->twin()->twin() != h) {
+            return {{h, "A halfedge's twin's twin is not itself!"}};
+        }
     }
-    verased.clear();
-    eerased.clear();
-    ferased.clear();
-    herased.clear();
+
+    for(VertexRef v : local.vertices) {
+
+        if(vertices.is_marked(v)) continue;
+
+        HalfedgeRef h = v->halfedge();
+        if(halfedges.is_marked(h)) {
+            return {{v, "A vertex's halfedge is erased!"}};
+        }
+
+        size_t n = 0;
+        do {
+            if(h->vertex() != v) {
+                return {{h, "A vertex's halfedge does not point to that vertex!"}};
+            }
+            if(n++ == bound) return {{v, "A vertex's halfedges do not lead back around!"}};
+            h = h->twin()->next();
+        } while(h != v->halfedge());
+    }
+
+    for(EdgeRef e : local.edges) {
+
+        if(edges.is_marked(e)) continue;
+
+        HalfedgeRef h = e->halfedge();
+        if(halfedges.is_marked(h)) {
+            return {{e, "An edge's halfedge is erased!"}};
+        }
+        if(h->twin()->twin() != h) {
+            return {{h, "A halfedge's twin's twin is not itself!"}};
+        }
+        if(h->edge() != e) {
+            return {{h, "An edge's halfedge does not point to that edge!"}};
+        }
+        if(h->twin()->edge() != e) {
+            return {{h->twin(), "An edge's halfedge does not point to that edge!"}};
+        }
+    }
+
+    for(FaceRef f : local.faces) {
+
+        if(faces.is_marked(f)) continue;
+
+        HalfedgeRef h = f->halfedge();
+        if(halfedges.is_marked(h)) {
+            return {{f, "A face's halfedge is erased!"}};
+        }
+
+        size_t n = 0;
+        do {
+            if(h->face() != f) {
+                return {{h, "A face's halfedge does not point to that face!"}};
+            }
+            if(n++ == bound) return {{f, "A face's halfedges do not lead back around!"}};
+            h = h->next();
+        } while(h != f->halfedge());
+    }
+
+    // The erased elements are about to go away for good
+    auto live = [](auto& list, auto& array) {
+        list.erase(std::remove_if(list.begin(), list.end(),
+                                  [&](auto elem) { return array.is_marked(elem); }),
+                   list.end());
+    };
+    live(local.halfedges, halfedges);
+    live(local.vertices, vertices);
+    live(local.edges, edges);
+    live(local.faces, faces);
+
+    do_erase();
+    return std::nullopt;
+}
+
+std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::warnings_local() {
+
+    // Looks for the same problems as warnings() around each recorded vertex. Coincident
+    // vertices are only found when they are neighbors; repeated edges always share a vertex.
+    std::vector<std::pair<unsigned int, EdgeRef>> ends;
+    for(VertexRef v : local.vertices) {
+        ends.clear();
+        HalfedgeRef h = v->halfedge();
+        do {
+            VertexRef u = h->twin()->vertex();
+            if(u == v) {
+                return {{h->edge(), "Edge wrapping single vertex."}};
+            }
+            if(u->pos == v->pos) {
+                return {{v, "Vertices with identical positions."}};
+            }
+            ends.push_back({u->id(), h->edge()});
+            h = h->twin()->next();
+        } while(h != v->halfedge());
+
+        std::sort(ends.begin(), ends.end());
+        for(size_t i = 1; i < ends.size(); i++) {
+            if(ends[i].first == ends[i - 1].first) {
+                return {{ends[i].second, "Multiple edges across same vertices."}};
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+void Halfedge_Mesh::end_local_check() {
+    local.active = false;
+    local.halfedges.clear();
+    local.vertices.clear();
+    local.edges.clear();
+    local.faces.clear();
+}
+
+void Halfedge_Mesh::do_erase() {
+    vertices.erase_marked();
+    edges.erase_marked();
+    faces.erase_marked();
+    halfedges.erase_marked();
+}
+
+void Halfedge_Mesh::pack_to(Halfedge_Mesh& mesh) const {
+
+    mesh.clear();
+
+    // These tables will be used to identify elements of the old mesh
+    // with elements of the new mesh. They are indexed by the old element's
+    // index in its array, so each lookup is just a load.
+    std::vector<HalfedgeRef> halfedgeOldToNew(halfedges.slots());
+    std::vector<VertexRef> vertexOldToNew(vertices.slots());
+    std::vector<EdgeRef> edgeOldToNew(edges.slots());
+    std::vector<FaceRef> faceOldToNew(faces.slots());
+
+    mesh.halfedges.reserve(n_halfedges());
+    mesh.vertices.reserve(n_vertices());
+    mesh.edges.reserve(n_edges());
+    mesh.faces.reserve(n_faces());
+
+    for(HalfedgeCRef h = halfedges_begin(); h != halfedges_end(); h++)
+        halfedgeOldToNew[h.index()] = mesh.halfedges.emplace(*h);
+    for(VertexCRef v = vertices_begin(); v != vertices_end(); v++)
+        vertexOldToNew[v.index()] = mesh.vertices.emplace(*v);
+    for(EdgeCRef e = edges_begin(); e != edges_end(); e++)
+        edgeOldToNew[e.index()] = mesh.edges.emplace(*e);
+    for(FaceCRef f = faces_begin(); f != faces_end(); f++)
+        faceOldToNew[f.index()] = mesh.faces.emplace(*f);
+
+    // "Search and replace" old pointers with new ones.
+    for(HalfedgeRef he = mesh.halfedges_begin(); he != mesh.halfedges_end(); he++) {
+        he->next() = halfedgeOldToNew[he->next().index()];
+        he->twin() = halfedgeOldToNew[he->twin().index()];
+        he->vertex() = vertexOldToNew[he->vertex().index()];
+        he->edge() = edgeOldToNew[he->edge().index()];
+        he->face() = faceOldToNew[he->face().index()];
+    }
+    for(VertexRef v = mesh.vertices_begin(); v != mesh.vertices_end(); v++)
+        v->halfedge() = halfedgeOldToNew[v->halfedge().index()];
+    for(EdgeRef e = mesh.edges_begin(); e != mesh.edges_end(); e++)
+        e->halfedge() = halfedgeOldToNew[e->halfedge().index()];
+    for(FaceRef f = mesh.faces_begin(); f != mesh.faces_end(); f++)
+        f->halfedge() = halfedgeOldToNew[f->halfedge().index()];
+
+    mesh.next_id = next_id;
+}
+
+void Halfedge_Mesh::compact() {
+    do_erase();
+    if(!vertices.holes() && !edges.holes() && !faces.holes() && !halfedges.holes()) return;
+
+    // Inserting every element in iteration order into fresh arrays packs them
+    Halfedge_Mesh packed;
+    pack_to(packed);
+    packed.flip_orientation = flip_orientation;
+    packed.attributes.enabled = attributes.enabled;
+    *this = std::move(packed);
 }
 
 std::string Halfedge_Mesh::from_mesh(const GL::Mesh& mesh) {
@@ -528,18 +1243,11 @@ std::string Halfedge_Mesh::from_mesh(const GL::Mesh& mesh) {
 
 bool Halfedge_Mesh::subdivide(SubD strategy) {
 
-    std::vector<std::vector<Index>> polys;
-    std::vector<Vec3> verts;
-    std::unordered_map<unsigned int, Index> layout;
-
     switch(strategy) {
-    case SubD::linear: {
-        linear_subdivide_positions();
-    } break;
+    case SubD::linear: break;
 
     case SubD::catmullclark: {
         if(has_boundary()) return false;
-        catmullclark_subdivide_positions();
     } break;
 
     case SubD::loop: {
@@ -547,49 +1255,254 @@ bool Halfedge_Mesh::subdivide(SubD strategy) {
         for(FaceRef f = faces_begin(); f != faces_end(); f++) {
             if(f->degree() != 3) return false;
         }
-        loop_subdivide();
-        return true;
     } break;
 
     default: assert(false);
     }
 
-    Index idx = 0;
-    size_t nV = vertices.size();
-    size_t nE = edges.size();
-    size_t nF = faces.size();
-    verts.resize(nV + nE + nF);
+    // The refined mesh is numbered after the indices of this one, which must have no holes
+    compact();
 
-    for(VertexRef v = vertices_begin(); v != vertices_end(); v++, idx++) {
-        verts[idx] = v->new_pos;
-        layout[v->id()] = idx;
-    }
-    for(EdgeRef e = edges_begin(); e != edges_end(); e++, idx++) {
-        verts[idx] = e->new_pos;
-        layout[e->id()] = idx;
-    }
-    for(FaceRef f = faces_begin(); f != faces_end(); f++, idx++) {
-        verts[idx] = f->new_pos;
-        layout[f->id()] = idx;
-    }
+    Halfedge_Mesh fine;
+    switch(strategy) {
+    case SubD::linear: {
+        linear_subdivide_positions();
+        build_quad_subdivision(fine);
+    } break;
 
-    for(auto f = faces_begin(); f != faces_end(); f++) {
-        Index i = layout[f->id()];
-        HalfedgeRef h = f->halfedge();
-        do {
-            Index j = layout[h->edge()->id()];
-            Index k = layout[h->next()->vertex()->id()];
-            Index l = layout[h->next()->edge()->id()];
-            std::vector<Index> quad = {i, j, k, l};
-            polys.push_back(quad);
-            h = h->next();
-        } while(h != f->halfedge());
+    case SubD::catmullclark: {
+        catmullclark_subdivide_positions();
+        build_quad_subdivision(fine);
+    } break;
+
+    case SubD::loop: {
+        loop_subdivide_positions();
+        build_loop_subdivision(fine);
+    } break;
+
+    default: assert(false);
     }
 
-    from_poly(polys, verts);
+    fine.flip_orientation = flip_orientation;
+    fine.attributes.enabled = attributes.enabled;
+    fine.render_dirty_flag = true;
+    *this = std::move(fine);
     return true;
 }
 
+/*
+    One step of subdivision has a fixed topology, so rather than listing the new polygons
+    and handing them to from_poly, the refined elements are allocated up front and their
+    references filled in directly (and in parallel), each at an index computed from the
+    indices of the elements of this mesh it comes from:
+
+    - Vertex v keeps index v; the point on edge e is nV + e; the point of the interior
+      face f is nV + nE + (the number of interior faces before f).
+    - Halfedge h, from a to b, is split into 2h (a to e) and 2h + 1 (e to b), where e is
+      the point on h's edge. Edge e is split into 2e, holding the first half of
+      e->halfedge(), and 2e + 1, holding its second half.
+
+    The rest (the halfedges and edges inside each face, and the faces) are numbered per
+    corner: the halfedges of a face, each standing for the corner at its tip.
+
+    subdivide_rims does the part both schemes share: it allocates the vertices and edges
+    and fills in all but next and face of the split halfedges, which must already exist.
+*/
+void Halfedge_Mesh::subdivide_rims(Halfedge_Mesh& fine, size_t n_inner_edges) const {
+
+    size_t nV = vertices.size(), nE = edges.size(), nH = halfedges.size();
+
+    for(size_t i = 0; i < nV + nE; i++) fine.new_vertex();
+    for(size_t i = 0; i < 2 * nE + n_inner_edges; i++) fine.new_edge();
+
+    Thread_Pool& pool = Thread_Pool::shared();
+    pool.parallel_for(0, nV, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            VertexCRef v = vertices.at(i);
+            VertexRef fv = fine.vertices.at(i);
+            fv->pos = v->new_pos;
+            fv->halfedge() = fine.halfedges.at(2 * v->halfedge().index());
+        }
+    });
+    pool.parallel_for(0, nE, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            EdgeCRef e = edges.at(i);
+            uint32_t h = e->halfedge().index();
+            VertexRef fv = fine.vertices.at(nV + i);
+            fv->pos = e->new_pos;
+            fv->halfedge() = fine.halfedges.at(2 * h + 1);
+            fine.edges.at(2 * i)->halfedge() = fine.halfedges.at(2 * h);
+            fine.edges.at(2 * i + 1)->halfedge() = fine.halfedges.at(2 * h + 1);
+        }
+    });
+    pool.parallel_for(0, nH, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            HalfedgeCRef h = halfedges.at(i);
+            uint32_t e = h->edge().index(), t = h->twin().index();
+            bool first = h->edge()->halfedge() == h;
+            HalfedgeRef a = fine.halfedges.at(2 * i), b = fine.halfedges.at(2 * i + 1);
+            a->vertex() = fine.vertices.at(h->vertex().index());
+            a->twin() = fine.halfedges.at(2 * t + 1);
+            a->edge() = fine.edges.at(first ? 2 * e : 2 * e + 1);
+            b->vertex() = fine.vertices.at(nV + e);
+            b->twin() = fine.halfedges.at(2 * t);
+            b->edge() = fine.edges.at(first ? 2 * e + 1 : 2 * e);
+        }
+    });
+}
+
+void Halfedge_Mesh::build_quad_subdivision(Halfedge_Mesh& fine) const {
+
+    size_t nV = vertices.size(), nE = edges.size(), nF = faces.size(), nH = halfedges.size();
+    Thread_Pool& pool = Thread_Pool::shared();
+
+    // Number the interior faces and their corners
+    std::vector<uint32_t> first_corner(nF), face_point(nF);
+    pool.parallel_for(0, nF, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            FaceCRef f = faces.at(i);
+            first_corner[i] = f->is_boundary() ? 0 : f->degree();
+        }
+    });
+    uint32_t nC = 0, nP = 0;
+    for(size_t i = 0; i < nF; i++) {
+        uint32_t degree = first_corner[i];
+        first_corner[i] = nC;
+        face_point[i] = nP;
+        nC += degree;
+        if(degree) nP++;
+    }
+
+    // Each corner becomes a quad, with two halfedges (and one edge) along the spokes
+    // from the face point: into the corner's first edge point, and out of its second
+    fine.halfedges.reserve(2 * nH + 2 * nC);
+    fine.vertices.reserve(nV + nE + nP);
+    fine.edges.reserve(2 * nE + nC);
+    fine.faces.reserve(nC + nF - nP);
+    for(size_t i = 0; i < 2 * nH + 2 * nC; i++) fine.new_halfedge();
+    subdivide_rims(fine, nC);
+    for(size_t i = 0; i < nP; i++) fine.new_vertex();
+    for(size_t i = 0; i < nC; i++) fine.new_face();
+    for(size_t i = nP; i < nF; i++) fine.new_face(true);
+
+    auto rim = [&](HalfedgeCRef h, bool second) {
+        return fine.halfedges.at(2 * h.index() + second);
+    };
+    auto spoke = [&](uint32_t c, bool out) {
+        return fine.halfedges.at(2 * nH + 2 * c + out);
+    };
+
+    pool.parallel_for(0, nF, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            FaceCRef f = faces.at(i);
+            HalfedgeCRef h = f->halfedge();
+
+            if(f->is_boundary()) {
+                FaceRef b = fine.faces.at(nC + i - face_point[i]);
+                b->halfedge() = rim(h, false);
+                do {
+                    rim(h, false)->next() = rim(h, true);
+                    rim(h, false)->face() = b;
+                    rim(h, true)->next() = rim(h->next(), false);
+                    rim(h, true)->face() = b;
+                    h = h->next();
+                } while(h != f->halfedge());
+                continue;
+            }
+
+            uint32_t c0 = first_corner[i];
+            VertexRef point = fine.vertices.at(nV + nE + face_point[i]);
+            point->pos = f->new_pos;
+            point->halfedge() = spoke(c0, false);
+
+            uint32_t n = f->degree();
+            for(uint32_t k = 0; k < n; k++, h = h->next()) {
+                uint32_t c = c0 + k;
+                uint32_t prev = c0 + (k + n - 1) % n, next = c0 + (k + 1) % n;
+                HalfedgeRef in = spoke(c, false), out = spoke(c, true);
+                HalfedgeRef from = rim(h, true), to = rim(h->next(), false);
+                FaceRef quad = fine.faces.at(c);
+                quad->halfedge() = in;
+
+                in->vertex() = point;
+                in->next() = from;
+                in->twin() = spoke(prev, true);
+                in->edge() = fine.edges.at(2 * nE + c);
+                in->face() = quad;
+                from->next() = to;
+                from->face() = quad;
+                to->next() = out;
+                to->face() = quad;
+                out->vertex() = fine.vertices.at(nV + h->next()->edge().index());
+                out->next() = in;
+                out->twin() = spoke(next, false);
+                out->edge() = fine.edges.at(2 * nE + next);
+                out->face() = quad;
+                fine.edges.at(2 * nE + c)->halfedge() = in;
+            }
+        }
+    });
+}
+
+void Halfedge_Mesh::build_loop_subdivision(Halfedge_Mesh& fine) const {
+
+    size_t nV = vertices.size(), nE = edges.size(), nF = faces.size(), nH = halfedges.size();
+
+    // Every face is a triangle, so each halfedge stands for the corner at its tip, which
+    // is cut off into triangle h. That leaves two halfedges (and an edge) between the
+    // edge points on either side of the corner: one in the corner triangle, and its twin
+    // in the middle triangle, nH + f.
+    fine.halfedges.reserve(4 * nH);
+    fine.vertices.reserve(nV + nE);
+    fine.edges.reserve(2 * nE + nH);
+    fine.faces.reserve(nH + nF);
+    for(size_t i = 0; i < 4 * nH; i++) fine.new_halfedge();
+    subdivide_rims(fine, nH);
+    for(size_t i = 0; i < nH + nF; i++) fine.new_face();
+
+    auto rim = [&](HalfedgeCRef h, bool second) {
+        return fine.halfedges.at(2 * h.index() + second);
+    };
+    auto cut = [&](HalfedgeCRef h, bool middle) {
+        return fine.halfedges.at(2 * nH + 2 * h.index() + middle);
+    };
+
+    Thread_Pool::shared().parallel_for(0, nF, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            FaceCRef f = faces.at(i);
+            FaceRef middle = fine.faces.at(nH + i);
+            middle->halfedge() = cut(f->halfedge(), true);
+
+            HalfedgeCRef h = f->halfedge();
+            do {
+                HalfedgeCRef n = h->next();
+                HalfedgeRef from = rim(h, true), to = rim(n, false);
+                HalfedgeRef in = cut(h, false), across = cut(h, true);
+                EdgeRef edge = fine.edges.at(2 * nE + h.index());
+                FaceRef corner = fine.faces.at(h.index());
+                corner->halfedge() = from;
+                edge->halfedge() = in;
+
+                from->next() = to;
+                from->face() = corner;
+                to->next() = in;
+                to->face() = corner;
+                in->vertex() = fine.vertices.at(nV + n->edge().index());
+                in->next() = from;
+                in->twin() = across;
+                in->edge() = edge;
+                in->face() = corner;
+                across->vertex() = fine.vertices.at(nV + h->edge().index());
+                across->next() = cut(n, true);
+                across->twin() = in;
+                across->edge() = edge;
+                across->face() = middle;
+                h = n;
+            } while(h != f->halfedge());
+        }
+    });
+}
+
 std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& polygons,
                                      const std::vector<Vec3>& verts) {
 
@@ -600,48 +1513,33 @@ std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& poly
     // must have at least three vertices.  Note that there are no special conditions
     // on the vertex indices, i.e., they do not have to start at 0 or 1, nor does
     // the collection of indices have to be contiguous.  Overall, this initializer
-    // is designed to be robust but perhaps not incredibly fast (though of course
-    // this does not affect the performance of the resulting data structure).  One
-    // could also implement faster initializers that handle important special cases
-    // (e.g., all triangles, or data that is known to be manifold). Since there are
-    // no strong conditions on the indices of polygons, we assume that the list of
-    // vertex positions is given in lexicographic order (i.e., that the lowest index
-    // appearing in any polygon corresponds to the first entry of the list of
+    // is designed to be robust, but it is also used to import large scans and to
+    // rebuild the mesh after subdivision, so it avoids ordered maps: vertices are
+    // numbered densely, all elements are allocated up front, and twins are matched
+    // by bucketing edges rather than by looking them up one at a time. Since there
+    // are no strong conditions on the indices of polygons, we assume that the list
+    // of vertex positions is given in lexicographic order (i.e., that the lowest
+    // index appearing in any polygon corresponds to the first entry of the list of
     // positions and so on).
 
     // define some types, to improve readability
     typedef std::vector<Index> IndexList;
-    typedef IndexList::const_iterator IndexListCRef;
-    typedef std::vector<IndexList> PolygonList;
-    typedef PolygonList::const_iterator PolygonListCRef;
-    typedef std::pair<Index, Index> IndexPair; // ordered pair of vertex indices,
-                                               // corresponding to an edge of an
-                                               // oriented polygon
+    const Index none = std::numeric_limits<Index>::max();
 
     // Clear any existing elements.
     clear();
 
-    // Since the vertices in our halfedge mesh are stored in a linked list,
-    // we will temporarily need to keep track of the correspondence between
-    // indices of vertices in our input and pointers to vertices in the new
-    // mesh (which otherwise can't be accessed by index).  Note that since
-    // we're using a general-purpose map (rather than, say, a vector), we can
-    // be a bit more flexible about the indexing scheme: input vertex indices
-    // aren't required to be 0-based or 1-based; in fact, the set of indices
-    // doesn't even have to be contiguous.  Taking advantage of this fact makes
-    // our conversion a bit more robust to different types of input, including
-    // data that comes from a subset of a full mesh.
-
-    // maps a vertex index to the corresponding vertex
-    std::map<Index, VertexRef> indexToVertex;
-
-    // Also store the vertex degree, i.e., the number of polygons that use each
-    // vertex; this information will be used to check that the mesh is manifold.
-    std::map<VertexRef, Size> vertexDegree;
+    Size nFaces = polygons.size();
 
-    // First, we do some basic sanity checks on the input.
-    for(PolygonListCRef p = polygons.begin(); p != polygons.end(); p++) {
-        if(p->size() < 3) {
+    // First, we do some basic sanity checks on the input, and count the corners
+    // of all polygons so that every element can be allocated up front. Meshes made
+    // only of triangles or only of quads (the usual case for imported meshes and
+    // for subdivision) can find the first corner of each face without a table.
+    Size nCorners = 0;
+    Size uniform = nFaces ? polygons[0].size() : 0;
+    Index maxIndex = 0;
+    for(const IndexList& p : polygons) {
+        if(p.size() < 3) {
             // Refuse to build the mesh if any of the polygons have fewer than three
             // vertices.(Note that if we omit this check the code will still
             // constructsomething fairlymeaningful for 1- and 2-point polygons, but
@@ -651,138 +1549,235 @@ std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& poly
             return "Each polygon must have at least three vertices.";
         }
 
-        // We want to count the number of distinct vertex indices in this
-        // polygon, to make sure it's the same as the number of vertices
-        // in the polygon---if they disagree, then the polygon is not valid
-        // (or at least, for simplicity we don't handle polygons of this type!).
-        std::set<Index> polygonIndices;
-
-        // loop over polygon vertices
-        for(IndexListCRef i = p->begin(); i != p->end(); i++) {
-            polygonIndices.insert(*i);
-
-            // allocate one vertex for each new index we encounter
-            if(indexToVertex.find(*i) == indexToVertex.end()) {
-                VertexRef v = new_vertex();
-                v->halfedge() = halfedges.end(); // this vertex doesn't yet point to any halfedge
-                indexToVertex[*i] = v;
-                vertexDegree[v] = 1; // we've now seen this vertex only once
-            } else {
-                // keep track of the number of times we've seen this vertex
-                vertexDegree[indexToVertex[*i]]++;
+        // Check that all vertices of the current polygon are distinct---if they
+        // aren't, then the polygon is not valid (or at least, for simplicity we
+        // don't handle polygons of this type!). Small polygons are checked pairwise.
+        bool distinct = true;
+        if(p.size() <= 8) {
+            for(Size i = 0; i < p.size() && distinct; i++) {
+                for(Size j = i + 1; j < p.size(); j++) {
+                    if(p[i] == p[j]) distinct = false;
+                }
             }
-        } // end loop over polygon vertices
-
-        // check that all vertices of the current polygon are distinct
-        Size degree = p->size(); // number of vertices in this polygon
-        if(polygonIndices.size() < degree) {
+        } else {
+            IndexList sorted = p;
+            std::sort(sorted.begin(), sorted.end());
+            distinct = std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end();
+        }
+        if(!distinct) {
             std::stringstream stream;
             stream << "One of the input polygons does not have distinct vertices!" << std::endl;
             stream << "(vertex indices:";
-            for(IndexListCRef i = p->begin(); i != p->end(); i++) {
-                stream << " " << *i;
+            for(Index i : p) {
+                stream << " " << i;
             }
             stream << ")" << std::endl;
             return stream.str();
         } // end check that polygon vertices are distinct
 
+        nCorners += p.size();
+        if(p.size() != uniform) uniform = 0;
+        for(Index i : p) maxIndex = std::max(maxIndex, i);
     } // end basic sanity checks on input
 
-    // The number of faces is just the number of polygons in the input.
-    Size nFaces = polygons.size();
-    for(Size i = 0; i < nFaces; i++) new_face();
-
-    // We will store a map from ordered pairs of vertex indices to
-    // the corresponding halfedge object in our new (halfedge) mesh;
-    // this map gets constructed during the next loop over polygons.
-    std::map<IndexPair, HalfedgeRef> pairToHalfedge;
-
-    // Next, we actually build the halfedge connectivity by again looping over
-    // polygons
-    PolygonListCRef p;
-    FaceRef f;
-    for(p = polygons.begin(), f = faces.begin(); p != polygons.end(); p++, f++) {
-
-        std::vector<HalfedgeRef> faceHalfedges; // cyclically ordered list of the half
-                                                // edges of this face
-        Size degree = p->size();                // number of vertices in this polygon
-
-        // loop over the halfedges of this face (equivalently, the ordered pairs of
-        // consecutive vertices)
-        for(Index i = 0; i < degree; i++) {
-
-            Index a = (*p)[i];                // current index
-            Index b = (*p)[(i + 1) % degree]; // next index, in cyclic order
-            IndexPair ab(a, b);
-            HalfedgeRef hab;
-
-            // check if this halfedge already exists; if so, we have a problem!
-            if(pairToHalfedge.find(ab) != pairToHalfedge.end()) {
-                std::stringstream stream;
-                stream << "Found multiple oriented edges with indices (" << a << ", " << b << ")."
-                       << std::endl;
-                stream << "This means that either (i) more than two faces contain this "
-                          "edge (hence the surface is nonmanifold), or"
-                       << std::endl;
-                stream << "(ii) there are exactly two faces containing this edge, but "
-                          "they have the same orientation (hence the surface is"
-                       << std::endl;
-                stream << "not consistently oriented." << std::endl;
-                return stream.str();
-            } else // otherwise, the halfedge hasn't been allocated yet
-            {
-                // so, we point this vertex pair to a new halfedge
-                hab = new_halfedge();
-                pairToHalfedge[ab] = hab;
-
-                // link the new halfedge to its face
-                hab->face() = f;
-                hab->face()->halfedge() = hab;
-
-                // also link it to its starting vertex
-                hab->vertex() = indexToVertex[a];
-                hab->vertex()->halfedge() = hab;
-
-                // keep a list of halfedges in this face, so that we can later
-                // link them together in a loop (via their "next" pointers)
-                faceHalfedges.push_back(hab);
+    std::vector<Index> faceStart;
+    if(!uniform) {
+        faceStart.resize(nFaces + 1, 0);
+        for(Size f = 0; f < nFaces; f++) faceStart[f + 1] = faceStart[f] + polygons[f].size();
+    }
+    auto firstCorner = [&](Size f) { return uniform ? f * uniform : faceStart[f]; };
+    // corners are numbered face by face; this finds the next corner around the same face
+    auto nextCorner = [&](Size f, Index c) {
+        return c + 1 == firstCorner(f) + polygons[f].size() ? firstCorner(f) : c + 1;
+    };
+
+    // Vertices are numbered by the rank of their input index, which is also the
+    // order their positions are given in. When the indices are reasonably dense we
+    // rank them with a lookup table, otherwise by sorting them.
+    std::vector<Index> vertexIndex; // input index of each vertex
+    std::vector<Index> cornerVertex(nCorners);
+    if(maxIndex < 2 * nCorners + verts.size()) {
+        std::vector<Index> rank(maxIndex + 1, none);
+        for(const IndexList& p : polygons) {
+            for(Index i : p) rank[i] = 0;
+        }
+        for(Index i = 0; i <= maxIndex; i++) {
+            if(rank[i] == none) continue;
+            rank[i] = vertexIndex.size();
+            vertexIndex.push_back(i);
+        }
+        Index c = 0;
+        for(const IndexList& p : polygons) {
+            for(Index i : p) cornerVertex[c++] = rank[i];
+        }
+    } else {
+        vertexIndex.reserve(nCorners);
+        for(const IndexList& p : polygons) {
+            vertexIndex.insert(vertexIndex.end(), p.begin(), p.end());
+        }
+        std::sort(vertexIndex.begin(), vertexIndex.end());
+        vertexIndex.erase(std::unique(vertexIndex.begin(), vertexIndex.end()), vertexIndex.end());
+        Index c = 0;
+        for(const IndexList& p : polygons) {
+            for(Index i : p) {
+                auto found = std::lower_bound(vertexIndex.begin(), vertexIndex.end(), i);
+                cornerVertex[c++] = found - vertexIndex.begin();
             }
+        }
+    }
+    Size nVertices = vertexIndex.size();
 
-            // Also, check if the twin of this halfedge has already been constructed
-            // (during construction of a different face).  If so, link the twins
-            // together and allocate their shared halfedge.  By the end of this pass
-            // over polygons, the only halfedges that will not have a twin will hence
-            // be those that sit along the domain boundary.
-            IndexPair ba(b, a);
-            std::map<IndexPair, HalfedgeRef>::iterator iba = pairToHalfedge.find(ba);
-            if(iba != pairToHalfedge.end()) {
-                HalfedgeRef hba = iba->second;
-
-                // link the twins
-                hab->twin() = hba;
-                hba->twin() = hab;
-
-                // allocate and link their edge
-                EdgeRef e = new_edge();
-                hab->edge() = e;
-                hba->edge() = e;
-                e->halfedge() = hab;
-            } else { // If we didn't find a twin...
-                // ...mark this halfedge as being twinless by pointing
-                // it to the end of the list of halfedges. If it remains
-                // twinless by the end of the current loop over polygons,
-                // it will be linked to a boundary face in the next pass.
-                hab->twin() = halfedges.end();
+    // Also store the vertex degree, i.e., the number of polygons that use each
+    // vertex; this information will be used to check that the mesh is manifold.
+    std::vector<Size> vertexDegree(nVertices, 0);
+    for(Index v : cornerVertex) vertexDegree[v]++;
+
+    // Next, we find the twin of each oriented edge, identifying the edge from
+    // corner c to the following corner by its pair of vertices. The corners are
+    // bucketed by the lower-numbered vertex of their edge (a counting sort), so
+    // each edge only has to be compared with the few others sharing that vertex,
+    // and the buckets can be searched in parallel.
+    std::vector<Index> cornerFace(nCorners);
+    for(Size f = 0; f < nFaces; f++) {
+        std::fill_n(cornerFace.begin() + firstCorner(f), polygons[f].size(), f);
+    }
+    auto edgeEnds = [&](Index c) {
+        return std::make_pair(cornerVertex[c], cornerVertex[nextCorner(cornerFace[c], c)]);
+    };
+
+    std::vector<Index> bucketStart(nVertices + 1, 0), bucketCorners(nCorners);
+    for(Index c = 0; c < nCorners; c++) {
+        auto [a, b] = edgeEnds(c);
+        bucketStart[std::min(a, b) + 1]++;
+    }
+    for(Index v = 0; v < nVertices; v++) bucketStart[v + 1] += bucketStart[v];
+    {
+        std::vector<Index> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for(Index c = 0; c < nCorners; c++) {
+            auto [a, b] = edgeEnds(c);
+            bucketCorners[fill[std::min(a, b)]++] = c;
+        }
+    }
+
+    // Any oriented edge that appears twice is an error; like a sequential scan over
+    // the polygons would, we report the earliest corner that repeats an edge.
+    std::vector<Index> twinCorner(nCorners, none);
+    std::atomic<Index> repeated{none};
+    auto matchBuckets = [&](size_t begin, size_t end) {
+        for(Index v = begin; v < end; v++) {
+            auto first = bucketCorners.begin() + bucketStart[v];
+            auto last = bucketCorners.begin() + bucketStart[v + 1];
+            auto other = [&](Index c) {
+                auto [a, b] = edgeEnds(c);
+                return a == v ? b : a;
+            };
+            // order the edges of the bucket by their other vertex, then by corner
+            std::sort(first, last, [&](Index i, Index j) {
+                Index oi = other(i), oj = other(j);
+                return oi != oj ? oi < oj : i < j;
+            });
+            for(auto run = first; run != last;) {
+                auto runEnd = run + 1;
+                while(runEnd != last && other(*runEnd) == other(*run)) runEnd++;
+                if(runEnd - run == 2 && edgeEnds(run[0]).first != edgeEnds(run[1]).first) {
+                    twinCorner[run[0]] = run[1];
+                    twinCorner[run[1]] = run[0];
+                } else if(runEnd - run > 1) {
+                    // the second corner with the same orientation as an earlier one
+                    Index found = none;
+                    for(auto i = run; i != runEnd; i++) {
+                        for(auto j = run; j != i; j++) {
+                            if(edgeEnds(*i).first == edgeEnds(*j).first) {
+                                found = std::min(found, *i);
+                                break;
+                            }
+                        }
+                    }
+                    Index prev = repeated.load();
+                    while(found < prev && !repeated.compare_exchange_weak(prev, found)) {
+                    }
+                }
+                run = runEnd;
             }
-        } // end loop over the current polygon's halfedges
+        }
+    };
+    Thread_Pool::shared().parallel_for(0, nVertices, 4096, matchBuckets);
+
+    if(repeated != none) {
+        auto [a, b] = edgeEnds(repeated);
+        std::stringstream stream;
+        stream << "Found multiple oriented edges with indices (" << vertexIndex[a] << ", "
+               << vertexIndex[b] << ")." << std::endl;
+        stream << "This means that either (i) more than two faces contain this "
+                  "edge (hence the surface is nonmanifold), or"
+               << std::endl;
+        stream << "(ii) there are exactly two faces containing this edge, but "
+                  "they have the same orientation (hence the surface is"
+               << std::endl;
+        stream << "not consistently oriented." << std::endl;
+        return stream.str();
+    }
+
+    // Now we allocate the elements. Each corner becomes the halfedge leaving its
+    // vertex, and edges are created once both of their halfedges exist. Boundary
+    // loops will add at most one more halfedge per corner.
+    vertices.reserve(nVertices);
+    faces.reserve(nFaces);
+    halfedges.reserve(nCorners);
+    edges.reserve(nCorners / 2 + 1);
+
+    std::vector<VertexRef> vertexRefs(nVertices);
+    for(Index v = 0; v < nVertices; v++) {
+        // this vertex doesn't yet point to any halfedge
+        vertexRefs[v] = new_vertex();
+        vertexRefs[v]->halfedge() = halfedges.end();
+    }
+
+    std::vector<HalfedgeRef> cornerHalfedge(nCorners);
+    for(Size f = 0; f < nFaces; f++) {
+        FaceRef face = new_face();
+        Index c0 = firstCorner(f);
+        Size degree = polygons[f].size();
+        for(Index c = c0; c < c0 + degree; c++) {
+            HalfedgeRef hab = new_halfedge();
+            cornerHalfedge[c] = hab;
+
+            // link the new halfedge to its face
+            hab->face() = face;
+            face->halfedge() = hab;
+
+            // also link it to its starting vertex
+            hab->vertex() = vertexRefs[cornerVertex[c]];
+            hab->vertex()->halfedge() = hab;
+        }
 
         // Now that all the halfedges of this face have been allocated,
         // we can link them together via their "next" pointers.
-        for(Index i = 0; i < degree; i++) {
-            Index j = (i + 1) % degree; // index of the next halfedge, in cyclic order
-            faceHalfedges[i]->next() = faceHalfedges[j];
+        for(Index c = c0; c < c0 + degree; c++) {
+            cornerHalfedge[c]->next() = cornerHalfedge[nextCorner(f, c)];
         }
+    }
 
+    for(Index c = 0; c < nCorners; c++) {
+        HalfedgeRef hab = cornerHalfedge[c];
+        Index t = twinCorner[c];
+        if(t == none) {
+            // Mark this halfedge as being twinless by pointing it to the end
+            // of the list of halfedges. It will be linked to a boundary face in
+            // the next pass.
+            hab->twin() = halfedges.end();
+        } else if(t < c) {
+            // link the twins
+            HalfedgeRef hba = cornerHalfedge[t];
+            hab->twin() = hba;
+            hba->twin() = hab;
+
+            // allocate and link their edge
+            EdgeRef e = new_edge();
+            hab->edge() = e;
+            hba->edge() = e;
+            e->halfedge() = hab;
+        }
     } // done building basic halfedge connectivity
 
     // For each vertex on the boundary, advance its halfedge pointer to one that
@@ -907,7 +1902,7 @@ std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& poly
             h = h->twin()->next();
         } while(h != v->halfedge());
 
-        Size cmp = vertexDegree[v];
+        Size cmp = vertexDegree[v.index()];
         if(count != cmp) {
             return "At least one of the vertices is nonmanifold.";
         }
@@ -925,18 +1920,10 @@ std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& poly
         return stream.str();
     }
 
-    // Since an STL map internally sorts its keys, we can iterate over the map
-    // from vertex indices to vertex iterators to visit our (input) vertices in
-    // lexicographic order
-    int i = 0;
-    for(std::map<Index, VertexRef>::const_iterator e = indexToVertex.begin();
-        e != indexToVertex.end(); e++) {
-        // grab a pointer to the vertex associated with the current key (i.e., the
-        // current index)
-        VertexRef v = e->second;
-
-        // set the att of this vertex to the corresponding
-        // position in the input
+    // Vertices were allocated in the order of their input indices, so they line up
+    // with the list of positions
+    Index i = 0;
+    for(VertexRef v = vertices_begin(); v != vertices_end(); v++) {
         v->pos = verts[i];
         i++;
     }
@@ -67,7 +67,7 @@
     data structure.  But it's worth making a few comments about how this
     particular implementation works---especially how things like boundaries
     are handled.  First and foremost, the "pointers" used in this
-    implementation are actually STL iterators.  STL stands for the "standard
+    implementation behave just like STL iterators.  STL stands for the "standard
     template library," and is a basic part of C++ that provides some very
     convenient and powerful data structures and algorithms---if you've never
     looked at the STL before, now would be a great time to get familiar!  At
@@ -127,14 +127,17 @@
 
 #pragma once
 
-#include <list>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <optional>
-#include <set>
 #include <string>
 #include <variant>
 #include <vector>
 
 #include "../platform/gl.h"
+#include "../util/thread_pool.h"
+#include "element_array.h"
 
 // Types of sub-division
 enum class SubD { linear, catmullclark, loop };
@@ -160,13 +163,13 @@ public:
 
     /*
         Rather than using raw pointers to mesh elements, we store references
-        as STL::iterators---for convenience, we give shorter names to these
-        iterators (e.g., EdgeRef instead of list<Edge>::iterator).
+        as iterators into each element array---for convenience, we give shorter
+        names to these iterators (e.g., EdgeRef instead of Element_Ref<Edge>).
     */
-    using VertexRef = std::list<Vertex>::iterator;
-    using EdgeRef = std::list<Edge>::iterator;
-    using FaceRef = std::list<Face>::iterator;
-    using HalfedgeRef = std::list<Halfedge>::iterator;
+    using VertexRef = Element_Ref<Vertex>;
+    using EdgeRef = Element_Ref<Edge>;
+    using FaceRef = Element_Ref<Face>;
+    using HalfedgeRef = Element_Ref<Halfedge>;
 
     /* This is a special kind of reference that can refer to any of the four
        element types. */
@@ -178,10 +181,10 @@ public:
         used so frequently, we will use "CIter" as a shorthand abbreviation for
         "constant iterator."
     */
-    using VertexCRef = std::list<Vertex>::const_iterator;
-    using EdgeCRef = std::list<Edge>::const_iterator;
-    using FaceCRef = std::list<Face>::const_iterator;
-    using HalfedgeCRef = std::list<Halfedge>::const_iterator;
+    using VertexCRef = Element_Ref<const Vertex>;
+    using EdgeCRef = Element_Ref<const Edge>;
+    using FaceCRef = Element_Ref<const Face>;
+    using HalfedgeCRef = Element_Ref<const Halfedge>;
     using ElementCRef = std::variant<VertexCRef, EdgeCRef, HalfedgeCRef, FaceCRef>;
 
     //////////////////////////////////////////////////////////////////////////////////////////
@@ -307,9 +310,12 @@ public:
     void catmullclark_subdivide_positions();
 
     /*
-        Sub-divide each face based on the Loop subdivision rule
+        Compute new vertex positions for a mesh that splits each triangle
+        into four (by inserting a vertex at each edge midpoint). The new
+        positions will be stored in the members Vertex::new_pos and
+        Edge::new_pos, based on the Loop subdivision rules.
     */
-    void loop_subdivide();
+    void loop_subdivide_positions();
 
     /*
         Isotropic remeshing
@@ -317,9 +323,20 @@ public:
     bool isotropic_remesh();
 
     /*
-        Mesh simplification
+        Mesh simplification: collapses the cheapest edges, by quadric error, until at
+        most target_faces faces are left or the next collapse would cost more than
+        max_error (a sum of squared distances to the planes of the original faces).
+        With no arguments, simplifies down to a quarter of the faces.
     */
     bool simplify();
+    bool simplify(Size target_faces, float max_error = std::numeric_limits<float>::infinity());
+    /*
+        Simplification through several decreasing face counts in one pass, calling
+        reached(i) once the mesh is down to targets[i] faces (or as far as it goes).
+        Returning false from reached stops early.
+    */
+    bool simplify(const std::vector<Size>& targets, float max_error,
+                  const std::function<bool(size_t)>& reached);
 
     //////////////////////////////////////////////////////////////////////////////////////////
     // End student operations, begin methods students should use
@@ -361,6 +378,7 @@ public:
         unsigned int _id = 0;
         HalfedgeRef _halfedge;
         friend class Halfedge_Mesh;
+        template<typename> friend class Element_Array;
     };
 
     class Edge {
@@ -394,6 +412,7 @@ public:
         unsigned int _id = 0;
         HalfedgeRef _halfedge;
         friend class Halfedge_Mesh;
+        template<typename> friend class Element_Array;
     };
 
     class Face {
@@ -414,6 +433,8 @@ public:
         Vec3 center() const;
         // Returns an area weighted face normal
         Vec3 normal() const;
+        // Returns the area of this face
+        float area() const;
         // Returns the number of vertices/edges in this face
         unsigned int degree() const;
         // Returns an id unique to this face
@@ -429,6 +450,7 @@ public:
         HalfedgeRef _halfedge;
         bool boundary = false;
         friend class Halfedge_Mesh;
+        template<typename> friend class Element_Array;
     };
 
     class Halfedge {
@@ -502,6 +524,7 @@ public:
         EdgeRef _edge;
         FaceRef _face;
         friend class Halfedge_Mesh;
+        template<typename> friend class Element_Array;
     };
 
     /*
@@ -517,33 +540,57 @@ public:
        facilitate checking for dangling references.
     */
     void erase(VertexRef v) {
-        verased.insert(v);
+        vertices.mark_erased(v);
+        changed(v);
+        if(local.active) local.vertices.push_back(v);
     }
     void erase(EdgeRef e) {
-        eerased.insert(e);
+        edges.mark_erased(e);
+        last_snapshot.reset();
+        if(local.active) local.edges.push_back(e);
     }
     void erase(FaceRef f) {
-        ferased.insert(f);
+        faces.mark_erased(f);
+        changed(f);
+        if(local.active) local.faces.push_back(f);
     }
     void erase(HalfedgeRef h) {
-        herased.insert(h);
+        halfedges.mark_erased(h);
+        last_snapshot.reset();
+        if(local.active) local.halfedges.push_back(h);
     }
 
     /*
         These methods allocate new mesh elements, returning a pointer (i.e., iterator) to the
         new element. (These methods cannot have const versions, because they modify the mesh!)
+
+        Note: new elements reuse the slots of previously deleted ones, so they do not always
+        come last when iterating over the mesh. If an algorithm relies on that (e.g. iterating
+        over the first n edges while splitting them), call compact() first.
     */
     HalfedgeRef new_halfedge() {
-        return halfedges.insert(halfedges.end(), Halfedge(next_id++));
+        last_snapshot.reset();
+        HalfedgeRef h = halfedges.emplace(next_id++);
+        if(local.active) local.halfedges.push_back(h);
+        return h;
     }
     VertexRef new_vertex() {
-        return vertices.insert(vertices.end(), Vertex(next_id++));
+        VertexRef v = vertices.emplace(next_id++);
+        changed(v);
+        if(local.active) local.vertices.push_back(v);
+        return v;
     }
     EdgeRef new_edge() {
-        return edges.insert(edges.end(), Edge(next_id++));
+        EdgeRef e = edges.emplace(next_id++);
+        changed(e);
+        if(local.active) local.edges.push_back(e);
+        return e;
     }
     FaceRef new_face(bool boundary = false) {
-        return faces.insert(faces.end(), Face(next_id++, boundary));
+        FaceRef f = faces.emplace(next_id++, boundary);
+        changed(f);
+        if(local.active) local.faces.push_back(f);
+        return f;
     }
 
     /*
@@ -635,6 +682,19 @@ public:
     std::optional<std::pair<ElementRef, std::string>> validate();
     std::optional<std::pair<ElementRef, std::string>> warnings();
 
+    /*
+        Checks of just the part of the mesh that a local operation touched, so that an edit
+        costs the same on any size of mesh. begin_local_check(elem) records the faces around
+        the vertices of elem before the operation, and elements created or erased after that
+        are recorded as they are. validate_local() and warnings_local() then run the checks
+        above on those elements only, until end_local_check(). An operation that rewires
+        anything further away goes unnoticed: validate() remains the thorough check.
+    */
+    void begin_local_check(ElementRef elem);
+    std::optional<std::pair<ElementRef, std::string>> validate_local();
+    std::optional<std::pair<ElementRef, std::string>> warnings_local();
+    void end_local_check();
+
     //////////////////////////////////////////////////////////////////////////////////////////
     // End methods students should use, begin internal methods - you don't need to use these
     //////////////////////////////////////////////////////////////////////////////////////////
@@ -653,12 +713,42 @@ public:
     void copy_to(Halfedge_Mesh& mesh);
     ElementRef copy_to(Halfedge_Mesh& mesh, unsigned int eid);
 
+    /*
+        Snapshots are shared, read-only copies of a mesh, as kept by undo. Taking a snapshot
+        of a mesh that has not changed since its last one (or since it was restored from one)
+        hands back that same copy. Changes are noticed the same way as for update_mesh:
+        through the methods above, mark_changed and mark_dirty.
+    */
+    using Snapshot = std::shared_ptr<const Halfedge_Mesh>;
+    Snapshot snapshot();
+    void restore(const Snapshot& snap);
+    ElementRef restore(const Snapshot& snap, unsigned int eid);
+
     /// Clear mesh of all elements.
     void clear();
     /// Creates new sub-divided mesh with provided scheme
     bool subdivide(SubD strategy);
     /// Export to renderable vertex-index mesh. Indexes the mesh.
     void to_mesh(GL::Mesh& mesh, bool split_faces) const;
+    /// Bring a mesh last exported by to_mesh up to date, re-indexing only the faces around
+    /// elements changed since (see mark_changed) and uploading just the parts that moved.
+    /// Falls back to to_mesh when the mesh was not exported from this one or a lot changed.
+    void update_mesh(GL::Mesh& mesh, bool split_faces) const;
+    /// Vertices and indices of a GL::Mesh, as to_mesh makes them. These can be built
+    /// away from the thread owning the GL context and uploaded there later.
+    struct Mesh_Data {
+        std::vector<GL::Mesh::Vert> verts;
+        std::vector<GL::Mesh::Index> idxs;
+    };
+    /// Levels of detail: simplifies a copy of the mesh once, exporting it each time it is
+    /// down to the next of fractions (decreasing) of its faces. No erasures may be pending.
+    /// Returns no levels if the mesh can't be simplified (i.e. it is not a triangle mesh)
+    /// or if cancel is cancelled before all of them are done.
+    std::vector<Mesh_Data> lod_levels(const std::vector<float>& fractions, bool split_faces,
+                                      const Cancel_Token& cancel) const;
+    /// Record that the faces around an element were edited, for update_mesh. Elements
+    /// created or erased are recorded on their own.
+    void mark_changed(ElementRef elem);
     /// Create mesh from polygon list
     std::string from_poly(const std::vector<std::vector<Index>>& polygons,
                           const std::vector<Vec3>& verts);
@@ -669,7 +759,12 @@ public:
     /// WARNING: erased elements stay in the element lists until do_erase()
     /// or validate() are called
     void do_erase();
+    /// Erases deleted elements and packs the remaining ones so that they are stored (and
+    /// iterated) in order without holes. Invalidates all element references.
+    void compact();
 
+    /// Flag the whole mesh as changed: the editor rebuilds its view of it and cached
+    /// attributes are all recomputed
     void mark_dirty();
     bool flipped() const {
         return flip_orientation;
@@ -683,50 +778,130 @@ public:
     static Vec3 center_of(ElementRef elem);
     static unsigned int id_of(ElementRef elem);
 
+    /*
+        Optional cache of per-element geometry: vertex normals, face normals, centers and
+        areas, and edge lengths. While it is on, update_attributes() recomputes whatever is
+        out of date (everything, in parallel, after mark_dirty), and mark_changed() or creating
+        an element invalidates the entries around it. Positions edited without telling the
+        mesh leave the cache stale, which is why it is off by default.
+    */
+    void cache_attributes(bool enable);
+    void update_attributes() const;
+    // These return the cached value if it is up to date, and compute it otherwise
+    Vec3 cached_normal(VertexCRef v) const;
+    Vec3 cached_normal(FaceCRef f) const;
+    Vec3 cached_center(FaceCRef f) const;
+    float cached_area(FaceCRef f) const;
+    float cached_length(EdgeCRef e) const;
+
 private:
-    std::list<Vertex> vertices;
-    std::list<Edge> edges;
-    std::list<Face> faces;
-    std::list<Halfedge> halfedges;
+    Element_Array<Vertex> vertices;
+    Element_Array<Edge> edges;
+    Element_Array<Face> faces;
+    Element_Array<Halfedge> halfedges;
 
     unsigned int next_id;
     bool flip_orientation = false;
+    Snapshot last_snapshot;
+
+    // Copies the elements slot for slot, so no erasures may be pending
+    void clone_to(Halfedge_Mesh& mesh) const;
+    void export_mesh(Mesh_Data& data, bool split_faces) const;
+    // Copies the elements in iteration order, leaving out the holes
+    void pack_to(Halfedge_Mesh& mesh) const;
+    // Connectivity of one step of subdivision, using the new_pos of each element
+    void build_quad_subdivision(Halfedge_Mesh& fine) const;
+    void build_loop_subdivision(Halfedge_Mesh& fine) const;
+    void subdivide_rims(Halfedge_Mesh& fine, size_t n_inner_edges) const;
+    ElementRef element_with_id(unsigned int id);
 
-    std::set<VertexRef> verased;
-    std::set<EdgeRef> eerased;
-    std::set<FaceRef> ferased;
-    std::set<HalfedgeRef> herased;
-};
+    /*
+        Where each face (and, for smooth normals, each vertex) went in the GL::Mesh last made
+        by to_mesh, by element index, along with the faces and vertices changed since then.
+        Triangle t is indices [3t, 3t + 3); with split faces, also vertices [3t, 3t + 3).
+        A face's triangles need not be adjacent, so they are linked through tri_next/prev.
+    */
+    struct Render_Layout {
+        Render_Layout() = default;
+        // A layout describes one particular GL::Mesh, so it doesn't follow the halfedge mesh
+        // when that is moved; the next update_mesh then does a full to_mesh
+        Render_Layout(Render_Layout&&) noexcept {
+        }
+        Render_Layout& operator=(Render_Layout&&) noexcept {
+            reset();
+            return *this;
+        }
+        void reset();
+
+        bool valid = false, split_faces = false, flipped = false;
+        size_t n_verts = 0, n_idxs = 0, max_changes = 0;
+        std::vector<uint32_t> vertex_slot, slot_vertex;
+        std::vector<uint32_t> face_tri, tri_face, tri_next, tri_prev;
+        std::vector<uint32_t> changed_vertices, changed_faces;
+
+        // Scratch space for update_mesh
+        bool patching = false;
+        std::vector<uint32_t> touched_tris, touched_verts;
+        std::vector<VertexCRef> corners;
+    };
+    mutable Render_Layout layout;
+
+    // Per-element geometry kept by cache_attributes, by element index
+    struct Attribute_Cache {
+        bool enabled = false, all_dirty = true;
+        std::vector<Vec3> vertex_normal, face_normal, face_center;
+        std::vector<float> face_area, edge_length;
+        std::vector<uint8_t> vertex_dirty, face_dirty, edge_dirty;
+        std::vector<uint32_t> dirty_vertices, dirty_faces, dirty_edges;
+
+        bool tracking() const {
+            return enabled && !all_dirty;
+        }
+        bool fresh(const std::vector<uint8_t>& dirty, uint32_t index) const {
+            return tracking() && index < dirty.size() && !dirty[index];
+        }
+        void invalidate(std::vector<uint8_t>& dirty, std::vector<uint32_t>& list,
+                        uint32_t index);
+    };
+    mutable Attribute_Cache attributes;
+
+    // Elements recorded for validate_local, from begin_local_check to end_local_check
+    struct Local_Check {
+        bool active = false;
+        std::vector<HalfedgeRef> halfedges;
+        std::vector<VertexRef> vertices;
+        std::vector<EdgeRef> edges;
+        std::vector<FaceRef> faces;
+    };
+    Local_Check local;
 
-/*
-    Some algorithms need to know how to compare two iterators (std::map)
-    Here we just say that one iterator comes before another if the address of the
-    object it points to is smaller. (You should not have to worry about this!)
-*/
-inline bool operator<(const Halfedge_Mesh::HalfedgeRef& i, const Halfedge_Mesh::HalfedgeRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::VertexRef& i, const Halfedge_Mesh::VertexRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::EdgeRef& i, const Halfedge_Mesh::EdgeRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::FaceRef& i, const Halfedge_Mesh::FaceRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::HalfedgeCRef& i, const Halfedge_Mesh::HalfedgeCRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::VertexCRef& i, const Halfedge_Mesh::VertexCRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::EdgeCRef& i, const Halfedge_Mesh::EdgeCRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::FaceCRef& i, const Halfedge_Mesh::FaceCRef& j) {
-    return &*i < &*j;
-}
+    void changed(VertexCRef v) {
+        last_snapshot.reset();
+        if(layout.valid) log_change(layout.changed_vertices, v.index());
+        if(attributes.tracking()) {
+            attributes.invalidate(attributes.vertex_dirty, attributes.dirty_vertices, v.index());
+        }
+    }
+    void changed(EdgeCRef e) {
+        last_snapshot.reset();
+        if(attributes.tracking()) {
+            attributes.invalidate(attributes.edge_dirty, attributes.dirty_edges, e.index());
+        }
+    }
+    void changed(FaceCRef f) {
+        last_snapshot.reset();
+        if(layout.valid) log_change(layout.changed_faces, f.index());
+        if(attributes.tracking()) {
+            attributes.invalidate(attributes.face_dirty, attributes.dirty_faces, f.index());
+        }
+    }
+    void log_change(std::vector<uint32_t>& log, uint32_t index);
+    void invalidate_around(VertexCRef v);
+    void layout_face(FaceCRef f, std::vector<GL::Mesh::Vert>& verts,
+                     std::vector<GL::Mesh::Index>& idxs) const;
+    void remove_tri(uint32_t t, std::vector<GL::Mesh::Vert>& verts,
+                    std::vector<GL::Mesh::Index>& idxs) const;
+};
 
 /*
     Some algorithms need to know how to hash references (std::unordered_map)
@@ -48,6 +48,48 @@ GL::Mesh quad_mesh(float x, float y) {
     return GL::Mesh(std::move(square.verts), std::move(square.elems));
 }
 
+GL::Mesh disk_mesh(float r, int sides) {
+
+    const float _2pi = PI_F * 2.0f;
+    const Vec3 up{0.0f, 1.0f, 0.0f};
+
+    std::vector<GL::Mesh::Vert> verts = {{Vec3{}, up, 0}};
+    std::vector<GL::Mesh::Index> elems;
+    for(int i = 0; i < sides; i++) {
+        float rad = (float)i / sides * _2pi;
+        verts.push_back({Vec3(std::cos(rad) * r, 0.0f, std::sin(rad) * r), up, 0});
+        elems.push_back(0);
+        elems.push_back((GL::Mesh::Index)(1 + (i + 1) % sides));
+        elems.push_back((GL::Mesh::Index)(1 + i));
+    }
+    return GL::Mesh(std::move(verts), std::move(elems));
+}
+
+GL::Mesh box_mesh(Vec3 h) {
+
+    std::vector<GL::Mesh::Vert> verts;
+    std::vector<GL::Mesh::Index> elems;
+    for(int a = 0; a < 3; a++) {
+        int b = (a + 1) % 3, c = (a + 2) % 3;
+        for(float side : {-1.0f, 1.0f}) {
+            Vec3 n;
+            n[a] = side;
+            GL::Mesh::Index base = (GL::Mesh::Index)verts.size();
+            for(int i = 0; i < 4; i++) {
+                Vec3 p;
+                p[a] = side * h[a];
+                p[b] = (i & 1 ? 1.0f : -1.0f) * h[b];
+                p[c] = (i & 2 ? 1.0f : -1.0f) * h[c];
+                verts.push_back({p, n, 0});
+            }
+            // Wind counter-clockwise as seen from outside
+            const GL::Mesh::Index front[] = {0, 1, 2, 2, 1, 3}, back[] = {0, 2, 1, 1, 2, 3};
+            for(GL::Mesh::Index i : side > 0.0f ? front : back) elems.push_back(base + i);
+        }
+    }
+    return GL::Mesh(std::move(verts), std::move(elems));
+}
+
 GL::Mesh sphere_mesh(float r, int i) {
     Gen::Data ico_sphere = Gen::ico_sphere(r, i);
     return GL::Mesh(std::move(ico_sphere.verts), std::move(ico_sphere.elems));
@@ -10,6 +10,9 @@ namespace Util {
 GL::Mesh cube_mesh(float radius);
 GL::Mesh square_mesh(float radius);
 GL::Mesh quad_mesh(float x, float y);
+GL::Mesh disk_mesh(float radius, int sides = 32);
+/// Box with separate vertices per face, so it is flat shaded
+GL::Mesh box_mesh(Vec3 half_size);
 GL::Mesh cyl_mesh(float radius, float height, int sides = 12, bool cap = true);
 GL::Mesh torus_mesh(float iradius, float oradius, int segments = 48, int sides = 24);
 GL::Mesh sphere_mesh(float r, int subdivsions);
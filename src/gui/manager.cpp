@@ -381,12 +381,39 @@ Mode Manager::item_options(Undo& undo, Mode cur_mode, Scene_Item& item, Pose& ol
                             (int)PT::Shape_Type::count)) {
                 if(obj.opt.shape_type == PT::Shape_Type::none)
                     obj.try_make_editable(start_opt.shape_type);
+                else
+                    obj.opt.shape = PT::Shape(obj.opt.shape_type);
                 update();
             }
-            if(obj.opt.shape_type == PT::Shape_Type::sphere) {
-                ImGui::DragFloat("Radius", &obj.opt.shape.get<PT::Sphere>().radius, 0.1f, 0.0f,
-                                 std::numeric_limits<float>::max(), "%.2f");
+
+            auto size = [&](const char* label, float* data, int n) {
+                const float max = std::numeric_limits<float>::max();
+                if(n == 1) ImGui::DragFloat(label, data, 0.1f, 0.0f, max, "%.2f");
+                if(n == 2) ImGui::DragFloat2(label, data, 0.1f, 0.0f, max, "%.2f");
+                if(n == 3) ImGui::DragFloat3(label, data, 0.1f, 0.0f, max, "%.2f");
                 activate();
+            };
+            switch(obj.opt.shape_type) {
+            case PT::Shape_Type::sphere: {
+                size("Radius", &obj.opt.shape.get<PT::Sphere>().radius, 1);
+            } break;
+            case PT::Shape_Type::box: {
+                size("Half Size", obj.opt.shape.get<PT::Box>().half_size.data, 3);
+            } break;
+            case PT::Shape_Type::cylinder: {
+                PT::Cylinder& cyl = obj.opt.shape.get<PT::Cylinder>();
+                size("Radius", &cyl.radius, 1);
+                size("Height", &cyl.height, 1);
+            } break;
+            case PT::Shape_Type::disk: {
+                size("Radius", &obj.opt.shape.get<PT::Disk>().radius, 1);
+            } break;
+            case PT::Shape_Type::plane: {
+                PT::Plane& plane = obj.opt.shape.get<PT::Plane>();
+                if(ImGui::Checkbox("Infinite", &plane.infinite)) update();
+                if(!plane.infinite) size("Half Size", plane.half_size.data, 2);
+            } break;
+            default: break;
             }
             ImGui::Unindent();
 
@@ -958,6 +985,10 @@ void Manager::UIsettings() {
     if(ImGui::Button("Apply")) {
         Renderer::get().set_samples(samples.n_samples());
     }
+    bool lod_changed = ImGui::Checkbox("Level of Detail", &lod_opt.enabled);
+    lod_changed |=
+        ImGui::SliderFloat("Pixels per Triangle", &lod_opt.tri_pixels, 1.0f, 64.0f, "%.0f");
+    if(lod_changed) Renderer::get().set_lod(lod_opt);
 
     ImGui::Separator();
     ImGui::Text("GPU: %s", GL::renderer().c_str());
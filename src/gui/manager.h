@@ -11,6 +11,7 @@
 #include "../lib/mathlib.h"
 #include "../util/camera.h"
 
+#include "../scene/renderer.h"
 #include "../scene/scene.h"
 #include "../scene/undo.h"
 
@@ -114,6 +115,7 @@ private:
     std::function<void(bool)> after_save;
 
     GL::MSAA samples;
+    Renderer::LODOpt lod_opt;
     Scene::Load_Opts load_opt;
 
     Widgets widgets;
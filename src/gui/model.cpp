@@ -19,7 +19,7 @@ Model::Model()
 
 void Model::begin_transform() {
 
-    my_mesh->copy_to(old_mesh);
+    old_mesh = my_mesh->snapshot();
 
     auto elem = *selected_element();
     trans_begin = {};
@@ -107,6 +107,7 @@ void Model::apply_transform(Widgets& widgets) {
                        if(action == Widget_Type::move) {
                            vert->pos = abs_pos;
                        }
+                       my_mesh->mark_changed(vert);
                        update_vertex(vert);
                    },
 
@@ -129,6 +130,7 @@ void Model::apply_transform(Widgets& widgets) {
                            h->vertex()->pos = s * (v0 - center) + center;
                            h->twin()->vertex()->pos = s * (v1 - center) + center;
                        }
+                       my_mesh->mark_changed(edge);
                        update_vertex(edge->halfedge()->vertex());
                        update_vertex(edge->halfedge()->twin()->vertex());
                    },
@@ -172,6 +174,7 @@ void Model::apply_transform(Widgets& widgets) {
                            }
                        }
 
+                       my_mesh->mark_changed(face);
                        h = face->halfedge();
                        do {
                            update_vertex(h->vertex());
@@ -224,7 +227,7 @@ void Model::vertex_viz(Halfedge_Mesh::VertexRef v, float& size, Mat4& transform)
 
     auto he = v->halfedge();
     do {
-        float len = he->edge()->length();
+        float len = my_mesh->cached_length(he->edge());
         min = std::min(min, len);
         avg += len;
         d++;
@@ -355,6 +358,7 @@ void Model::rebuild() {
     Halfedge_Mesh& mesh = *my_mesh;
 
     mesh.render_dirty_flag = false;
+    mesh.update_attributes();
 
     id_to_info.clear();
     vert_sizes.clear();
@@ -398,7 +402,9 @@ void Model::rebuild() {
         id_to_info[h->id()] = {h, arrows.add(transform, h->id())};
     }
 
-    validate();
+    // Edits made here were already checked; changes from elsewhere (e.g. undo) were not
+    if(!edit_validated) validate();
+    edit_validated = false;
 }
 
 bool Model::begin_bevel(std::string& err) {
@@ -410,7 +416,8 @@ bool Model::begin_bevel(std::string& err) {
         }
     }
 
-    my_mesh->copy_to(old_mesh);
+    old_mesh = my_mesh->snapshot();
+    my_mesh->begin_local_check(*sel);
 
     Halfedge_Mesh::FaceRef new_face;
     std::visit(overloaded{[&](Halfedge_Mesh::VertexRef vert) {
@@ -437,15 +444,16 @@ bool Model::begin_bevel(std::string& err) {
                           [&](auto) {}},
                *sel);
 
-    err = validate();
+    err = validate(true);
     if(!err.empty()) {
 
-        *my_mesh = std::move(old_mesh);
+        my_mesh->restore(old_mesh);
         return false;
 
     } else {
 
         my_mesh->render_dirty_flag = true;
+        my_mesh->mark_changed(new_face);
         set_selected(new_face);
 
         trans_begin = {};
@@ -507,19 +515,23 @@ bool Model::keydown(Widgets& widgets, SDL_Keysym key, Camera& cam) {
 }
 
 template<typename T>
-std::string Model::update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before,
+std::string Model::update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh::Snapshot&& before,
                                Halfedge_Mesh::ElementRef ref, T&& op) {
 
     unsigned int id = Halfedge_Mesh::id_of(ref);
+    my_mesh->begin_local_check(ref);
     std::optional<Halfedge_Mesh::ElementRef> new_ref = op(*my_mesh, ref);
-    if(!new_ref.has_value()) return {};
+    if(!new_ref.has_value()) {
+        my_mesh->end_local_check();
+        return {};
+    }
 
-    auto err = validate();
+    auto err = validate(true);
     if(!err.empty()) {
-        obj.take_mesh(std::move(before));
+        obj.set_mesh(before);
     } else {
         my_mesh->render_dirty_flag = true;
-        obj.set_mesh_dirty();
+        obj.set_mesh_changed(*new_ref);
         set_selected(*new_ref);
         undo.update_mesh(obj.id(), std::move(before), id, std::move(op));
     }
@@ -528,17 +540,16 @@ std::string Model::update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& be
 }
 
 template<typename T>
-std::string Model::update_mesh_global(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before,
-                                      T&& op) {
+std::string Model::update_mesh_global(Undo& undo, Scene_Object& obj,
+                                      Halfedge_Mesh::Snapshot&& before, T&& op) {
 
     bool suc = op(*my_mesh);
     if(!suc) return {};
 
     auto err = validate();
     if(!err.empty()) {
-        obj.take_mesh(std::move(before));
+        obj.set_mesh(before);
     } else {
-        my_mesh->render_dirty_flag = true;
         obj.set_mesh_dirty();
         selected_elem_id = 0;
         hovered_elem_id = 0;
@@ -547,17 +558,21 @@ std::string Model::update_mesh_global(Undo& undo, Scene_Object& obj, Halfedge_Me
     return err;
 }
 
-std::string Model::validate() {
+std::string Model::validate(bool local) {
 
-    auto valid = my_mesh->validate();
+    // Unless asked to check everything, local edits only check what they touched
+    local = local && !validate_all;
+    auto valid = local ? my_mesh->validate_local() : my_mesh->validate();
     if(valid.has_value()) {
+        my_mesh->end_local_check();
         auto& msg = valid.value();
         err_id = Halfedge_Mesh::id_of(msg.first);
         err_msg = msg.second;
         return msg.second;
     }
 
-    auto warn = my_mesh->warnings();
+    auto warn = local ? my_mesh->warnings_local() : my_mesh->warnings();
+    my_mesh->end_local_check();
     if(warn.has_value()) {
         auto& msg = warn.value();
         warn_id = Halfedge_Mesh::id_of(msg.first);
@@ -567,6 +582,7 @@ std::string Model::validate() {
         warn_msg = {};
     }
 
+    edit_validated = true;
     return {};
 }
 
@@ -604,12 +620,15 @@ std::optional<std::reference_wrapper<Scene_Object>> Model::set_my_obj(Scene_Mayb
 
     Halfedge_Mesh* old = my_mesh;
     my_mesh = &obj.get_mesh();
+    // The editor reports each edit it makes (see mark_changed), so attributes can be cached
+    my_mesh->cache_attributes(true);
 
     if(old != my_mesh) {
         selected_elem_id = 0;
         hovered_elem_id = 0;
         err_id = 0;
         warn_id = 0;
+        edit_validated = false;
         rebuild();
     } else if(old->render_dirty_flag) {
         rebuild();
@@ -631,39 +650,39 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
     Scene_Object& obj = opt.value();
 
     Halfedge_Mesh& mesh = *my_mesh;
-    Halfedge_Mesh before;
+    Halfedge_Mesh::Snapshot before;
 
     ImGui::Separator();
     ImGui::Text("Global Operations");
     if(ImGui::Button("Linear")) {
-        mesh.copy_to(before);
+        before = mesh.snapshot();
         return update_mesh_global(undo, obj, std::move(before),
                                   [](Halfedge_Mesh& m) { return m.subdivide(SubD::linear); });
     }
     if(Manager::wrap_button("Catmull-Clark")) {
-        mesh.copy_to(before);
+        before = mesh.snapshot();
         return update_mesh_global(undo, obj, std::move(before),
                                   [](Halfedge_Mesh& m) { return m.subdivide(SubD::catmullclark); });
     }
     if(Manager::wrap_button("Loop")) {
-        mesh.copy_to(before);
+        before = mesh.snapshot();
         return update_mesh_global(undo, obj, std::move(before),
                                   [](Halfedge_Mesh& m) { return m.subdivide(SubD::loop); });
     }
     if(ImGui::Button("Triangulate")) {
-        mesh.copy_to(before);
+        before = mesh.snapshot();
         return update_mesh_global(undo, obj, std::move(before), [](Halfedge_Mesh& m) {
             m.triangulate();
             return true;
         });
     }
     if(Manager::wrap_button("Remesh")) {
-        mesh.copy_to(before);
+        before = mesh.snapshot();
         return update_mesh_global(undo, obj, std::move(before),
                                   [](Halfedge_Mesh& m) { return m.isotropic_remesh(); });
     }
     if(Manager::wrap_button("Simplify")) {
-        mesh.copy_to(before);
+        before = mesh.snapshot();
         return update_mesh_global(undo, obj, std::move(before),
                                   [](Halfedge_Mesh& m) { return m.simplify(); });
     }
@@ -682,7 +701,7 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                 overloaded{
                     [&](Halfedge_Mesh::VertexRef vert) -> std::string {
                         if(ImGui::Button("Erase [del]")) {
-                            mesh.copy_to(before);
+                            before = mesh.snapshot();
                             return update_mesh(
                                 undo, obj, std::move(before), vert,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef vert) {
@@ -693,7 +712,7 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                     },
                     [&](Halfedge_Mesh::EdgeRef edge) -> std::string {
                         if(ImGui::Button("Erase [del]")) {
-                            mesh.copy_to(before);
+                            before = mesh.snapshot();
                             return update_mesh(
                                 undo, obj, std::move(before), edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
@@ -701,7 +720,7 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                                 });
                         }
                         if(Manager::wrap_button("Collapse")) {
-                            mesh.copy_to(before);
+                            before = mesh.snapshot();
                             return update_mesh(
                                 undo, obj, std::move(before), edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
@@ -709,7 +728,7 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                                 });
                         }
                         if(Manager::wrap_button("Flip")) {
-                            mesh.copy_to(before);
+                            before = mesh.snapshot();
                             return update_mesh(
                                 undo, obj, std::move(before), edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
@@ -717,7 +736,7 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                                 });
                         }
                         if(Manager::wrap_button("Split")) {
-                            mesh.copy_to(before);
+                            before = mesh.snapshot();
                             return update_mesh(
                                 undo, obj, std::move(before), edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
@@ -728,7 +747,7 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                     },
                     [&](Halfedge_Mesh::FaceRef face) -> std::string {
                         if(ImGui::Button("Collapse")) {
-                            mesh.copy_to(before);
+                            before = mesh.snapshot();
                             return update_mesh(
                                 undo, obj, std::move(before), face,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef face) {
@@ -841,6 +860,8 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
         }
     }
 
+    ImGui::Separator();
+    ImGui::Checkbox("Validate Whole Mesh", &validate_all);
     ImGui::Separator();
     return {};
 }
@@ -857,8 +878,7 @@ void Model::erase_selected(Undo& undo, Scene_Maybe obj_opt) {
     Halfedge_Mesh::ElementRef sel = sel_.value();
     Halfedge_Mesh& mesh = *my_mesh;
 
-    Halfedge_Mesh before;
-    mesh.copy_to(before);
+    Halfedge_Mesh::Snapshot before = mesh.snapshot();
 
     std::visit(overloaded{[&](Halfedge_Mesh::VertexRef vert) {
                               return update_mesh(
@@ -913,12 +933,19 @@ void Model::render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam) {
 
 std::string Model::end_transform(Widgets& widgets, Undo& undo, Scene_Object& obj) {
 
-    obj.set_mesh_dirty();
+    // Only the selected element (or bevel) moved
+    auto elem = selected_element();
+    if(elem.has_value()) {
+        obj.set_mesh_changed(*elem);
+        my_mesh->begin_local_check(*elem);
+    } else {
+        obj.set_mesh_dirty();
+    }
     my_mesh->render_dirty_flag = true;
 
-    auto err = validate();
+    auto err = validate(elem.has_value());
     if(!err.empty()) {
-        obj.take_mesh(std::move(old_mesh));
+        obj.set_mesh(old_mesh);
     } else {
         undo.update_mesh_full(obj.id(), std::move(old_mesh));
     }
@@ -39,10 +39,11 @@ public:
 
 private:
     template<typename T>
-    std::string update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before,
+    std::string update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh::Snapshot&& before,
                             Halfedge_Mesh::ElementRef ref, T&& op);
     template<typename T>
-    std::string update_mesh_global(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before, T&& op);
+    std::string update_mesh_global(Undo& undo, Scene_Object& obj,
+                                   Halfedge_Mesh::Snapshot&& before, T&& op);
 
     void zoom_to(Halfedge_Mesh::ElementRef ref, Camera& cam);
     void begin_transform();
@@ -59,15 +60,18 @@ private:
     void face_viz(Halfedge_Mesh::FaceRef face, std::vector<GL::Mesh::Vert>& verts,
                   std::vector<GL::Mesh::Index>& idxs, size_t insert_at);
 
-    std::string validate();
+    // Checks the mesh after an edit: with local, just the part recorded by
+    // Halfedge_Mesh::begin_local_check, unless validate_all is set
+    std::string validate(bool local = false);
     std::string warn_msg, err_msg;
+    bool validate_all = false, edit_validated = false;
 
     // This all needs to be updated when the mesh connectivity changes
     unsigned int warn_id = 0, err_id = 0;
     unsigned int selected_elem_id = 0, hovered_elem_id = 0;
 
     Halfedge_Mesh* my_mesh = nullptr;
-    Halfedge_Mesh old_mesh;
+    Halfedge_Mesh::Snapshot old_mesh;
 
     enum class Bevel { face, edge, vert };
     Bevel beveling;
@@ -128,6 +128,14 @@ std::pair<float, float> Render::completion_time() const {
     return ui_render.completion_time();
 }
 
+void Render::set_compressed(bool compress) {
+    ui_render.tracer().set_compressed(compress);
+}
+
+void Render::set_output(bool exr, bool half, bool layers) {
+    ui_render.set_output(exr, half, layers);
+}
+
 std::string Render::headless_render(Animate& animate, Scene& scene, std::string output, bool a,
                                     int w, int h, int s, int ls, int d, float exp, bool w_from_ar) {
     if(w_from_ar) {
@@ -23,6 +23,8 @@ public:
     std::string headless_render(Animate& animate, Scene& scene, std::string output, bool a, int w,
                                 int h, int s, int ls, int d, float exp, bool w_from_ar);
     std::pair<float, float> completion_time() const;
+    void set_compressed(bool compress);
+    void set_output(bool exr, bool half, bool layers);
 
     bool keydown(Widgets& widgets, SDL_Keysym key);
     Mode UIsidebar(Manager& manager, Undo& undo, Scene& scene, Scene_Maybe selected,
@@ -55,7 +55,7 @@ void Rig::render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam) {
         handle = nullptr;
     }
     if(my_obj->rig_dirty) {
-        mesh_bvh.build(obj.mesh());
+        mesh_bvh.build(obj.mesh(), PT::BVH_Builder::linear);
         my_obj->rig_dirty = false;
     }
 
@@ -214,7 +214,7 @@ Mode Rig::UIsidebar(Manager& manager, Undo& undo, Widgets& widgets, Scene_Maybe
         handle = nullptr;
     }
     if(my_obj->rig_dirty) {
-        mesh_bvh.build(obj.mesh());
+        mesh_bvh.build(obj.mesh(), PT::BVH_Builder::linear);
         my_obj->rig_dirty = false;
     }
 
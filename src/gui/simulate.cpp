@@ -10,13 +10,11 @@ namespace Gui {
 const char* Solid_Type_Names[(int)Solid_Type::count] = {"Sphere", "Cube", "Cylinder", "Torus",
                                                         "Custom"};
 
-Simulate::Simulate() : thread_pool(std::thread::hardware_concurrency()) {
+Simulate::Simulate() : thread_pool(Thread_Pool::shared()) {
     last_update = SDL_GetPerformanceCounter();
 }
 
 Simulate::~Simulate() {
-    thread_pool.wait();
-    thread_pool.stop();
 }
 
 bool Simulate::keydown(Widgets& widgets, Undo& undo, SDL_Keysym key) {
@@ -83,18 +81,19 @@ void Simulate::build_scene(Scene& scene) {
 
     std::mutex obj_mut;
     std::vector<PT::Object> obj_list;
+    Task_Group tasks(thread_pool, Priority::simulation);
 
     scene.for_items([&, this](Scene_Item& item) {
         if(item.is<Scene_Object>()) {
             Scene_Object& obj = item.get<Scene_Object>();
-            thread_pool.enqueue([&]() {
+            tasks.run([&]() {
                 if(obj.is_shape()) {
                     PT::Shape shape(obj.opt.shape);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         PT::Object(std::move(shape), obj.id(), 0, obj.pose.transform()));
                 } else {
-                    PT::Tri_Mesh mesh(obj.posed_mesh());
+                    PT::Tri_Mesh mesh(obj.posed_mesh(), PT::BVH_Builder::linear);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         PT::Object(std::move(mesh), obj.id(), 0, obj.pose.transform()));
@@ -112,8 +111,68 @@ void Simulate::build_scene(Scene& scene) {
         }
     });
 
-    thread_pool.wait();
-    scene_bvh.build(std::move(obj_list));
+    tasks.wait();
+    scene_bvh.build(std::move(obj_list), 1, PT::BVH_Builder::linear, &thread_pool);
+}
+
+bool Simulate::refit_scene(Scene& scene) {
+
+    if(!scene.has_particles()) return false;
+
+    std::vector<PT::Object>& prims = scene_bvh.edit_primitives();
+    std::unordered_map<Scene_ID, PT::Object*> objs;
+    for(PT::Object& obj : prims) {
+        objs[obj.id()] = &obj;
+    }
+    if(objs.empty() || objs.size() != prims.size()) return false;
+
+    std::atomic<bool> ok(true);
+    size_t n_objs = 0;
+    Task_Group tasks(thread_pool, Priority::simulation);
+
+    scene.for_items([&, this](Scene_Item& item) {
+        if(item.is<Scene_Object>()) {
+
+            Scene_Object& obj = item.get<Scene_Object>();
+            auto entry = objs.find(obj.id());
+            if(entry == objs.end()) {
+                ok = false;
+                return;
+            }
+            PT::Object* pt_obj = entry->second;
+            n_objs++;
+
+            tasks.run([&, pt_obj]() {
+                if(obj.is_shape()) {
+                    *pt_obj = PT::Object(PT::Shape(obj.opt.shape), obj.id(), 0,
+                                         obj.pose.transform());
+                } else {
+                    pt_obj->set_trans(obj.pose.transform());
+                    if(!pt_obj->refit(obj.posed_mesh())) ok = false;
+                }
+            });
+        } else if(item.is<Scene_Light>()) {
+
+            Scene_Light& light = item.get<Scene_Light>();
+            if(light.opt.type != Light_Type::rectangle) return;
+
+            auto entry = objs.find(light.id());
+            if(entry == objs.end()) {
+                ok = false;
+                return;
+            }
+            n_objs++;
+
+            PT::Tri_Mesh mesh(Util::quad_mesh(light.opt.size.x, light.opt.size.y));
+            *entry->second = PT::Object(std::move(mesh), light.id(), 0, light.pose.transform());
+        }
+    });
+
+    tasks.wait();
+    if(!ok || n_objs != objs.size()) return false;
+
+    scene_bvh.refit(&thread_pool);
+    return !scene_bvh.needs_rebuild();
 }
 
 void Simulate::clear_particles(Scene& scene) {
@@ -126,7 +185,7 @@ void Simulate::clear_particles(Scene& scene) {
 
 void Simulate::update_bvh(Scene& scene, Undo& undo) {
     if(cur_actions != undo.n_actions()) {
-        build_scene(scene);
+        if(!refit_scene(scene)) build_scene(scene);
         cur_actions = undo.n_actions();
     }
 }
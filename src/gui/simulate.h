@@ -30,13 +30,14 @@ public:
     void clear_particles(Scene& scene);
     void update_bvh(Scene& scene, Undo& undo);
     void build_scene(Scene& scene);
+    bool refit_scene(Scene& scene);
 
     void render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam);
     Mode UIsidebar(Manager& manager, Scene& scene, Undo& undo, Widgets& widgets, Scene_Maybe obj);
 
 private:
     PT::BVH<PT::Object> scene_bvh;
-    Thread_Pool thread_pool;
+    Thread_Pool& thread_pool;
     Pose old_pose;
     size_t cur_actions = 0;
     Uint64 last_update;
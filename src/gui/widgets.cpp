@@ -585,6 +585,20 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
         ImGui::InputInt("Area Light Samples", &out_area_samples, 1, 100);
         ImGui::InputInt("Max Ray Depth", &out_depth, 1, 32);
         ImGui::SliderFloat("Exposure", &exposure, 0.01f, 10.0f, "%.2f", 2.5f);
+        ImGui::Combo("Mesh BVH", (int*)&builder, PT::BVH_Builder_Names,
+                     (int)PT::BVH_Builder::count);
+        pathtracer.set_builder(builder);
+        ImGui::Checkbox("Compress Meshes", &compress_meshes);
+        pathtracer.set_compressed(compress_meshes);
+
+        static const char* output_names[] = {"PNG", "EXR", "EXR (Half)"};
+        ImGui::Combo("Output Format", (int*)&out_format, output_names, (int)Output::count);
+        if(out_format != Output::png) {
+            ImGui::Combo("EXR Compression", (int*)&out_compression, EXR_Compression_Names,
+                         (int)EXR_Compression::count);
+            ImGui::Checkbox("EXR Layers", &out_layers);
+        }
+        pathtracer.set_layers(out_format != Output::png && out_layers);
     } else {
         ImGui::Combo("Samples", (int*)&msaa.samples, GL::Sample_Count_Names, msaa.n_options());
         out_samples = msaa.n_samples();
@@ -607,6 +621,12 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
 
 std::string Widget_Render::step(Animate& animate, Scene& scene) {
 
+    std::string save_err = exr_writer.poll();
+    if(!save_err.empty()) {
+        animating = false;
+        return save_err;
+    }
+
     if(animating) {
 
         if(next_frame == max_frame) {
@@ -651,25 +671,22 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
             }
 
             if(!pathtracer.in_progress()) {
-                std::vector<unsigned char> data;
 
-                pathtracer.get_output().tonemap_to(data, exposure);
                 std::stringstream str;
                 str << std::setfill('0') << std::setw(4) << next_frame;
 #ifdef _WIN32
-                std::string path = folder + "\\" + str.str() + ".png";
+                std::string path = folder + "\\" + str.str() + output_ext();
 #else
-                std::string path = folder + "/" + str.str() + ".png";
+                std::string path = folder + "/" + str.str() + output_ext();
 #endif
 
-                stbi_flip_vertically_on_write(false);
-                if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
-                                   (int)out_w * 4)) {
+                std::string err = save_output(path, exposure);
+                if(!err.empty()) {
                     animating = false;
-                    return "Failed to write output!";
+                    return err;
                 }
 
-                pathtracer.begin_render(scene, cam);
+                pathtracer.begin_render(scene, cam, false, true);
                 next_frame++;
             }
         }
@@ -747,11 +764,53 @@ static bool postfix(const std::string& path, const std::string& type) {
     return false;
 }
 
+void Widget_Render::set_output(bool exr, bool half, bool layers) {
+    out_format = exr ? (half ? Output::exr_half : Output::exr) : Output::png;
+    out_layers = layers;
+    pathtracer.set_layers(exr && layers);
+}
+
+std::string Widget_Render::output_ext() const {
+    return out_format == Output::png ? ".png" : ".exr";
+}
+
+std::string Widget_Render::save_output(std::string path, float exp) {
+
+    // The output format decides what is written, so the path is given its extension
+    std::string ext = output_ext();
+    if(!postfix(path, ext)) {
+        std::string other = ext == ".exr" ? ".png" : ".exr";
+        if(postfix(path, other)) path.resize(path.size() - other.size());
+        path += ext;
+    }
+
+    // EXRs hold the raw accumulator, so they don't need tonemapping and can be
+    // compressed and written while the next render runs
+    if(out_format != Output::png) {
+        EXR_Options opt;
+        opt.half = out_format == Output::exr_half;
+        opt.compression = out_compression;
+        exr_writer.write(path, out_w, out_h, pathtracer.get_layers(), opt);
+        return {};
+    }
+
+    std::vector<unsigned char> data;
+    pathtracer.get_output().tonemap_to(data, exp);
+    stbi_flip_vertically_on_write(false);
+    if(!stbi_write_png(path.c_str(), out_w, out_h, 4, data.data(), out_w * 4)) {
+        return "Failed to write output!";
+    }
+    return {};
+}
+
 bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::string& err) {
 
     bool ret = false;
     if(!render_window) return ret;
 
+    std::string save_err = exr_writer.poll();
+    if(!save_err.empty()) err = save_err;
+
     begin(scene, cam, user_cam);
 
     ImGui::Separator();
@@ -785,27 +844,26 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
     ImGui::SameLine();
     if(ImGui::Button("Save Image")) {
         char* path = nullptr;
-        NFD_SaveDialog("png", nullptr, &path);
+        std::string ext = method == 1 ? output_ext() : ".png";
+        NFD_SaveDialog(ext.c_str() + 1, nullptr, &path);
         if(path) {
 
             std::string spath(path);
-            if(!postfix(spath, ".png")) {
-                spath += ".png";
+            if(!postfix(spath, ext)) {
+                spath += ext;
             }
 
-            std::vector<unsigned char> data;
-
             if(method == 1) {
-                pathtracer.get_output().tonemap_to(data, exposure);
-                stbi_flip_vertically_on_write(false);
+                std::string save = save_output(spath, exposure);
+                if(!save.empty()) err = save;
             } else {
+                std::vector<unsigned char> data;
                 Renderer::get().saved(data);
                 stbi_flip_vertically_on_write(true);
-            }
-
-            if(!stbi_write_png(spath.c_str(), (int)out_w, (int)out_h, 4, data.data(),
-                               (int)out_w * 4)) {
-                err = "Failed to write png!";
+                if(!stbi_write_png(spath.c_str(), (int)out_w, (int)out_h, 4, data.data(),
+                                   (int)out_w * 4)) {
+                    err = "Failed to write png!";
+                }
             }
             free(path);
         }
@@ -899,14 +957,11 @@ std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera
         }
         std::cout << std::endl;
 
-        std::vector<unsigned char> data;
-        pathtracer.get_output().tonemap_to(data, exp);
-        if(!stbi_write_png(output.c_str(), w, h, 4, data.data(), w * 4)) {
-            return "Failed to write output!";
-        }
+        std::string err = save_output(output, exp);
+        if(!err.empty()) return err;
     }
 
-    return {};
+    return exr_writer.poll(true);
 }
 
 void Widget_Render::render_log(const Mat4& view) const {
@@ -85,6 +85,7 @@ public:
 
     std::string headless(Animate& animate, Scene& scene, const Camera& cam, std::string output,
                          bool a, int w, int h, int s, int ls, int d, float exp);
+    void set_output(bool exr, bool half, bool layers);
 
     void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
     void render_log(const Mat4& view) const;
@@ -107,13 +108,23 @@ public:
 
 private:
     void begin(Scene& scene, Widget_Camera& cam, Camera& user_cam);
+    std::string save_output(std::string path, float exp);
+    std::string output_ext() const;
 
     mutable std::mutex log_mut;
     GL::Lines ray_log;
 
     int out_w, out_h, out_samples = 32, out_area_samples = 8, out_depth = 4;
+    PT::BVH_Builder builder = PT::BVH_Builder::sah;
+    bool compress_meshes = false;
     float exposure = 1.0f;
 
+    enum class Output : int { png, exr, exr_half, count };
+    Output out_format = Output::png;
+    EXR_Compression out_compression = EXR_Compression::zip;
+    bool out_layers = false;
+    EXR_Writer exr_writer;
+
     bool has_rendered = false;
     bool render_window = false, render_window_focus = false;
 
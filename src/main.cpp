@@ -23,6 +23,20 @@ int main(int argc, char** argv) {
     args.add_option("--samples", settings.s, "Pixel samples (if headless)");
     args.add_option("--exposure", settings.exp, "Output exposure (if headless)");
     args.add_option("--area_samples", settings.ls, "Area light samples (if headless)");
+    args.add_flag("--compress_meshes", settings.compress_meshes,
+                  "Store meshes quantized to save memory (if headless)");
+    args.add_flag("--exr", settings.exr,
+                  "Write EXR instead of PNG; implied by a .exr output file (if headless)");
+    args.add_flag("--exr_half", settings.exr_half, "Write EXR output as half floats (if headless)");
+    args.add_flag("--exr_layers", settings.exr_layers,
+                  "Add sample count, variance, albedo, normal, and depth layers to EXR output "
+                  "(if headless)");
+    args.add_option("--bvh_cache", settings.bvh_cache_dir, "Directory to cache mesh BVHs in");
+    args.add_option("--bvh_cache_mb", settings.bvh_cache_mb, "Maximum size of the BVH cache in MB");
+    args.add_flag("--bvh_cache_no_verify", settings.bvh_cache_no_verify,
+                  "Skip checking BVH cache entries against their checksums when loading");
+    args.add_option("--texture_cache", settings.texture_cache_dir,
+                    "Directory to cache tiled environment maps in");
 
     CLI11_PARSE(args, argc, argv);
 
@@ -2,6 +2,7 @@
 #include "gl.h"
 #include "../lib/log.h"
 
+#include <algorithm>
 #include <fstream>
 
 namespace GL {
@@ -160,6 +161,15 @@ void Tex2D::image(int w, int h, unsigned char* img) {
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void Tex2D::update(int x, int y, int w, int h, int stride, const unsigned char* img) {
+    assert(id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, img);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 TexID Tex2D::get_id() const {
     return id;
 }
@@ -180,6 +190,10 @@ Mesh::Mesh(Mesh&& src) {
     src.ebo = 0;
     vbo = src.vbo;
     src.vbo = 0;
+    vbo_size = src.vbo_size;
+    ebo_size = src.ebo_size;
+    vert_patches = std::move(src.vert_patches);
+    idx_patches = std::move(src.idx_patches);
     dirty = src.dirty;
     src.dirty = true;
     n_elem = src.n_elem;
@@ -198,6 +212,10 @@ void Mesh::operator=(Mesh&& src) {
     src.vbo = 0;
     ebo = src.ebo;
     src.ebo = 0;
+    vbo_size = src.vbo_size;
+    ebo_size = src.ebo_size;
+    vert_patches = std::move(src.vert_patches);
+    idx_patches = std::move(src.idx_patches);
     dirty = src.dirty;
     src.dirty = true;
     n_elem = src.n_elem;
@@ -247,18 +265,58 @@ void Mesh::destroy() {
     ebo = vao = vbo = 0;
 }
 
+// Uploads the patched ranges of an array into the bound buffer, merging overlapping ones
+template<typename T>
+static void upload_patches(GLenum target, const std::vector<T>& data,
+                           std::vector<std::pair<size_t, size_t>>& patches) {
+    std::sort(patches.begin(), patches.end());
+    size_t i = 0;
+    while(i < patches.size()) {
+        size_t begin = patches[i].first, end = patches[i].second;
+        for(i++; i < patches.size() && patches[i].first <= end; i++) {
+            end = std::max(end, patches[i].second);
+        }
+        end = std::min(end, data.size());
+        if(begin < end) {
+            glBufferSubData(target, sizeof(T) * begin, sizeof(T) * (end - begin),
+                            data.data() + begin);
+        }
+    }
+    patches.clear();
+}
+
+// Reallocates the bound buffer for all of an array. Buffers outgrown by patches get
+// room for the whole vector capacity, so a growing mesh is not reallocated every time.
+template<typename T>
+static size_t upload_all(GLenum target, const std::vector<T>& data, bool grow) {
+    size_t size = grow ? data.capacity() : data.size();
+    glBufferData(target, sizeof(T) * size, grow ? nullptr : data.data(), GL_DYNAMIC_DRAW);
+    if(grow) glBufferSubData(target, 0, sizeof(T) * data.size(), data.data());
+    return size;
+}
+
 void Mesh::update() {
     glBindVertexArray(vao);
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vert) * _verts.size(), _verts.data(), GL_DYNAMIC_DRAW);
+    if(dirty || _verts.size() > vbo_size) {
+        vbo_size = upload_all(GL_ARRAY_BUFFER, _verts, !dirty);
+        vert_patches.clear();
+    } else {
+        upload_patches(GL_ARRAY_BUFFER, _verts, vert_patches);
+    }
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Index) * _idxs.size(), _idxs.data(),
-                 GL_DYNAMIC_DRAW);
+    if(dirty || _idxs.size() > ebo_size) {
+        ebo_size = upload_all(GL_ELEMENT_ARRAY_BUFFER, _idxs, !dirty);
+        idx_patches.clear();
+    } else {
+        upload_patches(GL_ELEMENT_ARRAY_BUFFER, _idxs, idx_patches);
+    }
 
     glBindVertexArray(0);
 
+    n_elem = (GLuint)_idxs.size();
     dirty = false;
 }
 
@@ -295,6 +353,31 @@ std::vector<Mesh::Index>& Mesh::edit_indices() {
     return _idxs;
 }
 
+std::vector<Mesh::Vert>& Mesh::patch_verts() {
+    return _verts;
+}
+
+std::vector<Mesh::Index>& Mesh::patch_indices() {
+    return _idxs;
+}
+
+void Mesh::patched_verts(size_t begin, size_t end) {
+    end = std::min(end, _verts.size());
+    if(begin >= end) return;
+    vert_patches.push_back({begin, end});
+    // The box only grows to fit the patch: it is recomputed by the next recreate()
+    for(size_t i = begin; i < end; i++) {
+        _bbox.enclose(_verts[i].pos);
+    }
+}
+
+void Mesh::patched_indices(size_t begin, size_t end) {
+    n_elem = (GLuint)_idxs.size();
+    end = std::min(end, _idxs.size());
+    if(begin >= end) return;
+    idx_patches.push_back({begin, end});
+}
+
 const std::vector<Mesh::Vert>& Mesh::verts() const {
     return _verts;
 }
@@ -308,7 +391,7 @@ BBox Mesh::bbox() const {
 }
 
 void Mesh::render() {
-    if(dirty) update();
+    if(dirty || !vert_patches.empty() || !idx_patches.empty()) update();
     glBindVertexArray(vao);
     glDrawElements(GL_TRIANGLES, n_elem, GL_UNSIGNED_INT, nullptr);
     glBindVertexArray(0);
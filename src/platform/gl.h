@@ -3,6 +3,7 @@
 
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../lib/mathlib.h"
@@ -49,6 +50,9 @@ public:
     void operator=(Tex2D&& src);
 
     void image(int w, int h, unsigned char* img);
+    /// Replace a w by h region at (x, y) of the existing image. Rows of img are stride
+    /// pixels apart.
+    void update(int x, int y, int w, int h, int stride, const unsigned char* img);
     TexID get_id() const;
     void bind(int idx = 0) const;
 
@@ -80,6 +84,14 @@ public:
     void recreate(std::vector<Vert>&& vertices, std::vector<Index>&& indices);
     std::vector<Vert>& edit_verts();
     std::vector<Index>& edit_indices();
+
+    /// For editing part of the mesh in place: unlike edit_verts/edit_indices, these don't
+    /// mark the whole mesh for upload. Report each range written with patched_verts or
+    /// patched_indices; only those are re-uploaded (unless an array outgrew its buffer).
+    std::vector<Vert>& patch_verts();
+    std::vector<Index>& patch_indices();
+    void patched_verts(size_t begin, size_t end);
+    void patched_indices(size_t begin, size_t end);
     Mesh copy() const;
 
     BBox bbox() const;
@@ -97,6 +109,10 @@ private:
     GLuint n_elem = 0;
     bool dirty = true;
 
+    // Number of vertices/indices the buffers have room for, and ranges waiting for upload
+    size_t vbo_size = 0, ebo_size = 0;
+    std::vector<std::pair<size_t, size_t>> vert_patches, idx_patches;
+
     std::vector<Vert> _verts;
     std::vector<Index> _idxs;
 
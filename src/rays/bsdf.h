@@ -123,6 +123,17 @@ public:
                           underlying);
     }
 
+    /// Overall surface color, used for the albedo output layer
+    Spectrum albedo() const {
+        return std::visit(
+            overloaded{[](const BSDF_Lambertian& b) { return b.albedo; },
+                       [](const BSDF_Mirror& b) { return b.reflectance; },
+                       [](const BSDF_Glass& b) { return (b.reflectance + b.transmittance) * 0.5f; },
+                       [](const BSDF_Diffuse&) { return Spectrum(1.0f); },
+                       [](const BSDF_Refract& b) { return b.transmittance; }},
+            underlying);
+    }
+
     bool is_sided() const {
         return std::visit(overloaded{[](const BSDF_Lambertian&) { return false; },
                                      [](const BSDF_Mirror&) { return false; },
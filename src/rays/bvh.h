@@ -3,16 +3,35 @@
 
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
+#include "../util/thread_pool.h"
 
 #include "trace.h"
 
 namespace PT {
 
+enum class BVH_Builder : int { sah, spatial, linear, count };
+inline const char* BVH_Builder_Names[(int)BVH_Builder::count] = {"SAH", "Spatial Splits",
+                                                                 "Linear (Morton)"};
+
+class BVH_Cache;
+
 template<typename Primitive> class BVH {
 public:
     BVH() = default;
     BVH(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
-    void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
+    /// Build with the given builder. Spatial splits fall back to SAH for primitives that
+    /// can't be clipped; the pool (if any) is used by builders that run in parallel.
+    void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1,
+               BVH_Builder builder = BVH_Builder::sah, Thread_Pool* pool = nullptr);
+    /// Build with spatial splits, which may reference a primitive from several leaves.
+    /// At most max_duplication * primitives.size() extra references are created.
+    void build_spatial(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1,
+                       float max_duplication = 0.5f);
+    /// Build by sorting primitives along a Morton curve, optionally followed by
+    /// restructuring small treelets to lower the SAH cost. Much faster than the SAH
+    /// build at some cost in traversal performance.
+    void build_linear(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1,
+                      Thread_Pool* pool = nullptr, bool optimize = true);
 
     BVH(BVH&& src) = default;
     BVH& operator=(BVH&& src) = default;
@@ -22,6 +41,25 @@ public:
 
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    /// Traversal behind hit(): the primitives of each leaf are intersected together by
+    /// leaf_hit(ray, start, size), which returns the closest hit among them
+    template<typename Leaf_Hit> Trace hit(const Ray& ray, const Leaf_Hit& leaf_hit) const;
+
+    /// Recompute node bounds bottom-up after primitives have moved. The tree topology
+    /// is kept as-is; leaves are refit in parallel when a thread pool is given.
+    void refit(Thread_Pool* pool = nullptr);
+    /// Surface area heuristic cost of the current tree, relative to the root bounds
+    float sah_cost() const;
+    /// Whether refitting has degraded the SAH cost past max_cost_ratio times its build-time value
+    bool needs_rebuild(float max_cost_ratio = 1.5f) const;
+    std::vector<Primitive>& edit_primitives();
+    const std::vector<Primitive>& get_primitives() const;
+    /// Call f(start, size) with the primitive range of each leaf
+    template<typename F> void for_each_leaf(const F& f) const;
+
+    size_t n_nodes() const;
+    /// Bytes used by the nodes and primitives, excluding memory owned by the primitives
+    size_t bytes() const;
 
     BVH copy() const;
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
@@ -36,12 +74,26 @@ private:
 
         bool is_leaf() const;
         friend class BVH<Primitive>;
+        friend class BVH_Cache;
     };
     size_t new_node(BBox box = {}, size_t start = 0, size_t size = 0, size_t l = 0, size_t r = 0);
+    template<typename Box_Of> float sah_cost(const Box_Of& box_of) const;
+    /// SAH cost of the tree as built, over the bounds a refit computes. Spatial splits clip
+    /// node bounds tighter than that, so the built bounds can't be compared against a refit.
+    float refit_baseline() const;
 
     std::vector<Node> nodes;
     std::vector<Primitive> primitives;
     size_t root_idx = 0;
+
+    friend class BVH_Cache;
+
+    static const inline size_t refit_grain = 256;
+    static const inline size_t spatial_bins = 32;
+    static const inline size_t spatial_max_depth = 64;
+    static const inline size_t linear_grain = 4096;
+    static const inline size_t treelet_leaves = 5;
+    float built_cost = 0.0f, refit_cost = 0.0f;
 };
 
 } // namespace PT
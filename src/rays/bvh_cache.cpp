@@ -0,0 +1,328 @@
+
+#include "bvh_cache.h"
+#include "tri_mesh.h"
+
+#include "../util/mapped_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace PT {
+
+namespace {
+
+const char cache_magic[8] = {'C', '3', 'D', 'B', 'V', 'H', '\0', '\0'};
+const uint32_t cache_version = 3;
+
+struct Cache_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t key;
+    uint64_t n_nodes, n_tris, n_verts;
+    uint64_t root_idx;
+    uint64_t checksum;
+    float built_cost;
+    uint32_t padding;
+};
+
+struct Cache_Tri {
+    uint32_t v0, v1, v2, flat;
+};
+
+} // namespace
+
+BVH_Cache& BVH_Cache::get() {
+    static BVH_Cache cache;
+    return cache;
+}
+
+void BVH_Cache::configure(std::string _dir, size_t _max_bytes, bool _verify) {
+    dir = _dir;
+    max_bytes = _max_bytes;
+    verify = _verify;
+    if(dir.empty()) return;
+
+    std::error_code err;
+    fs::create_directories(dir, err);
+    if(err) {
+        warn("Failed to create BVH cache directory %s: %s", dir.c_str(), err.message().c_str());
+        dir.clear();
+    }
+}
+
+bool BVH_Cache::enabled() const {
+    return !dir.empty();
+}
+
+uint64_t BVH_Cache::hash(const void* data, size_t bytes, uint64_t seed) {
+
+    auto mix = [](uint64_t h, uint64_t w) {
+        h ^= w * 0x9E3779B97F4A7C15ull;
+        h = (h << 31) | (h >> 33);
+        return h * 0xBF58476D1CE4E5B9ull;
+    };
+
+    const unsigned char* ptr = (const unsigned char*)data;
+    uint64_t h = mix(seed, bytes);
+    size_t i = 0;
+    for(; i + 8 <= bytes; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, ptr + i, 8);
+        h = mix(h, w);
+    }
+    if(i < bytes) {
+        uint64_t w = 0;
+        std::memcpy(&w, ptr + i, bytes - i);
+        h = mix(h, w);
+    }
+    return h ^ (h >> 29);
+}
+
+uint64_t BVH_Cache::key(const GL::Mesh& mesh, BVH_Builder builder, size_t max_leaf_size) const {
+
+    uint64_t settings[] = {cache_version, (uint64_t)builder, max_leaf_size};
+    uint64_t h = hash(settings, sizeof(settings));
+
+    for(const GL::Mesh::Vert& v : mesh.verts()) {
+        float data[] = {v.pos.x, v.pos.y, v.pos.z, v.norm.x, v.norm.y, v.norm.z};
+        h = hash(data, sizeof(data), h);
+    }
+
+    const auto& idxs = mesh.indices();
+    return hash(idxs.data(), idxs.size() * sizeof(GL::Mesh::Index), h);
+}
+
+std::string BVH_Cache::path(uint64_t key) const {
+    std::stringstream name;
+    name << std::hex << key << ".bvh";
+    return (fs::path(dir) / name.str()).string();
+}
+
+bool BVH_Cache::load(uint64_t key, Tri_Mesh& mesh) const {
+
+    using Node = BVH<Triangle>::Node;
+
+    std::string file = path(key);
+    Mapped_File map;
+    if(!map.open(file).empty()) return false;
+
+    // Stale or corrupt entries are removed so they get rebuilt
+    auto reject = [&]() {
+        map.close();
+        std::error_code err;
+        fs::remove(file, err);
+        warn("Discarding invalid BVH cache entry %s", file.c_str());
+        return false;
+    };
+
+    if(map.size() < sizeof(Cache_Header)) return reject();
+
+    Cache_Header header;
+    std::memcpy(&header, map.data(), sizeof(Cache_Header));
+
+    if(std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) ||
+       header.version != cache_version || header.node_size != sizeof(Node) ||
+       header.key != key) {
+        return reject();
+    }
+
+    size_t payload = map.size() - sizeof(Cache_Header);
+    if(header.n_nodes > payload / sizeof(Node) || header.n_tris > payload / sizeof(Cache_Tri) ||
+       header.n_verts > payload / sizeof(Tri_Mesh_Vert)) {
+        return reject();
+    }
+
+    size_t node_bytes = header.n_nodes * sizeof(Node);
+    size_t tri_bytes = header.n_tris * sizeof(Cache_Tri);
+    size_t vert_bytes = header.n_verts * sizeof(Tri_Mesh_Vert);
+    if(node_bytes + tri_bytes + vert_bytes != payload) return reject();
+
+    const unsigned char* nodes = map.data() + sizeof(Cache_Header);
+    const unsigned char* tris = nodes + node_bytes;
+    const unsigned char* verts = tris + tri_bytes;
+
+    // Hashing reads the whole entry again, which costs more than copying it out; without
+    // it, the structure checks below still keep a corrupt tree from being traversed
+    if(verify) {
+        uint64_t h = hash(nodes, node_bytes);
+        h = hash(tris, tri_bytes, h);
+        if(hash(verts, vert_bytes, h) != header.checksum) return reject();
+    }
+
+    if(header.n_nodes && header.root_idx >= header.n_nodes) return reject();
+
+    mesh.verts.resize(header.n_verts);
+    std::memcpy(mesh.verts.data(), verts, vert_bytes);
+
+    BVH<Triangle>& bvh = mesh.triangles;
+    bvh.nodes.resize(header.n_nodes);
+    std::memcpy(bvh.nodes.data(), nodes, node_bytes);
+
+    // Every node must be reached exactly once from the root, which rules out cycles and
+    // shared subtrees, and interior bounds must be finite and contain their children's
+    auto contains = [](const BBox& outer, const BBox& inner) {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y &&
+               outer.min.z <= inner.min.z && outer.max.x >= inner.max.x &&
+               outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+    };
+    bool bad = false;
+    if(header.n_nodes) {
+        std::vector<bool> reached(header.n_nodes, false);
+        std::vector<size_t> stack = {header.root_idx};
+        reached[header.root_idx] = true;
+        size_t n_reached = 1;
+        while(!stack.empty() && !bad) {
+            const Node& node = bvh.nodes[stack.back()];
+            stack.pop_back();
+            if(!node.bbox.min.valid() || !node.bbox.max.valid()) {
+                bad = true;
+            } else if(node.is_leaf()) {
+                bad = node.start > header.n_tris || node.size > header.n_tris - node.start;
+            } else {
+                for(size_t c : {node.l, node.r}) {
+                    if(c >= header.n_nodes || reached[c] ||
+                       !contains(node.bbox, bvh.nodes[c].bbox)) {
+                        bad = true;
+                        break;
+                    }
+                    reached[c] = true;
+                    n_reached++;
+                    stack.push_back(c);
+                }
+            }
+        }
+        bad = bad || n_reached != header.n_nodes;
+    }
+    if(bad) {
+        mesh.verts.clear();
+        bvh.clear();
+        return reject();
+    }
+
+    bvh.primitives.clear();
+    bvh.primitives.reserve(header.n_tris);
+    for(size_t i = 0; i < header.n_tris; i++) {
+        Cache_Tri t;
+        std::memcpy(&t, tris + i * sizeof(Cache_Tri), sizeof(Cache_Tri));
+        if(t.v0 >= header.n_verts || t.v1 >= header.n_verts || t.v2 >= header.n_verts) {
+            mesh.verts.clear();
+            bvh.clear();
+            return reject();
+        }
+        bvh.primitives.push_back(Triangle(mesh.verts.data(), t.v0, t.v1, t.v2));
+        bvh.primitives.back().flat = t.flat != 0;
+    }
+
+    bvh.root_idx = header.root_idx;
+    bvh.built_cost = header.built_cost;
+    bvh.refit_cost = 0.0f;
+
+    // Entries are evicted least recently used first
+    std::error_code err;
+    fs::last_write_time(file, fs::file_time_type::clock::now(), err);
+    return true;
+}
+
+void BVH_Cache::store(uint64_t key, const Tri_Mesh& mesh) {
+
+    const BVH<Triangle>& bvh = mesh.triangles;
+
+    std::vector<Cache_Tri> tris;
+    tris.reserve(bvh.primitives.size());
+    for(const Triangle& t : bvh.primitives) {
+        tris.push_back({t.v0, t.v1, t.v2, (uint32_t)t.flat});
+    }
+
+    size_t node_bytes = bvh.nodes.size() * sizeof(bvh.nodes[0]);
+    size_t tri_bytes = tris.size() * sizeof(Cache_Tri);
+    size_t vert_bytes = mesh.verts.size() * sizeof(Tri_Mesh_Vert);
+
+    Cache_Header header = {};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.node_size = (uint32_t)sizeof(bvh.nodes[0]);
+    header.key = key;
+    header.n_nodes = bvh.nodes.size();
+    header.n_tris = tris.size();
+    header.n_verts = mesh.verts.size();
+    header.root_idx = bvh.root_idx;
+    header.built_cost = bvh.built_cost;
+
+    uint64_t h = hash(bvh.nodes.data(), node_bytes);
+    h = hash(tris.data(), tri_bytes, h);
+    header.checksum = hash(mesh.verts.data(), vert_bytes, h);
+
+    // Write to a temporary file first so readers never see a partial entry
+    std::string file = path(key);
+    std::stringstream tmp;
+    tmp << file << "." << std::this_thread::get_id() << ".tmp";
+
+    {
+        std::ofstream out(tmp.str(), std::ios::binary | std::ios::trunc);
+        if(!out) {
+            warn("Failed to write BVH cache entry %s", file.c_str());
+            return;
+        }
+        out.write((const char*)&header, sizeof(Cache_Header));
+        out.write((const char*)bvh.nodes.data(), node_bytes);
+        out.write((const char*)tris.data(), tri_bytes);
+        out.write((const char*)mesh.verts.data(), vert_bytes);
+        if(!out) {
+            out.close();
+            std::error_code err;
+            fs::remove(tmp.str(), err);
+            warn("Failed to write BVH cache entry %s", file.c_str());
+            return;
+        }
+    }
+
+    std::error_code err;
+    fs::rename(tmp.str(), file, err);
+    if(err) {
+        fs::remove(tmp.str(), err);
+        return;
+    }
+
+    evict();
+}
+
+void BVH_Cache::evict() {
+
+    std::lock_guard<std::mutex> lock(evict_mut);
+
+    struct Entry {
+        fs::path path;
+        fs::file_time_type time;
+        uintmax_t size;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+
+    std::error_code err;
+    for(const auto& file : fs::directory_iterator(dir, err)) {
+        if(!file.is_regular_file(err) || file.path().extension() != ".bvh") continue;
+        uintmax_t size = file.file_size(err);
+        if(err) continue;
+        entries.push_back({file.path(), file.last_write_time(err), size});
+        total += size;
+    }
+
+    if(total <= max_bytes) return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& l, const Entry& r) { return l.time < r.time; });
+
+    for(const Entry& e : entries) {
+        if(total <= max_bytes) break;
+        if(fs::remove(e.path, err)) total -= e.size;
+    }
+}
+
+} // namespace PT
@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "../platform/gl.h"
+#include "bvh.h"
+
+namespace PT {
+
+class Tri_Mesh;
+
+/// On-disk cache of triangle mesh BVHs, keyed by a hash of the mesh data and builder settings.
+/// Entries are flat, versioned binary files that are memory-mapped and copied out in bulk.
+/// Loads check each entry's checksum (unless verify is unset) and the structure of its tree.
+class BVH_Cache {
+public:
+    static BVH_Cache& get();
+
+    /// An empty directory disables the cache
+    void configure(std::string dir, size_t max_bytes, bool verify = true);
+    bool enabled() const;
+
+    uint64_t key(const GL::Mesh& mesh, BVH_Builder builder, size_t max_leaf_size) const;
+    bool load(uint64_t key, Tri_Mesh& mesh) const;
+    void store(uint64_t key, const Tri_Mesh& mesh);
+
+    static uint64_t hash(const void* data, size_t bytes, uint64_t seed = 0);
+
+private:
+    BVH_Cache() = default;
+    std::string path(uint64_t key) const;
+    void evict();
+
+    std::mutex evict_mut;
+    std::string dir;
+    size_t max_bytes = 0;
+    bool verify = true;
+};
+
+} // namespace PT
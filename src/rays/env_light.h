@@ -1,11 +1,14 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
 #include <variant>
 
 #include "../lib/mathlib.h"
 #include "../lib/spectrum.h"
 #include "../util/hdr_image.h"
+#include "../util/tiled_image.h"
 
 #include "light.h"
 #include "samplers.h"
@@ -36,25 +39,51 @@ struct Env_Sphere {
     Samplers::Sphere::Uniform sampler;
 };
 
+// Environment image and its sampling tables. Immutable once built: the scene light owns
+// a shared reference and renders borrow it rather than copying the image.
 struct Env_Map {
 
-    Env_Map(HDR_Image&& img) : image(std::move(img)), sampler(image) {
+    Env_Map(HDR_Image&& img) : Env_Map(Tiled_Image(img)) {
+    }
+    Env_Map(Tiled_Image&& img)
+        : image(std::move(img)), sampler(image.level_copy(image.level_below(max_sample_w))) {
     }
 
     Light_Sample sample() const;
-    Spectrum sample_direction(Vec3 dir) const;
+    /// footprint is the angular width (in radians) of the cone of directions to filter over
+    Spectrum sample_direction(Vec3 dir, float footprint = 0.0f) const;
+
+    // Importance sampling runs on a mip level no wider than this. Directions are still
+    // uniform within the sampled texel, so the pdf stays exact.
+    static const inline size_t max_sample_w = 2048;
+
+    /// Constant-time alternative to sampler, with the same interface and exact pdf. Its
+    /// tables are built on first use, so maps that never call it don't pay for them.
+    const Samplers::Sphere::Alias_Image& alias_sampler() const {
+        std::call_once(alias_built, [this]() {
+            alias = std::make_unique<Samplers::Sphere::Alias_Image>(
+                image.level_copy(image.level_below(max_sample_w)));
+        });
+        return *alias;
+    }
 
-    HDR_Image image;
+    Tiled_Image image;
     Samplers::Sphere::Image sampler;
+
+private:
+    mutable std::once_flag alias_built;
+    mutable std::unique_ptr<Samplers::Sphere::Alias_Image> alias;
 };
 
 class Env_Light {
 public:
+    using Env_Map_Ref = std::shared_ptr<const Env_Map>;
+
     Env_Light(Env_Hemisphere&& l) : underlying(std::move(l)) {
     }
     Env_Light(Env_Sphere&& l) : underlying(std::move(l)) {
     }
-    Env_Light(Env_Map&& l) : underlying(std::move(l)) {
+    Env_Light(Env_Map_Ref l) : underlying(std::move(l)) {
     }
 
     Env_Light(const Env_Light& src) = delete;
@@ -65,15 +94,15 @@ public:
     Light_Sample sample(Vec3) const {
         return std::visit(overloaded{[](const Env_Hemisphere& h) { return h.sample(); },
                                      [](const Env_Sphere& h) { return h.sample(); },
-                                     [](const Env_Map& h) { return h.sample(); }},
+                                     [](const Env_Map_Ref& h) { return h->sample(); }},
                           underlying);
     }
 
-    Spectrum sample_direction(Vec3 dir) const {
+    Spectrum sample_direction(Vec3 dir, float footprint = 0.0f) const {
         return std::visit(
-            overloaded{[&dir](const Env_Hemisphere& h) { return h.sample_direction(dir); },
-                       [&dir](const Env_Sphere& h) { return h.sample_direction(dir); },
-                       [&dir](const Env_Map& h) { return h.sample_direction(dir); }},
+            overloaded{[&](const Env_Hemisphere& h) { return h.sample_direction(dir); },
+                       [&](const Env_Sphere& h) { return h.sample_direction(dir); },
+                       [&](const Env_Map_Ref& h) { return h->sample_direction(dir, footprint); }},
             underlying);
     }
 
@@ -82,7 +111,7 @@ public:
     }
 
 private:
-    std::variant<Env_Hemisphere, Env_Sphere, Env_Map> underlying;
+    std::variant<Env_Hemisphere, Env_Sphere, Env_Map_Ref> underlying;
 };
 
 } // namespace PT
\ No newline at end of file
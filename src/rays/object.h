@@ -72,6 +72,12 @@ public:
         itrans = T.inverse();
         has_trans = trans != Mat4::I;
     }
+    bool refit(const GL::Mesh& mesh) {
+        if(Tri_Mesh* tri_mesh = std::get_if<Tri_Mesh>(&underlying)) {
+            return tri_mesh->refit(mesh);
+        }
+        return false;
+    }
 
 private:
     bool has_trans;
@@ -9,7 +9,8 @@
 namespace PT {
 
 Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
-    : thread_pool(std::thread::hardware_concurrency()), gui(gui), camera(screen_dim) {
+    : gui(gui), thread_pool(Thread_Pool::shared()),
+      render_tasks(thread_pool, Priority::render, render_token), camera(screen_dim) {
     accumulator_samples = 0;
     total_epochs = 0;
     completed_epochs = 0;
@@ -20,7 +21,6 @@ Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
 
 Pathtracer::~Pathtracer() {
     cancel();
-    thread_pool.stop();
 }
 
 void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
@@ -39,8 +39,8 @@ void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
                 lights.push_back(Light(Directional_Light(r), light.id(), light.pose.transform()));
             } break;
             case Light_Type::sphere: {
-                if(light.opt.has_emissive_map) {
-                    env_light = Env_Light(Env_Map(light.emissive_copy()));
+                if(light.opt.has_emissive_map && light.emissive_map()) {
+                    env_light = Env_Light(light.emissive_map());
                 } else {
                     env_light = Env_Light(Env_Sphere(r));
                 }
@@ -96,6 +96,7 @@ void Pathtracer::build_scene(Scene& layout_scene) {
     // default constructor for Object so whatever
     std::mutex obj_mut;
     std::vector<Object> obj_list;
+    Task_Group tasks(thread_pool);
     materials.clear();
     mat_cache.clear();
 
@@ -104,35 +105,16 @@ void Pathtracer::build_scene(Scene& layout_scene) {
 
             Scene_Object& obj = item.get<Scene_Object>();
             unsigned int idx = (unsigned int)materials.size();
-            const Material::Options& opt = obj.material.opt;
+            if(!build_material(obj.material)) return;
 
-            switch(opt.type) {
-            case Material_Type::lambertian: {
-                materials.push_back(BSDF(BSDF_Lambertian(opt.albedo)));
-            } break;
-            case Material_Type::mirror: {
-                materials.push_back(BSDF(BSDF_Mirror(opt.reflectance)));
-            } break;
-            case Material_Type::refract: {
-                materials.push_back(BSDF(BSDF_Refract(opt.transmittance, opt.ior)));
-            } break;
-            case Material_Type::glass: {
-                materials.push_back(BSDF(BSDF_Glass(opt.transmittance, opt.reflectance, opt.ior)));
-            } break;
-            case Material_Type::diffuse_light: {
-                materials.push_back(BSDF(BSDF_Diffuse(obj.material.emissive())));
-            } break;
-            default: return;
-            }
-
-            thread_pool.enqueue([&, idx]() {
+            tasks.run([&, idx]() {
                 if(obj.is_shape()) {
                     Shape shape(obj.opt.shape);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         Object(std::move(shape), obj.id(), idx, obj.pose.transform()));
                 } else {
-                    Tri_Mesh mesh(obj.posed_mesh());
+                    Tri_Mesh mesh(obj.posed_mesh(), mesh_builder, compress_meshes);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         Object(std::move(mesh), obj.id(), idx, obj.pose.transform()));
@@ -145,8 +127,8 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             unsigned int idx = (unsigned int)materials.size();
             materials.push_back(BSDF(BSDF_Diffuse(particles.opt.color)));
 
-            thread_pool.enqueue([&, idx]() {
-                Tri_Mesh mesh(particles.mesh());
+            tasks.run([&, idx]() {
+                Tri_Mesh mesh(particles.mesh(), mesh_builder, compress_meshes);
 
                 const auto& parts = particles.get_particles();
                 for(const Particle& p : parts) {
@@ -160,10 +142,100 @@ void Pathtracer::build_scene(Scene& layout_scene) {
         }
     });
 
-    thread_pool.wait();
+    tasks.wait();
     build_lights(layout_scene, obj_list);
 
-    scene.build(std::move(obj_list));
+    scene.build(std::move(obj_list), 1, mesh_builder, &thread_pool);
+}
+
+bool Pathtracer::refit_scene(Scene& layout_scene) {
+
+    // Particle systems change their number of instances every step, so they
+    // always need a full build
+    if(layout_scene.has_particles()) return false;
+
+    std::vector<Object>& prims = scene.edit_primitives();
+    std::unordered_map<Scene_ID, Object*> objs;
+    for(Object& obj : prims) {
+        objs[obj.id()] = &obj;
+    }
+    if(objs.empty() || objs.size() != prims.size()) return false;
+
+    materials.clear();
+    mat_cache.clear();
+
+    // Materials are rebuilt in the same order as in build_scene, so each
+    // object keeps its material index as long as the scene has the same items
+    std::atomic<bool> ok(true);
+    size_t n_objs = 0;
+    Task_Group tasks(thread_pool);
+
+    layout_scene.for_items([&, this](Scene_Item& item) {
+        if(!item.is<Scene_Object>()) return;
+
+        Scene_Object& obj = item.get<Scene_Object>();
+        unsigned int idx = (unsigned int)materials.size();
+        if(!build_material(obj.material)) return;
+
+        auto entry = objs.find(obj.id());
+        if(entry == objs.end()) {
+            ok = false;
+            return;
+        }
+        Object* pt_obj = entry->second;
+        n_objs++;
+
+        tasks.run([&, pt_obj, idx]() {
+            if(obj.is_shape()) {
+                *pt_obj = Object(Shape(obj.opt.shape), obj.id(), idx, obj.pose.transform());
+            } else {
+                pt_obj->set_trans(obj.pose.transform());
+                if(!pt_obj->refit(obj.posed_mesh())) ok = false;
+            }
+        });
+    });
+
+    tasks.wait();
+
+    // Area light quads are tiny, so just replace them
+    std::vector<Object> light_objs;
+    build_lights(layout_scene, light_objs);
+    for(Object& light : light_objs) {
+        auto entry = objs.find(light.id());
+        if(entry == objs.end()) return false;
+        *entry->second = std::move(light);
+        n_objs++;
+    }
+
+    if(!ok || n_objs != objs.size()) return false;
+
+    scene.refit(&thread_pool);
+    return !scene.needs_rebuild();
+}
+
+bool Pathtracer::build_material(const Material& material) {
+
+    const Material::Options& opt = material.opt;
+
+    switch(opt.type) {
+    case Material_Type::lambertian: {
+        materials.push_back(BSDF(BSDF_Lambertian(opt.albedo)));
+    } break;
+    case Material_Type::mirror: {
+        materials.push_back(BSDF(BSDF_Mirror(opt.reflectance)));
+    } break;
+    case Material_Type::refract: {
+        materials.push_back(BSDF(BSDF_Refract(opt.transmittance, opt.ior)));
+    } break;
+    case Material_Type::glass: {
+        materials.push_back(BSDF(BSDF_Glass(opt.transmittance, opt.reflectance, opt.ior)));
+    } break;
+    case Material_Type::diffuse_light: {
+        materials.push_back(BSDF(BSDF_Diffuse(material.emissive())));
+    } break;
+    default: return false;
+    }
+    return true;
 }
 
 void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_samples, size_t depth) {
@@ -173,22 +245,41 @@ void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_sampl
     n_area_samples = area_samples;
     max_depth = depth;
     accumulator.resize(out_w, out_h);
+    accumulator_m2.assign(out_w * out_h, Spectrum());
+    accumulator_counts.assign(out_w * out_h, 0.0f);
+    first_hits.clear();
+}
+
+void Pathtracer::set_builder(BVH_Builder builder) {
+    mesh_builder = builder;
+}
+
+void Pathtracer::set_compressed(bool compress) {
+    compress_meshes = compress;
+}
+
+void Pathtracer::set_layers(bool layers) {
+    output_layers = layers;
 }
 
 void Pathtracer::log_ray(const Ray& ray, float t, Spectrum color) {
     gui.log_ray(ray, t, color);
 }
 
-void Pathtracer::accumulate(const HDR_Image& sample) {
+void Pathtracer::accumulate(const HDR_Image& sample, const std::vector<float>& counts) {
 
     std::lock_guard<std::mutex> lock(accumulator_mut);
 
+    // Running mean and sum of squared differences (Welford) of the per-epoch estimates
     accumulator_samples++;
     for(size_t j = 0; j < out_h; j++) {
         for(size_t i = 0; i < out_w; i++) {
             Spectrum& s = accumulator.at(i, j);
             const Spectrum& n = sample.at(i, j);
-            s += (n - s) * (1.0f / accumulator_samples);
+            Spectrum delta = n - s;
+            s += delta * (1.0f / accumulator_samples);
+            accumulator_m2[j * out_w + i] += delta * (n - s);
+            accumulator_counts[j * out_w + i] += counts[j * out_w + i];
         }
     }
 }
@@ -196,6 +287,7 @@ void Pathtracer::accumulate(const HDR_Image& sample) {
 void Pathtracer::do_trace(size_t samples) {
 
     HDR_Image sample(out_w, out_h);
+    std::vector<float> counts(out_w * out_h);
     for(size_t j = 0; j < out_h; j++) {
         for(size_t i = 0; i < out_w; i++) {
 
@@ -208,12 +300,42 @@ void Pathtracer::do_trace(size_t samples) {
                     sampled++;
                 }
 
-                if(cancel_flag) return;
+                if(render_token.cancelled()) return;
             }
             sample.at(i, j) *= (1.0f / sampled);
+            counts[j * out_w + i] = (float)sampled;
+        }
+        // Let any interactive work queued meanwhile run before the next row
+        thread_pool.yield();
+    }
+    accumulate(sample, counts);
+}
+
+void Pathtracer::trace_first_hits() {
+
+    std::vector<First_Hit> hits(out_w * out_h);
+    Vec2 wh((float)out_w, (float)out_h);
+
+    for(size_t j = 0; j < out_h; j++) {
+        for(size_t i = 0; i < out_w; i++) {
+
+            Ray ray = camera.generate_ray(Vec2(i + 0.5f, j + 0.5f) / wh);
+            Trace hit = scene.hit(ray);
+            if(render_token.cancelled()) return;
+
+            First_Hit& out = hits[j * out_w + i];
+            if(!hit.hit) {
+                out.depth = std::numeric_limits<float>::infinity();
+                continue;
+            }
+            out.albedo = materials[hit.material].albedo();
+            out.normal = dot(hit.normal, ray.dir) > 0.0f ? -hit.normal : hit.normal;
+            out.depth = hit.distance;
         }
     }
-    accumulate(sample);
+
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    first_hits = std::move(hits);
 }
 
 bool Pathtracer::in_progress() const {
@@ -233,9 +355,10 @@ size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t dep
     return scene.visualize(lines, active, depth, Mat4::I);
 }
 
-void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples) {
+void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples,
+                              bool refit) {
 
-    size_t n_threads = std::thread::hardware_concurrency();
+    size_t n_threads = thread_pool.size();
     size_t samples_per_epoch = std::max(size_t(1), n_samples / (n_threads * 10));
 
     cancel();
@@ -244,33 +367,52 @@ void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_s
     if(!add_samples) {
         accumulator.clear({});
         accumulator_samples = 0;
+        std::fill(accumulator_m2.begin(), accumulator_m2.end(), Spectrum());
+        std::fill(accumulator_counts.begin(), accumulator_counts.end(), 0.0f);
+        first_hits.clear();
         build_time = SDL_GetPerformanceCounter();
-        build_scene(layout_scene);
+        if(!refit || !refit_scene(layout_scene)) {
+            build_scene(layout_scene);
+        }
         build_time = SDL_GetPerformanceCounter() - build_time;
     }
     render_time = SDL_GetPerformanceCounter();
     
     camera = cam;
 
+    auto finish = [this]() {
+        size_t completed = completed_epochs.fetch_add(1);
+        if(completed + 1 == total_epochs) {
+            Uint64 done = SDL_GetPerformanceCounter();
+            render_time = done - render_time;
+        }
+    };
+
+    // Finding first hits takes one ray per pixel, so it just counts as another epoch
+    if(!add_samples && output_layers) {
+        total_epochs++;
+        render_tasks.run([finish, this]() {
+            trace_first_hits();
+            finish();
+        });
+    }
+
     for(size_t s = 0; s < n_samples; s += samples_per_epoch) {
         size_t samples = (s + samples_per_epoch) > n_samples ? n_samples - s : samples_per_epoch;
-        thread_pool.enqueue([samples, this]() {
+        render_tasks.run([samples, finish, this]() {
             do_trace(samples);
-            size_t completed = completed_epochs.fetch_add(1);
-            if(completed + 1 == total_epochs) {
-                Uint64 done = SDL_GetPerformanceCounter();
-                render_time = done - render_time;
-            }
+            finish();
         });
     }
 }
 
 void Pathtracer::cancel() {
-    cancel_flag = true;
-    thread_pool.clear();
+    // Epochs that have not started are dropped, and running ones stop at the next sample.
+    // This runs on the GUI thread, so it must not help with other queued work meanwhile.
+    render_tasks.cancel_and_wait();
+    render_token.reset();
     completed_epochs = 0;
     total_epochs = 0;
-    cancel_flag = false;
     build_time = 0;
     render_time = SDL_GetPerformanceCounter() - render_time;
 }
@@ -279,6 +421,48 @@ const HDR_Image& Pathtracer::get_output() {
     return accumulator;
 }
 
+std::vector<EXR_Layer> Pathtracer::get_layers() {
+
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+
+    const HDR_Image& image = accumulator;
+    size_t n = out_w * out_h;
+    std::vector<EXR_Layer> layers;
+
+    auto add = [&](std::string name, std::vector<std::string> channels, auto&& value) {
+        EXR_Layer& layer = layers.emplace_back();
+        layer.name = name;
+        layer.channels = channels;
+        layer.data.reserve(n * channels.size());
+        for(size_t i = 0; i < n; i++) value(i, layer.data);
+    };
+    auto rgb = [](Spectrum s, std::vector<float>& out) {
+        out.insert(out.end(), {s.r, s.g, s.b});
+    };
+
+    add("", {"R", "G", "B"}, [&](size_t i, auto& out) { rgb(image.at(i), out); });
+    if(!output_layers) return layers;
+
+    // Variance of the mean, estimated from the spread of the per-epoch estimates
+    float k = (float)accumulator_samples;
+    float var_scale = k > 1.0f ? 1.0f / (k * (k - 1.0f)) : 0.0f;
+
+    add("samples", {"Y"}, [&](size_t i, auto& out) { out.push_back(accumulator_counts[i]); });
+    add("variance", {"R", "G", "B"},
+        [&](size_t i, auto& out) { rgb(accumulator_m2[i] * var_scale, out); });
+
+    if(first_hits.size() == n) {
+        add("albedo", {"R", "G", "B"},
+            [&](size_t i, auto& out) { rgb(first_hits[i].albedo, out); });
+        add("normal", {"X", "Y", "Z"}, [&](size_t i, auto& out) {
+            Vec3 v = first_hits[i].normal;
+            out.insert(out.end(), {v.x, v.y, v.z});
+        });
+        add("depth", {"Z"}, [&](size_t i, auto& out) { out.push_back(first_hits[i].depth); });
+    }
+    return layers;
+}
+
 const GL::Tex2D& Pathtracer::get_output_texture(float exposure) {
     std::lock_guard<std::mutex> lock(accumulator_mut);
     return accumulator.get_texture(exposure);
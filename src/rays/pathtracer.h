@@ -7,6 +7,7 @@
 
 #include "../lib/mathlib.h"
 #include "../scene/scene.h"
+#include "../util/exr_writer.h"
 #include "../util/hdr_image.h"
 #include "../util/thread_pool.h"
 
@@ -27,12 +28,19 @@ public:
     ~Pathtracer();
 
     void set_sizes(size_t w, size_t h, size_t pixel_samples, size_t area_samples, size_t depth);
+    void set_builder(BVH_Builder builder);
+    void set_compressed(bool compress);
+    void set_layers(bool layers);
 
     const HDR_Image& get_output();
+    /// Copy of the output as EXR layers: the image itself, plus the sample count, variance,
+    /// albedo, normal, and depth layers if enabled
+    std::vector<EXR_Layer> get_layers();
     const GL::Tex2D& get_output_texture(float exposure);
     size_t visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t level);
 
-    void begin_render(Scene& scene, const Camera& camera, bool add_samples = false);
+    void begin_render(Scene& scene, const Camera& camera, bool add_samples = false,
+                      bool refit = false);
     void cancel();
     bool in_progress() const;
     float progress() const;
@@ -41,17 +49,24 @@ public:
 private:
     // Internal
     void build_scene(Scene& scene);
+    bool refit_scene(Scene& scene);
+    bool build_material(const Material& material);
     void build_lights(Scene& scene, std::vector<Object>& objs);
     void do_trace(size_t samples);
-    void accumulate(const HDR_Image& sample);
+    void trace_first_hits();
+    void accumulate(const HDR_Image& sample, const std::vector<float>& counts);
     bool tonemap();
 
     Gui::Widget_Render& gui;
     unsigned long long render_time, build_time;
-    Thread_Pool thread_pool;
-    bool cancel_flag = false;
+    Thread_Pool& thread_pool;
+    // Epochs run at render priority so that interactive work gets ahead of them
+    Cancel_Token render_token;
+    Task_Group render_tasks;
 
     HDR_Image accumulator;
+    std::vector<Spectrum> accumulator_m2;
+    std::vector<float> accumulator_counts;
     std::mutex accumulator_mut;
     size_t total_epochs, accumulator_samples;
     std::atomic<size_t> completed_epochs;
@@ -69,6 +84,17 @@ private:
 
     Camera camera;
     size_t out_w, out_h, n_samples, n_area_samples, max_depth;
+    BVH_Builder mesh_builder = BVH_Builder::sah;
+    bool compress_meshes = false;
+
+    // What the camera sees through each pixel center, for the extra output layers
+    struct First_Hit {
+        Spectrum albedo;
+        Vec3 normal;
+        float depth = 0.0f;
+    };
+    bool output_layers = false;
+    std::vector<First_Hit> first_hits;
 };
 
 } // namespace PT
@@ -0,0 +1,105 @@
+
+#include "samplers.h"
+#include "../util/rand.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Samplers {
+
+Sphere::Alias_Image::Alias_Image(const HDR_Image& image) {
+
+    const auto [_w, _h] = image.dimension();
+    w = _w;
+    h = _h;
+    if(!w || !h) return;
+
+    // Row y spans theta from pi * (1 - y / h) down to pi * (1 - (y + 1) / h)
+    row_z.resize(h + 1);
+    for(size_t y = 0; y <= h; y++) {
+        row_z[y] = -std::cos(PI_F * y / h);
+    }
+
+    // Weight texels by luminance times solid angle, so that rows near the poles aren't
+    // oversampled. An all black image is sampled uniformly.
+    std::vector<float> weights(w * h), row_weights(h);
+    double total = 0.0;
+    for(int pass = 0; pass < 2 && total <= 0.0; pass++) {
+        total = 0.0;
+        for(size_t y = 0; y < h; y++) {
+            float solid_angle = 2.0f * PI_F / w * (row_z[y + 1] - row_z[y]);
+            double sum = 0.0;
+            for(size_t x = 0; x < w; x++) {
+                float lum = pass ? 1.0f : image.at(x, y).luma();
+                weights[y * w + x] = lum * solid_angle;
+                sum += weights[y * w + x];
+            }
+            row_weights[y] = (float)sum;
+            total += sum;
+        }
+    }
+
+    rows.resize(h);
+    cols.resize(w * h);
+    pdf.resize(w * h);
+    build_alias(row_weights.data(), h, rows.data());
+    for(size_t y = 0; y < h; y++) {
+        build_alias(&weights[y * w], w, &cols[y * w]);
+        float solid_angle = 2.0f * PI_F / w * (row_z[y + 1] - row_z[y]);
+        for(size_t x = 0; x < w; x++) {
+            pdf[y * w + x] = (float)(weights[y * w + x] / total) / solid_angle;
+        }
+    }
+}
+
+void Sphere::Alias_Image::build_alias(const float* weights, size_t n, Alias* out) {
+
+    double sum = 0.0;
+    for(size_t i = 0; i < n; i++) {
+        sum += weights[i];
+    }
+
+    // Vose's method: pair each under-full entry with an over-full one
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for(size_t i = 0; i < n; i++) {
+        scaled[i] = sum > 0.0 ? weights[i] * n / sum : 1.0;
+        (scaled[i] < 1.0 ? small : large).push_back((uint32_t)i);
+    }
+
+    while(!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        out[s] = {(float)scaled[s], l};
+        scaled[l] -= 1.0 - scaled[s];
+        if(scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Whatever is left is full up to rounding error
+    for(uint32_t i : small) out[i] = {1.0f, i};
+    for(uint32_t i : large) out[i] = {1.0f, i};
+}
+
+Vec3 Sphere::Alias_Image::sample(float& out_pdf) const {
+
+    auto pick = [](const Alias* table, size_t n) {
+        float u = RNG::unit() * n;
+        size_t i = std::min((size_t)u, n - 1);
+        return u - i < table[i].prob ? i : (size_t)table[i].alias;
+    };
+
+    size_t y = pick(rows.data(), h);
+    size_t x = pick(&cols[y * w], w);
+    out_pdf = pdf[y * w + x];
+
+    // Uniform in solid angle within the texel: z = cos(theta) is uniform across the row
+    float z = row_z[y] + (row_z[y + 1] - row_z[y]) * RNG::unit();
+    float phi = 2.0f * PI_F * ((x + RNG::unit()) / w) - PI_F;
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    return Vec3(r * std::cos(phi), z, r * std::sin(phi));
+}
+
+} // namespace Samplers
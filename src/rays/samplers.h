@@ -70,5 +70,27 @@ struct Image {
     float total = 0.0f;
 };
 
+/// Importance samples a lat-long image in constant time: a row is picked from a marginal
+/// alias table, then a texel from that row's conditional table, then a direction uniformly
+/// in the texel's solid angle. Same interface as Image.
+struct Alias_Image {
+    Alias_Image(const HDR_Image& image);
+    Vec3 sample(float& pdf) const;
+
+    /// Walker's alias method: entry i is taken with probability prob, otherwise alias is
+    struct Alias {
+        float prob = 1.0f;
+        uint32_t alias = 0;
+    };
+    static void build_alias(const float* weights, size_t n, Alias* out);
+
+    size_t w = 0, h = 0;
+    std::vector<Alias> rows, cols;
+    /// Density per solid angle of the directions sampled within each texel
+    std::vector<float> pdf;
+    /// cos(theta) of the lower edge of each row, and of the top of the image
+    std::vector<float> row_z;
+};
+
 } // namespace Sphere
 } // namespace Samplers
@@ -0,0 +1,149 @@
+
+#include "shapes.h"
+
+namespace PT {
+
+Shape::Shape(Shape_Type type) {
+    switch(type) {
+    case Shape_Type::box: underlying = Box(); break;
+    case Shape_Type::cylinder: underlying = Cylinder(); break;
+    case Shape_Type::disk: underlying = Disk(); break;
+    case Shape_Type::plane: underlying = Plane(); break;
+    default: underlying = Sphere(); break;
+    }
+}
+
+namespace {
+
+// Shared by the shapes below, which may hit in several places: keeps the nearest
+// hit within the ray's bounds
+struct Nearest {
+    const Ray& ray;
+    Trace ret;
+
+    explicit Nearest(const Ray& ray) : ray(ray) {
+        ret.origin = ray.point;
+    }
+
+    void consider(float t, Vec3 normal) {
+        if(!(t >= ray.dist_bounds.x && t <= ray.dist_bounds.y)) return;
+        if(ret.hit && t >= ret.distance) return;
+        ret.hit = true;
+        ret.distance = t;
+        ret.position = ray.at(t);
+        ret.normal = normal;
+    }
+};
+
+} // namespace
+
+BBox Box::bbox() const {
+    return BBox(-half_size, half_size);
+}
+
+Trace Box::hit(const Ray& ray) const {
+
+    // Slab test: the ray is inside the box between its last entry and first exit
+    float t_in = -FLT_MAX, t_out = FLT_MAX;
+    int a_in = 0, a_out = 0;
+    for(int a = 0; a < 3; a++) {
+        float inv = 1.0f / ray.dir[a];
+        float t0 = (-half_size[a] - ray.point[a]) * inv;
+        float t1 = (half_size[a] - ray.point[a]) * inv;
+        if(t0 > t1) std::swap(t0, t1);
+        if(t0 > t_in) {
+            t_in = t0;
+            a_in = a;
+        }
+        if(t1 < t_out) {
+            t_out = t1;
+            a_out = a;
+        }
+    }
+
+    Nearest nearest(ray);
+    if(t_in > t_out) return nearest.ret;
+
+    auto face = [&](float t, int a) {
+        Vec3 n;
+        n[a] = ray.at(t)[a] < 0.0f ? -1.0f : 1.0f;
+        return n;
+    };
+    nearest.consider(t_in, face(t_in, a_in));
+    nearest.consider(t_out, face(t_out, a_out));
+    return nearest.ret;
+}
+
+BBox Cylinder::bbox() const {
+    return BBox(Vec3{-radius, 0.0f, -radius}, Vec3{radius, height, radius});
+}
+
+Trace Cylinder::hit(const Ray& ray) const {
+
+    Nearest nearest(ray);
+    Vec3 o = ray.point, d = ray.dir;
+
+    // Side: x^2 + z^2 = r^2 for 0 <= y <= height
+    float a = d.x * d.x + d.z * d.z;
+    float b = 2.0f * (o.x * d.x + o.z * d.z);
+    float c = o.x * o.x + o.z * o.z - radius * radius;
+    float disc = b * b - 4.0f * a * c;
+    if(a > 0.0f && disc >= 0.0f) {
+        float root = std::sqrt(disc);
+        for(float t : {(-b - root) / (2.0f * a), (-b + root) / (2.0f * a)}) {
+            Vec3 p = ray.at(t);
+            if(p.y >= 0.0f && p.y <= height) {
+                nearest.consider(t, Vec3{p.x, 0.0f, p.z}.unit());
+            }
+        }
+    }
+
+    // Caps
+    if(d.y != 0.0f) {
+        for(float y : {0.0f, height}) {
+            float t = (y - o.y) / d.y;
+            Vec3 p = ray.at(t);
+            if(p.x * p.x + p.z * p.z <= radius * radius) {
+                nearest.consider(t, Vec3{0.0f, y > 0.0f ? 1.0f : -1.0f, 0.0f});
+            }
+        }
+    }
+    return nearest.ret;
+}
+
+BBox Disk::bbox() const {
+    return BBox(Vec3{-radius, 0.0f, -radius}, Vec3{radius, 0.0f, radius});
+}
+
+Trace Disk::hit(const Ray& ray) const {
+
+    Nearest nearest(ray);
+    if(ray.dir.y == 0.0f) return nearest.ret;
+
+    float t = -ray.point.y / ray.dir.y;
+    Vec3 p = ray.at(t);
+    if(p.x * p.x + p.z * p.z <= radius * radius) {
+        nearest.consider(t, Vec3{0.0f, 1.0f, 0.0f});
+    }
+    return nearest.ret;
+}
+
+BBox Plane::bbox() const {
+    Vec2 s = infinite ? Vec2{infinite_size} : half_size;
+    return BBox(Vec3{-s.x, 0.0f, -s.y}, Vec3{s.x, 0.0f, s.y});
+}
+
+Trace Plane::hit(const Ray& ray) const {
+
+    Nearest nearest(ray);
+    if(ray.dir.y == 0.0f) return nearest.ret;
+
+    float t = -ray.point.y / ray.dir.y;
+    Vec3 p = ray.at(t);
+    if(infinite || (std::abs(p.x) <= half_size.x && std::abs(p.z) <= half_size.y)) {
+        nearest.consider(t, Vec3{0.0f, 1.0f, 0.0f});
+    }
+    return nearest.ret;
+}
+
+} // namespace PT
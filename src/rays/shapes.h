@@ -7,7 +7,7 @@
 
 namespace PT {
 
-enum class Shape_Type : int { none, sphere, count };
+enum class Shape_Type : int { none, sphere, box, cylinder, disk, plane, count };
 extern const char* Shape_Type_Names[(int)Shape_Type::count];
 
 class Sphere {
@@ -26,11 +26,93 @@ public:
     }
 };
 
+/// Axis-aligned box centered at the origin
+class Box {
+public:
+    Box() = default;
+    Box(Vec3 half_size) : half_size(half_size) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+
+    Vec3 half_size = Vec3{1.0f};
+
+    bool operator!=(const Box& b) const {
+        return half_size != b.half_size;
+    }
+};
+
+/// Capped cylinder around the y axis, from y = 0 to y = height
+class Cylinder {
+public:
+    Cylinder() = default;
+    Cylinder(float radius, float height) : radius(radius), height(height) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+
+    float radius = 0.5f, height = 2.0f;
+
+    bool operator!=(const Cylinder& c) const {
+        return radius != c.radius || height != c.height;
+    }
+};
+
+/// Disk in the xz plane centered at the origin, facing +y
+class Disk {
+public:
+    Disk() = default;
+    Disk(float radius) : radius(radius) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+
+    float radius = 1.0f;
+
+    bool operator!=(const Disk& d) const {
+        return radius != d.radius;
+    }
+};
+
+/// Rectangle in the xz plane centered at the origin, facing +y. Infinite planes are
+/// bounded by infinite_size, which keeps their boxes usable in a BVH.
+class Plane {
+public:
+    static constexpr float infinite_size = 1e5f;
+
+    Plane() = default;
+    Plane(Vec2 half_size, bool infinite = false) : half_size(half_size), infinite(infinite) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+
+    Vec2 half_size = Vec2{1.0f};
+    bool infinite = false;
+
+    bool operator!=(const Plane& p) const {
+        return half_size != p.half_size || infinite != p.infinite;
+    }
+};
+
 class Shape {
 public:
     Shape() = default;
+    /// Default shape of the given type
+    explicit Shape(Shape_Type type);
     Shape(Sphere&& sphere) : underlying(std::move(sphere)) {
     }
+    Shape(Box&& box) : underlying(std::move(box)) {
+    }
+    Shape(Cylinder&& cylinder) : underlying(std::move(cylinder)) {
+    }
+    Shape(Disk&& disk) : underlying(std::move(disk)) {
+    }
+    Shape(Plane&& plane) : underlying(std::move(plane)) {
+    }
 
     Shape(const Shape& src) = default;
     Shape& operator=(const Shape& src) = default;
@@ -58,7 +140,7 @@ public:
     }
 
 private:
-    std::variant<Sphere> underlying;
+    std::variant<Sphere, Box, Cylinder, Disk, Plane> underlying;
 };
 
 } // namespace PT
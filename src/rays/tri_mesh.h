@@ -6,6 +6,7 @@
 
 #include "bvh.h"
 #include "trace.h"
+#include "tri_pack.h"
 
 namespace PT {
 
@@ -14,10 +15,19 @@ struct Tri_Mesh_Vert {
     Vec3 normal;
 };
 
+/// Vertex of a compressed Tri_Mesh. The position is quantized to 21 bits per axis within
+/// the mesh bounds and the normal is octahedral-encoded to 16 bits per component.
+struct Tri_Mesh_Packed_Vert {
+    uint32_t position[2];
+    uint32_t normal;
+};
+
 class Triangle {
 public:
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    /// Bounds of the part of the triangle inside box
+    BBox clip(const BBox& box) const;
 
     size_t visualize(GL::Lines&, GL::Lines&, size_t, const Mat4&) const {
         return size_t(0);
@@ -27,14 +37,19 @@ private:
     Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2);
 
     unsigned int v0, v1, v2;
+    /// Shaded with its geometric normal rather than interpolated vertex normals
+    bool flat = false;
     Tri_Mesh_Vert* vertex_list;
     friend class Tri_Mesh;
+    friend class Tri_Pack;
+    friend class BVH_Cache;
 };
 
 class Tri_Mesh {
 public:
     Tri_Mesh() = default;
-    Tri_Mesh(const GL::Mesh& mesh);
+    Tri_Mesh(const GL::Mesh& mesh, BVH_Builder builder = BVH_Builder::sah,
+             bool compress = false);
 
     Tri_Mesh(Tri_Mesh&& src) = default;
     Tri_Mesh& operator=(Tri_Mesh&& src) = default;
@@ -48,11 +63,42 @@ public:
 
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
 
-    void build(const GL::Mesh& mesh);
+    /// If compress is set, vertices are stored quantized and decoded when a leaf is hit,
+    /// and no packed copy of the triangles is kept. Takes about half the memory.
+    void build(const GL::Mesh& mesh, BVH_Builder builder = BVH_Builder::sah,
+               bool compress = false);
+    /// Update vertex data in place and refit the BVH, rebuilding it if its quality has degraded.
+    /// Returns false (and does nothing) if the mesh topology differs from the one built.
+    bool refit(const GL::Mesh& mesh);
+
+    const BVH<Triangle>& bvh() const;
+    bool compressed() const;
+    /// Bytes used by vertices, the BVH and the packed triangles
+    size_t bytes() const;
 
 private:
+    /// Flat-shaded meshes come with three vertices of their own per triangle. Those
+    /// triangles are marked flat instead, and their vertices welded back together.
+    static void weld(const GL::Mesh& mesh, std::vector<Tri_Mesh_Vert>& verts,
+                     std::vector<Triangle>& tris);
+    static size_t topology_of(const std::vector<Triangle>& tris);
+    friend class BVH_Cache;
+
+    Vec3 position(unsigned int v) const;
+    void compress(const std::vector<Tri_Mesh_Vert>& mesh_verts);
+    bool hit_compressed(const Ray& ray, size_t start, size_t size, Tri_Pack::Hit& closest) const;
+    Vec3 decode_position(const Tri_Mesh_Packed_Vert& v) const;
+    static uint32_t encode_normal(Vec3 n);
+    static Vec3 decode_normal(uint32_t n);
+
     std::vector<Tri_Mesh_Vert> verts;
+    std::vector<Tri_Mesh_Packed_Vert> packed_verts;
+    Vec3 quant_min, quant_step;
+
     BVH<Triangle> triangles;
+    Tri_Pack packed;
+    BVH_Builder builder = BVH_Builder::sah;
+    size_t topology = 0;
 };
 
 } // namespace PT
@@ -0,0 +1,283 @@
+
+#include "tri_pack.h"
+#include "tri_mesh.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRI_PACK_SIMD
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRI_PACK_SIMD
+#endif
+
+namespace PT {
+
+#ifdef TRI_PACK_SIMD
+
+namespace {
+
+// Minimal SIMD layer over Tri_Pack::width lanes
+
+#if defined(__AVX__)
+
+using Lanes = __m256;
+inline Lanes load(const float* p) {
+    return _mm256_load_ps(p);
+}
+inline Lanes splat(float f) {
+    return _mm256_set1_ps(f);
+}
+inline Lanes add(Lanes a, Lanes b) {
+    return _mm256_add_ps(a, b);
+}
+inline Lanes sub(Lanes a, Lanes b) {
+    return _mm256_sub_ps(a, b);
+}
+inline Lanes mul(Lanes a, Lanes b) {
+    return _mm256_mul_ps(a, b);
+}
+inline Lanes div(Lanes a, Lanes b) {
+    return _mm256_div_ps(a, b);
+}
+inline Lanes ge(Lanes a, Lanes b) {
+    return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+inline Lanes le(Lanes a, Lanes b) {
+    return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+inline Lanes neq(Lanes a, Lanes b) {
+    return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ);
+}
+inline Lanes both(Lanes a, Lanes b) {
+    return _mm256_and_ps(a, b);
+}
+inline int bits(Lanes m) {
+    return _mm256_movemask_ps(m);
+}
+inline void store(float* p, Lanes a) {
+    _mm256_storeu_ps(p, a);
+}
+
+#else
+
+using Lanes = __m128;
+inline Lanes load(const float* p) {
+    return _mm_load_ps(p);
+}
+inline Lanes splat(float f) {
+    return _mm_set1_ps(f);
+}
+inline Lanes add(Lanes a, Lanes b) {
+    return _mm_add_ps(a, b);
+}
+inline Lanes sub(Lanes a, Lanes b) {
+    return _mm_sub_ps(a, b);
+}
+inline Lanes mul(Lanes a, Lanes b) {
+    return _mm_mul_ps(a, b);
+}
+inline Lanes div(Lanes a, Lanes b) {
+    return _mm_div_ps(a, b);
+}
+inline Lanes ge(Lanes a, Lanes b) {
+    return _mm_cmpge_ps(a, b);
+}
+inline Lanes le(Lanes a, Lanes b) {
+    return _mm_cmple_ps(a, b);
+}
+inline Lanes neq(Lanes a, Lanes b) {
+    return _mm_cmpneq_ps(a, b);
+}
+inline Lanes both(Lanes a, Lanes b) {
+    return _mm_and_ps(a, b);
+}
+inline int bits(Lanes m) {
+    return _mm_movemask_ps(m);
+}
+inline void store(float* p, Lanes a) {
+    _mm_storeu_ps(p, a);
+}
+
+#endif
+
+inline Lanes dot(Lanes ax, Lanes ay, Lanes az, Lanes bx, Lanes by, Lanes bz) {
+    return add(add(mul(ax, bx), mul(ay, by)), mul(az, bz));
+}
+
+} // namespace
+
+#endif
+
+void Tri_Pack::build(const BVH<Triangle>& bvh) {
+
+    clear();
+
+    const std::vector<Triangle>& tris = bvh.get_primitives();
+    leaf_block.resize(tris.size());
+
+    bvh.for_each_leaf([&](size_t start, size_t size) {
+        leaf_block[start] = (uint32_t)blocks.size();
+
+        for(size_t i = 0; i < size; i += width) {
+            Block& block = blocks.emplace_back();
+
+            for(size_t lane = 0; lane < width; lane++) {
+
+                // Padding lanes get degenerate triangles, which never hit
+                if(i + lane < size) {
+                    uint32_t idx = (uint32_t)(start + i + lane);
+                    const Triangle& tri = tris[idx];
+                    set_lane(block, lane, tri.vertex_list[tri.v0].position,
+                             tri.vertex_list[tri.v1].position, tri.vertex_list[tri.v2].position,
+                             idx);
+                } else {
+                    set_lane(block, lane, Vec3{}, Vec3{}, Vec3{}, (uint32_t)(start + i));
+                }
+            }
+        }
+    });
+}
+
+void Tri_Pack::set_lane(Block& block, size_t lane, Vec3 v0, Vec3 v1, Vec3 v2, uint32_t idx) {
+    Vec3 e1 = v1 - v0, e2 = v2 - v0;
+    for(int a = 0; a < 3; a++) {
+        block.v0[a][lane] = v0[a];
+        block.e1[a][lane] = e1[a];
+        block.e2[a][lane] = e2[a];
+    }
+    block.tri[lane] = idx;
+}
+
+void Tri_Pack::clear() {
+    blocks.clear();
+    leaf_block.clear();
+}
+
+#ifdef TRI_PACK_SIMD
+
+int Tri_Pack::hit_block(const Block& block, const Ray& ray, float tmax, float* ts, float* us,
+                        float* vs) {
+
+    // Moller-Trumbore, one triangle per lane
+    Lanes dx = splat(ray.dir.x), dy = splat(ray.dir.y), dz = splat(ray.dir.z);
+    Lanes zero = splat(0.0f), one = splat(1.0f);
+
+    Lanes e1x = load(block.e1[0]), e1y = load(block.e1[1]), e1z = load(block.e1[2]);
+    Lanes e2x = load(block.e2[0]), e2y = load(block.e2[1]), e2z = load(block.e2[2]);
+
+    Lanes px = sub(mul(dy, e2z), mul(dz, e2y));
+    Lanes py = sub(mul(dz, e2x), mul(dx, e2z));
+    Lanes pz = sub(mul(dx, e2y), mul(dy, e2x));
+    Lanes det = dot(e1x, e1y, e1z, px, py, pz);
+    Lanes inv = div(one, det);
+
+    Lanes sx = sub(splat(ray.point.x), load(block.v0[0]));
+    Lanes sy = sub(splat(ray.point.y), load(block.v0[1]));
+    Lanes sz = sub(splat(ray.point.z), load(block.v0[2]));
+    Lanes u = mul(dot(sx, sy, sz, px, py, pz), inv);
+
+    Lanes qx = sub(mul(sy, e1z), mul(sz, e1y));
+    Lanes qy = sub(mul(sz, e1x), mul(sx, e1z));
+    Lanes qz = sub(mul(sx, e1y), mul(sy, e1x));
+    Lanes v = mul(dot(dx, dy, dz, qx, qy, qz), inv);
+    Lanes t = mul(dot(e2x, e2y, e2z, qx, qy, qz), inv);
+
+    Lanes mask = both(neq(det, zero), both(ge(u, zero), ge(v, zero)));
+    mask = both(mask, le(add(u, v), one));
+    mask = both(mask, both(ge(t, splat(ray.dist_bounds.x)), le(t, splat(tmax))));
+
+    int hits = bits(mask);
+    if(hits) {
+        store(ts, t);
+        store(us, u);
+        store(vs, v);
+    }
+    return hits;
+}
+
+#else
+
+int Tri_Pack::hit_block(const Block& block, const Ray& ray, float tmax, float* ts, float* us,
+                        float* vs) {
+
+    // Without SIMD, lanes are tested one after another with early outs
+    int hits = 0;
+    for(size_t lane = 0; lane < width; lane++) {
+        Vec3 e1(block.e1[0][lane], block.e1[1][lane], block.e1[2][lane]);
+        Vec3 e2(block.e2[0][lane], block.e2[1][lane], block.e2[2][lane]);
+        Vec3 v0(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+
+        Vec3 p = cross(ray.dir, e2);
+        float det = dot(e1, p);
+        if(det == 0.0f) continue;
+        float inv = 1.0f / det;
+
+        Vec3 s = ray.point - v0;
+        float u = dot(s, p) * inv;
+        if(!(u >= 0.0f && u <= 1.0f)) continue;
+
+        Vec3 q = cross(s, e1);
+        float v = dot(ray.dir, q) * inv;
+        if(!(v >= 0.0f && u + v <= 1.0f)) continue;
+
+        float t = dot(e2, q) * inv;
+        if(!(t >= ray.dist_bounds.x && t <= tmax)) continue;
+
+        ts[lane] = t;
+        us[lane] = u;
+        vs[lane] = v;
+        hits |= 1 << lane;
+    }
+    return hits;
+}
+
+#endif
+
+bool Tri_Pack::hit(const Ray& ray, size_t start, size_t size, Hit& closest) const {
+
+    if(!size) return false;
+
+    bool found = false;
+    size_t first = leaf_block[start], last = first + (size + width - 1) / width;
+
+    for(size_t b = first; b < last; b++) {
+        found |= hit_closest(blocks[b], ray, closest);
+    }
+    return found;
+}
+
+bool Tri_Pack::hit(const Ray& ray, const Vec3 (*tris)[3], size_t n, uint32_t first,
+                   Hit& closest) {
+
+    Block block;
+    for(size_t lane = 0; lane < width; lane++) {
+        if(lane < n) {
+            set_lane(block, lane, tris[lane][0], tris[lane][1], tris[lane][2],
+                     first + (uint32_t)lane);
+        } else {
+            set_lane(block, lane, Vec3{}, Vec3{}, Vec3{}, first);
+        }
+    }
+    return hit_closest(block, ray, closest);
+}
+
+bool Tri_Pack::hit_closest(const Block& block, const Ray& ray, Hit& closest) {
+
+    alignas(32) float ts[width], us[width], vs[width];
+    int hits = hit_block(block, ray, std::min(ray.dist_bounds.y, closest.t), ts, us, vs);
+
+    bool found = false;
+    for(size_t lane = 0; hits && lane < width; lane++) {
+        if((hits >> lane & 1) && ts[lane] < closest.t) {
+            closest = {ts[lane], us[lane], vs[lane], block.tri[lane]};
+            found = true;
+        }
+    }
+    return found;
+}
+
+size_t Tri_Pack::bytes() const {
+    return blocks.capacity() * sizeof(Block) + leaf_block.capacity() * sizeof(uint32_t);
+}
+
+} // namespace PT
@@ -0,0 +1,62 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "bvh.h"
+
+namespace PT {
+
+class Triangle;
+
+/// Copy of a mesh's triangles laid out for intersection. Each BVH leaf is stored as blocks
+/// of one vertex and two edges per triangle in structure of arrays form, so that a block
+/// can be tested against a ray at once with SIMD.
+class Tri_Pack {
+public:
+#ifdef __AVX__
+    static constexpr size_t width = 8;
+#else
+    static constexpr size_t width = 4;
+#endif
+
+    struct Hit {
+        float t = FLT_MAX, u = 0.0f, v = 0.0f;
+        /// Index of the triangle in BVH order
+        uint32_t tri = 0;
+    };
+
+    void build(const BVH<Triangle>& bvh);
+    void clear();
+
+    /// Intersect the leaf covering triangles [start, start + size) with the ray, updating
+    /// closest if a hit within the ray's bounds is nearer. Returns whether it was updated.
+    bool hit(const Ray& ray, size_t start, size_t size, Hit& closest) const;
+    /// Intersect up to width triangles given as three vertices each, which are numbered from
+    /// first. Lets meshes that keep no packed copy test their leaves the same way.
+    static bool hit(const Ray& ray, const Vec3 (*tris)[3], size_t n, uint32_t first,
+                    Hit& closest);
+
+    size_t bytes() const;
+
+private:
+    struct alignas(32) Block {
+        float v0[3][width], e1[3][width], e2[3][width];
+        uint32_t tri[width];
+    };
+
+    static void set_lane(Block& block, size_t lane, Vec3 v0, Vec3 v1, Vec3 v2, uint32_t idx);
+    /// Update closest with the nearest lane of the block hit within the ray's bounds
+    static bool hit_closest(const Block& block, const Ray& ray, Hit& closest);
+    /// Returns a mask of the lanes hit within the ray's bounds (up to tmax), and their t, u, v
+    static int hit_block(const Block& block, const Ray& ray, float tmax, float* ts, float* us,
+                         float* vs);
+
+    std::vector<Block> blocks;
+    /// First block of the leaf starting at each triangle index
+    std::vector<uint32_t> leaf_block;
+};
+
+} // namespace PT
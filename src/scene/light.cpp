@@ -2,9 +2,35 @@
 #include "light.h"
 
 #include "../geometry/util.h"
+#include "../rays/env_light.h"
 #include "renderer.h"
 
+#include <filesystem>
+#include <future>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
+
+namespace {
+
+// Environment maps are large and building their sampling tables isn't free, so each file
+// is loaded once and shared by every light using it until the file changes on disk.
+using Env_Load = std::pair<std::shared_ptr<const PT::Env_Map>, std::string>;
+
+struct Env_Cache_Entry {
+    std::weak_ptr<const PT::Env_Map> map;
+    std::filesystem::file_time_type time;
+    // Valid while the file is being loaded; other lights wait on this rather than the lock
+    std::shared_future<Env_Load> loading;
+};
+
+std::mutex env_cache_lock;
+std::unordered_map<std::string, Env_Cache_Entry> env_cache;
+
+// The sky dome only needs a tonemapped preview, not the full resolution map
+const size_t max_preview_w = 2048;
+
+} // namespace
 
 const char* Light_Type_Names[(int)Light_Type::count] = {"Directional", "Sphere", "Hemisphere",
                                                         "Point",       "Spot",   "Rectangle"};
@@ -41,24 +67,80 @@ void Scene_Light::emissive_clear() {
     opt.has_emissive_map = false;
 }
 
-HDR_Image Scene_Light::emissive_copy() const {
-    return _emissive.copy();
+std::shared_ptr<const PT::Env_Map> Scene_Light::emissive_map() const {
+    return _emissive;
 }
 
 std::string Scene_Light::emissive_load(std::string file) {
-    std::string err = _emissive.load_from(file);
-    if(err.empty()) {
-        opt.has_emissive_map = true;
+
+    std::error_code err_code;
+    auto time = std::filesystem::last_write_time(file, err_code);
+
+    auto load = [&file]() -> Env_Load {
+        Tiled_Image image;
+        std::string err = image.load_from(file);
+        if(!err.empty()) return {nullptr, std::move(err)};
+        return {std::make_shared<const PT::Env_Map>(std::move(image)), {}};
+    };
+
+    Env_Load result;
+    if(err_code) {
+        result = load();
+    } else {
+        std::unique_lock<std::mutex> lock(env_cache_lock);
+
+        for(auto e = env_cache.begin(); e != env_cache.end();) {
+            if(e->second.map.expired() && !e->second.loading.valid())
+                e = env_cache.erase(e);
+            else
+                e++;
+        }
+
+        auto entry = env_cache.find(file);
+        if(entry != env_cache.end() && entry->second.time == time) {
+            result.first = entry->second.map.lock();
+            if(!result.first && entry->second.loading.valid()) {
+                std::shared_future<Env_Load> loading = entry->second.loading;
+                lock.unlock();
+                result = loading.get();
+            }
+        }
+
+        if(!result.first && result.second.empty()) {
+            std::promise<Env_Load> promise;
+            env_cache[file] = {{}, time, promise.get_future().share()};
+            lock.unlock();
+
+            result = load();
+            promise.set_value(result);
+
+            lock.lock();
+            entry = env_cache.find(file);
+            if(entry != env_cache.end() && entry->second.time == time) {
+                if(result.first) {
+                    entry->second.map = result.first;
+                    entry->second.loading = {};
+                } else {
+                    env_cache.erase(entry);
+                }
+            }
+        }
     }
-    return err;
+
+    if(!result.first) return result.second;
+
+    _emissive = std::move(result.first);
+    _emissive_preview = _emissive->image.level_copy(_emissive->image.level_below(max_preview_w));
+    opt.has_emissive_map = true;
+    return {};
 }
 
 std::string Scene_Light::emissive_loaded() const {
-    return _emissive.loaded_from();
+    return _emissive ? _emissive->image.loaded_from() : std::string();
 }
 
 const GL::Tex2D& Scene_Light::emissive_texture() const {
-    return _emissive.get_texture();
+    return _emissive_preview.get_texture();
 }
 
 BBox Scene_Light::bbox() const {
@@ -122,7 +204,7 @@ void Scene_Light::render(const Mat4& view, bool depth_only, bool posed) {
         renderer.skydome(rot, col, 0.0f);
     } else if(opt.type == Light_Type::sphere) {
         if(opt.has_emissive_map)
-            renderer.skydome(rot, col, -1.1f, _emissive.get_texture());
+            renderer.skydome(rot, col, -1.1f, _emissive_preview.get_texture());
         else
             renderer.skydome(rot, col, -1.1f);
     } else {
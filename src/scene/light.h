@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 
 #include "../lib/spectrum.h"
@@ -11,6 +12,10 @@
 #include "object.h"
 #include "pose.h"
 
+namespace PT {
+struct Env_Map;
+}
+
 enum class Light_Type : int { directional, sphere, hemisphere, point, spot, rectangle, count };
 extern const char* Light_Type_Names[(int)Light_Type::count];
 
@@ -35,7 +40,7 @@ public:
 
     std::string emissive_load(std::string file);
     std::string emissive_loaded() const;
-    HDR_Image emissive_copy() const;
+    std::shared_ptr<const PT::Env_Map> emissive_map() const;
 
     const GL::Tex2D& emissive_texture() const;
     void emissive_clear();
@@ -70,7 +75,8 @@ private:
     Scene_ID _id = 0;
     GL::Mesh _mesh;
     GL::Lines _lines;
-    HDR_Image _emissive;
+    std::shared_ptr<const PT::Env_Map> _emissive;
+    HDR_Image _emissive_preview;
 };
 
 bool operator!=(const Scene_Light::Options& l, const Scene_Light::Options& r);
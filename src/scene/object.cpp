@@ -6,6 +6,7 @@
 
 #include "../geometry/util.h"
 #include "../gui/render.h"
+#include "../util/thread_pool.h"
 
 Scene_Object::Scene_Object(Scene_ID id, Pose p, GL::Mesh&& m, std::string n)
     : pose(p), _id(id), armature(id), _mesh(std::move(m)) {
@@ -34,6 +35,10 @@ Scene_Object::Scene_Object(Scene_ID id, Pose p, Halfedge_Mesh&& m, std::string n
     sync_anim_mesh();
 }
 
+Scene_Object::~Scene_Object() {
+    if(lod_build) lod_build->cancel.cancel();
+}
+
 const GL::Mesh& Scene_Object::posed_mesh() {
     sync_anim_mesh();
     if(armature.has_bones()) {
@@ -58,6 +63,27 @@ void Scene_Object::try_make_editable(PT::Shape_Type prev) {
         _mesh = Util::sphere_mesh(opt.shape.get<PT::Sphere>().radius, 2);
     } break;
 
+    case PT::Shape_Type::box: {
+        Vec3 h = opt.shape.get<PT::Box>().half_size;
+        _mesh = Util::cube_mesh(1.0f);
+        for(GL::Mesh::Vert& v : _mesh.edit_verts()) v.pos *= h;
+    } break;
+
+    case PT::Shape_Type::cylinder: {
+        const PT::Cylinder& cyl = opt.shape.get<PT::Cylinder>();
+        _mesh = Util::cyl_mesh(cyl.radius, cyl.height, 32);
+    } break;
+
+    case PT::Shape_Type::disk: {
+        _mesh = Util::disk_mesh(opt.shape.get<PT::Disk>().radius);
+    } break;
+
+    case PT::Shape_Type::plane: {
+        const PT::Plane& plane = opt.shape.get<PT::Plane>();
+        Vec2 h = plane.infinite ? Vec2{infinite_plane_size} : plane.half_size;
+        _mesh = Util::quad_mesh(h.x, h.y);
+    } break;
+
     case PT::Shape_Type::none:
     case PT::Shape_Type::count: break;
     }
@@ -69,7 +95,9 @@ void Scene_Object::try_make_editable(PT::Shape_Type prev) {
     }
 
     mesh_dirty = true;
+    mesh_rebuild = true;
     skel_dirty = true;
+    drop_lods();
 }
 
 bool Scene_Object::is_shape() const {
@@ -86,19 +114,21 @@ bool Scene_Object::is_editable() const {
     return editable && opt.shape_type == PT::Shape_Type::none;
 }
 
-void Scene_Object::copy_mesh(Halfedge_Mesh& out) {
-    halfedge.copy_to(out);
+Halfedge_Mesh::Snapshot Scene_Object::snapshot_mesh() {
+    return halfedge.snapshot();
 }
 
-void Scene_Object::set_mesh(Halfedge_Mesh& in) {
-    in.copy_to(halfedge);
+// Flag the mesh before restoring it, as that would otherwise forget the snapshot it
+// now matches
+void Scene_Object::set_mesh(const Halfedge_Mesh::Snapshot& in) {
     set_mesh_dirty();
+    halfedge.restore(in);
 }
 
-Halfedge_Mesh::ElementRef Scene_Object::set_mesh(Halfedge_Mesh& in, unsigned int eid) {
-    auto e = in.copy_to(halfedge, eid);
+Halfedge_Mesh::ElementRef Scene_Object::set_mesh(const Halfedge_Mesh::Snapshot& in,
+                                                 unsigned int eid) {
     set_mesh_dirty();
-    return e;
+    return halfedge.restore(in, eid);
 }
 
 void Scene_Object::take_mesh(Halfedge_Mesh&& in) {
@@ -142,13 +172,17 @@ void Scene_Object::sync_anim_mesh() {
 void Scene_Object::flip_normals() {
     halfedge.flip();
     mesh_dirty = true;
+    drop_lods();
 }
 
 void Scene_Object::sync_mesh() {
 
     if(editable && mesh_dirty) {
-        halfedge.to_mesh(_mesh, !opt.smooth_normals);
-        mesh_dirty = false;
+        if(mesh_rebuild)
+            halfedge.to_mesh(_mesh, !opt.smooth_normals);
+        else
+            halfedge.update_mesh(_mesh, !opt.smooth_normals);
+        mesh_dirty = mesh_rebuild = false;
     } else if(mesh_dirty && is_shape()) {
         mesh_dirty = false;
     }
@@ -164,10 +198,62 @@ void Scene_Object::set_skel_dirty() {
 }
 
 void Scene_Object::set_mesh_dirty() {
+    halfedge.mark_dirty();
+    rig_dirty = true;
+    mesh_dirty = true;
+    mesh_rebuild = true;
+    skel_dirty = true;
+    pose_dirty = true;
+    drop_lods();
+}
+
+void Scene_Object::set_mesh_changed(Halfedge_Mesh::ElementRef elem) {
+    halfedge.mark_changed(elem);
     rig_dirty = true;
     mesh_dirty = true;
     skel_dirty = true;
     pose_dirty = true;
+    drop_lods();
+}
+
+// Levels of detail are built behind anything more urgent, so a thread waiting on
+// interactive work never picks one up
+static Task_Group& lod_tasks() {
+    static Task_Group tasks(Thread_Pool::shared(), Priority::render);
+    return tasks;
+}
+
+// A build still running for an older mesh gives up at its next checkpoint. It isn't
+// waited for: it only touches its own snapshot and result.
+void Scene_Object::drop_lods() {
+    if(lod_build) lod_build->cancel.cancel();
+    lod_build.reset();
+    _lods.clear();
+    lods_dirty = true;
+    lod_edited = std::chrono::steady_clock::now();
+}
+
+std::vector<GL::Mesh>& Scene_Object::lods() {
+
+    if(lod_build && lod_build->done) {
+        for(Halfedge_Mesh::Mesh_Data& level : lod_build->levels) {
+            _lods.emplace_back(std::move(level.verts), std::move(level.idxs));
+        }
+        lod_build.reset();
+    }
+
+    // While the mesh is being edited, each edit would just cancel the last build
+    bool idle = std::chrono::steady_clock::now() - lod_edited >= lod_idle;
+    if(lods_dirty && idle && editable && _mesh.tris() >= lod_min_tris) {
+        lods_dirty = false;
+        lod_build = std::make_shared<LOD_Build>();
+        lod_tasks().run([build = lod_build, mesh = halfedge.snapshot(),
+                         split = !opt.smooth_normals]() {
+            build->levels = mesh->lod_levels(lod_fractions, split, build->cancel);
+            build->done = true;
+        });
+    }
+    return _lods;
 }
 
 BBox Scene_Object::bbox() {
@@ -180,6 +266,9 @@ BBox Scene_Object::bbox() {
             box = _anim_mesh.bbox();
         else
             box = _mesh.bbox();
+    } else if(opt.shape_type == PT::Shape_Type::plane && opt.shape.get<PT::Plane>().infinite) {
+        // Match what the viewport draws, not the path tracer's (far larger) bounds
+        box = PT::Plane(Vec2{infinite_plane_size}).bbox();
     } else {
         box = opt.shape.bbox();
     }
@@ -208,13 +297,38 @@ void Scene_Object::render(const Mat4& view, bool solid, bool depth_only, bool po
         opts.modelview = opts.modelview * Mat4::scale(Vec3{opt.shape.get<PT::Sphere>().radius});
         Renderer::get().sphere(opts);
     } break;
+    case PT::Shape_Type::box: {
+        opts.wireframe = false;
+        opts.modelview = opts.modelview * Mat4::scale(opt.shape.get<PT::Box>().half_size);
+        Renderer::get().box(opts);
+    } break;
+    case PT::Shape_Type::cylinder: {
+        const PT::Cylinder& cyl = opt.shape.get<PT::Cylinder>();
+        opts.wireframe = false;
+        opts.modelview = opts.modelview * Mat4::scale(Vec3{cyl.radius, cyl.height, cyl.radius});
+        Renderer::get().cylinder(opts);
+    } break;
+    case PT::Shape_Type::disk: {
+        opts.wireframe = false;
+        opts.modelview = opts.modelview * Mat4::scale(Vec3{opt.shape.get<PT::Disk>().radius});
+        Renderer::get().disk(opts);
+    } break;
+    case PT::Shape_Type::plane: {
+        const PT::Plane& plane = opt.shape.get<PT::Plane>();
+        Vec2 h = plane.infinite ? Vec2{infinite_plane_size} : plane.half_size;
+        opts.wireframe = false;
+        opts.modelview = opts.modelview * Mat4::scale(Vec3{h.x, 1.0f, h.y});
+        Renderer::get().plane(opts);
+    } break;
     case PT::Shape_Type::none: {
         opts.wireframe = opt.wireframe;
 
         if(do_anim && armature.has_bones()) {
             Renderer::get().mesh(_anim_mesh, opts);
-        } else {
+        } else if(opt.wireframe || !Renderer::get().lod_opt().enabled) {
             Renderer::get().mesh(_mesh, opts);
+        } else {
+            Renderer::get().mesh(_mesh, lods(), opts);
         }
     } break;
 
@@ -1,6 +1,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+
 #include "../geometry/halfedge.h"
 #include "../platform/gl.h"
 #include "../rays/shapes.h"
@@ -18,7 +21,7 @@ public:
     Scene_Object(Scene_ID id, Pose pose, Halfedge_Mesh&& mesh, std::string n = {});
     Scene_Object(const Scene_Object& src) = delete;
     Scene_Object(Scene_Object&& src) = default;
-    ~Scene_Object() = default;
+    ~Scene_Object();
 
     void operator=(const Scene_Object& src) = delete;
     Scene_Object& operator=(Scene_Object&& src) = default;
@@ -36,10 +39,10 @@ public:
 
     Halfedge_Mesh& get_mesh();
     const Halfedge_Mesh& get_mesh() const;
-    void copy_mesh(Halfedge_Mesh& out);
+    Halfedge_Mesh::Snapshot snapshot_mesh();
     void take_mesh(Halfedge_Mesh&& in);
-    void set_mesh(Halfedge_Mesh& in);
-    Halfedge_Mesh::ElementRef set_mesh(Halfedge_Mesh& in, unsigned int eid);
+    void set_mesh(const Halfedge_Mesh::Snapshot& in);
+    Halfedge_Mesh::ElementRef set_mesh(const Halfedge_Mesh::Snapshot& in, unsigned int eid);
 
     BBox bbox();
     bool is_editable() const;
@@ -48,10 +51,20 @@ public:
     void flip_normals();
 
     void set_mesh_dirty();
+    /// Like set_mesh_dirty, but only the faces around elem get rebuilt
+    void set_mesh_changed(Halfedge_Mesh::ElementRef elem);
     void set_skel_dirty();
     void set_pose_dirty();
 
     static const inline int max_name_len = 256;
+    /// Infinite planes are drawn (and made editable) at this size
+    static const inline float infinite_plane_size = 100.0f;
+    /// Editable meshes with at least this many triangles get levels of detail, with these
+    /// fractions of the triangles
+    static const inline size_t lod_min_tris = 20000;
+    static const inline std::vector<float> lod_fractions = {0.5f, 0.25f, 0.1f, 0.05f};
+    /// ...once the mesh has gone this long without being edited
+    static const inline std::chrono::milliseconds lod_idle{500};
     struct Options {
         char name[max_name_len] = {};
         bool wireframe = false;
@@ -69,13 +82,27 @@ public:
     mutable bool rig_dirty = false;
 
 private:
+    std::vector<GL::Mesh>& lods();
+    void drop_lods();
+
     Scene_ID _id = 0;
     Halfedge_Mesh halfedge;
 
     mutable GL::Mesh _mesh, _anim_mesh;
+    // Levels of detail of _mesh, built on the thread pool from a snapshot of the mesh. The
+    // build shares its result with the object, and is cancelled if the object moves on.
+    struct LOD_Build {
+        Cancel_Token cancel;
+        std::vector<Halfedge_Mesh::Mesh_Data> levels;
+        std::atomic<bool> done = false;
+    };
+    std::vector<GL::Mesh> _lods;
+    std::shared_ptr<LOD_Build> lod_build;
+    std::chrono::steady_clock::time_point lod_edited;
+    bool lods_dirty = true;
     mutable std::unordered_map<unsigned int, std::vector<Joint*>> vertex_joints;
     mutable bool editable = true;
-    mutable bool mesh_dirty = false;
+    mutable bool mesh_dirty = false, mesh_rebuild = false;
     mutable bool skel_dirty = false, pose_dirty = false;
 };
 
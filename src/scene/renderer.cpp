@@ -18,6 +18,8 @@ Renderer::Renderer(Vec2 dim)
       inst_shader(GL::Shaders::inst_v, GL::Shaders::mesh_f),
       dome_shader(GL::Shaders::dome_v, GL::Shaders::dome_f), _sphere(Util::sphere_mesh(1.0f, 3)),
       _cyl(Util::cyl_mesh(1.0f, 1.0f, 64, false)), _hemi(Util::hemi_mesh(1.0f)),
+      _box(Util::box_mesh(Vec3{1.0f})), _capped_cyl(Util::cyl_mesh(1.0f, 1.0f, 64, true)),
+      _disk(Util::disk_mesh(1.0f, 64)), _square(Util::square_mesh(1.0f)),
       samples(DEFAULT_SAMPLES), window_dim(dim),
       id_buffer(new GLubyte[(int)dim.x * (int)dim.y * 4]) {
 }
@@ -150,6 +152,22 @@ void Renderer::sphere(MeshOpt opt) {
     mesh(_sphere, opt);
 }
 
+void Renderer::box(MeshOpt opt) {
+    mesh(_box, opt);
+}
+
+void Renderer::cylinder(MeshOpt opt) {
+    mesh(_capped_cyl, opt);
+}
+
+void Renderer::disk(MeshOpt opt) {
+    mesh(_disk, opt);
+}
+
+void Renderer::plane(MeshOpt opt) {
+    mesh(_square, opt);
+}
+
 void Renderer::capsule(MeshOpt opt, const Mat4& mdl, float height, float rad, BBox& box) {
 
     Mat4 T = opt.modelview;
@@ -212,6 +230,39 @@ void Renderer::mesh(GL::Mesh& mesh, Renderer::MeshOpt opt) {
     if(opt.depth_only) GL::color_mask(true);
 }
 
+void Renderer::mesh(GL::Mesh& mesh, std::vector<GL::Mesh>& lods, Renderer::MeshOpt opt) {
+
+    GL::Mesh* pick = &mesh;
+    if(lod.enabled && !lods.empty()) {
+        float pixels = screen_area(opt.modelview, mesh.bbox());
+        for(GL::Mesh& level : lods) {
+            if(pixels > lod.tri_pixels * level.tris()) break;
+            pick = &level;
+        }
+    }
+    Renderer::mesh(*pick, opt);
+}
+
+// Area of the bounding sphere of the box on screen, in pixels
+float Renderer::screen_area(const Mat4& modelview, BBox box) const {
+
+    box.transform(modelview);
+    float radius = 0.5f * (box.max - box.min).norm();
+    float depth = -box.center().z;
+    if(depth <= radius) return window_dim.x * window_dim.y;
+
+    float pixels = radius / depth * _proj[1][1] * 0.5f * window_dim.y;
+    return std::min(PI_F * pixels * pixels, window_dim.x * window_dim.y);
+}
+
+void Renderer::set_lod(LODOpt opt) {
+    lod = opt;
+}
+
+const Renderer::LODOpt& Renderer::lod_opt() const {
+    return lod;
+}
+
 void Renderer::set_samples(int s) {
     samples = s;
     framebuffer.resize(window_dim, samples);
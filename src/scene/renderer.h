@@ -53,9 +53,20 @@ public:
         unsigned int err_id = 0;
     };
 
+    struct LODOpt {
+        bool enabled = true;
+        // Levels of detail are picked to give each triangle about this many pixels
+        float tri_pixels = 8.0f;
+    };
+    void set_lod(LODOpt opt);
+    const LODOpt& lod_opt() const;
+
     // NOTE(max): updates & uses the indices in mesh for selection/traversal
     void halfedge_editor(HalfedgeOpt opt);
     void mesh(GL::Mesh& mesh, MeshOpt opt);
+    /// Draws the coarsest of the levels of detail of mesh (finest first) that still gives no
+    /// triangle more than the set number of pixels, judging by its bounding box on screen
+    void mesh(GL::Mesh& mesh, std::vector<GL::Mesh>& lods, MeshOpt opt);
     void lines(const GL::Lines& lines, const Mat4& view, const Mat4& model = Mat4::I,
                float alpha = 1.0f);
     void instances(Renderer::MeshOpt opt, GL::Instances& inst);
@@ -68,6 +79,11 @@ public:
     void skydome(const Mat4& rotation, Vec3 color, float cosine, const GL::Tex2D& tex);
 
     void sphere(MeshOpt opt);
+    /// Unit shapes, matching those of PT::Shape at size one
+    void box(MeshOpt opt);
+    void cylinder(MeshOpt opt);
+    void disk(MeshOpt opt);
+    void plane(MeshOpt opt);
     void capsule(MeshOpt opt, float height, float rad);
     void capsule(MeshOpt opt, const Mat4& mdl, float height, float rad, BBox& box);
 
@@ -82,11 +98,14 @@ private:
 
     GL::Framebuffer framebuffer, id_resolve, save_buffer, save_output;
     GL::Shader mesh_shader, line_shader, inst_shader, dome_shader;
-    GL::Mesh _sphere, _cyl, _hemi;
+    GL::Mesh _sphere, _cyl, _hemi, _box, _capped_cyl, _disk, _square;
 
     int samples;
     Vec2 window_dim;
     GLubyte* id_buffer;
 
     Mat4 _proj;
+    LODOpt lod;
+
+    float screen_area(const Mat4& modelview, BBox box) const;
 };
@@ -298,6 +298,10 @@ static const std::string ANIM_NAME = "S3D-ANIMATION";
 static const std::string FLIPPED_TAG = "FLIPPED";
 static const std::string SMOOTHED_TAG = "SMOOTHED";
 static const std::string SPHERESHAPE_TAG = "SPHERESHAPE";
+static const std::string BOXSHAPE_TAG = "BOXSHAPE";
+static const std::string CYLINDERSHAPE_TAG = "CYLINDERSHAPE";
+static const std::string DISKSHAPE_TAG = "DISKSHAPE";
+static const std::string PLANESHAPE_TAG = "PLANESHAPE";
 static const std::string EMITTER_TAG = "EMITTER";
 static const std::string EMITTER_ANIM = "EMITTER_ANIM_NODE";
 
@@ -470,7 +474,47 @@ static Scene_Light::Options load_light(aiLight* ai_light, bool hemi, bool sphere
     return opt;
 }
 
-static Material::Options load_material(aiMaterial* ai_mat, float& was_sphere) {
+// Shapes are stored as a tag in the material name, with up to three parameters
+static const std::string* shape_tag(PT::Shape_Type type) {
+    switch(type) {
+    case PT::Shape_Type::sphere: return &SPHERESHAPE_TAG;
+    case PT::Shape_Type::box: return &BOXSHAPE_TAG;
+    case PT::Shape_Type::cylinder: return &CYLINDERSHAPE_TAG;
+    case PT::Shape_Type::disk: return &DISKSHAPE_TAG;
+    case PT::Shape_Type::plane: return &PLANESHAPE_TAG;
+    default: return nullptr;
+    }
+}
+
+static Vec3 shape_params(PT::Shape_Type type, const PT::Shape& shape) {
+    switch(type) {
+    case PT::Shape_Type::sphere: return Vec3{shape.get<PT::Sphere>().radius};
+    case PT::Shape_Type::box: return shape.get<PT::Box>().half_size;
+    case PT::Shape_Type::cylinder: {
+        const PT::Cylinder& cyl = shape.get<PT::Cylinder>();
+        return Vec3{cyl.radius, cyl.height, 0.0f};
+    }
+    case PT::Shape_Type::disk: return Vec3{shape.get<PT::Disk>().radius};
+    case PT::Shape_Type::plane: {
+        const PT::Plane& plane = shape.get<PT::Plane>();
+        return Vec3{plane.half_size.x, plane.half_size.y, plane.infinite ? 1.0f : 0.0f};
+    }
+    default: return Vec3{};
+    }
+}
+
+static PT::Shape shape_from(PT::Shape_Type type, Vec3 p) {
+    switch(type) {
+    case PT::Shape_Type::box: return PT::Shape(PT::Box(p));
+    case PT::Shape_Type::cylinder: return PT::Shape(PT::Cylinder(p.x, p.y));
+    case PT::Shape_Type::disk: return PT::Shape(PT::Disk(p.x));
+    case PT::Shape_Type::plane: return PT::Shape(PT::Plane(Vec2{p.x, p.y}, p.z > 0.0f));
+    default: return PT::Shape(PT::Sphere(p.x));
+    }
+}
+
+static Material::Options load_material(aiMaterial* ai_mat, PT::Shape_Type& shape_type,
+                                       PT::Shape& shape) {
 
     Material::Options mat;
 
@@ -512,10 +556,13 @@ static Material::Options load_material(aiMaterial* ai_mat, float& was_sphere) {
     }
     mat.emissive *= 1.0f / mat.intensity;
 
-    if(type.find(SPHERESHAPE_TAG) != std::string::npos) {
+    for(int t = (int)PT::Shape_Type::sphere; t < (int)PT::Shape_Type::count; t++) {
+        if(type.find("-" + *shape_tag((PT::Shape_Type)t)) == std::string::npos) continue;
         aiColor3D specular;
         ai_mat->Get(AI_MATKEY_COLOR_SPECULAR, specular);
-        was_sphere = specular.r;
+        shape_type = (PT::Shape_Type)t;
+        shape = shape_from(shape_type, Vec3{specular.r, specular.g, specular.b});
+        break;
     }
 
     return mat;
@@ -560,17 +607,18 @@ static void load_node(Scene& scobj, std::vector<std::string>& errors,
         Vec3 scale = aiVec(ascale);
         Pose p = {pos, Degrees(rot).range(0.0f, 360.0f), scale};
 
-        float was_sphere = -1.0f;
+        PT::Shape_Type shape_type = PT::Shape_Type::none;
+        PT::Shape shape;
         Material::Options mat_opt =
-            load_material(scene->mMaterials[mesh->mMaterialIndex], was_sphere);
+            load_material(scene->mMaterials[mesh->mMaterialIndex], shape_type, shape);
 
         Scene_Object new_obj;
 
-        if(was_sphere > 0.0f) {
+        if(shape_type != PT::Shape_Type::none) {
 
             Scene_Object obj(scobj.reserve_id(), p, GL::Mesh(), name);
-            obj.opt.shape_type = PT::Shape_Type::sphere;
-            obj.opt.shape = PT::Shape(PT::Sphere(was_sphere));
+            obj.opt.shape_type = shape_type;
+            obj.opt.shape = std::move(shape);
             new_obj = std::move(obj);
 
         } else {
@@ -1057,7 +1105,8 @@ static std::string write_light(aiLight* ai_light, const Scene_Light::Options& op
     return name;
 }
 
-static void write_material(aiMaterial* ai_mat, const Material::Options& opt, float is_sphere) {
+static void write_material(aiMaterial* ai_mat, const Material::Options& opt,
+                           PT::Shape_Type shape_type, const PT::Shape& shape) {
 
     std::string mat_name;
     switch(opt.type) {
@@ -1080,9 +1129,10 @@ static void write_material(aiMaterial* ai_mat, const Material::Options& opt, flo
     }
 
     // Horrible hack
-    if(is_sphere >= 0.0f) {
-        mat_name += "-" + SPHERESHAPE_TAG;
-        ai_mat->AddProperty(new aiColor3D(is_sphere), 1, AI_MATKEY_COLOR_SPECULAR);
+    if(const std::string* tag = shape_tag(shape_type)) {
+        Vec3 p = shape_params(shape_type, shape);
+        mat_name += "-" + *tag;
+        ai_mat->AddProperty(new aiColor3D(p.x, p.y, p.z), 1, AI_MATKEY_COLOR_SPECULAR);
     }
 
     Spectrum emissive = opt.emissive * opt.intensity;
@@ -1409,11 +1459,7 @@ std::string Scene::write(std::string file, const Camera& render_cam,
                 write_mesh(ai_mesh, obj.mesh());
             }
 
-            float r = -1.0f;
-            if(obj.opt.shape_type == PT::Shape_Type::sphere) {
-                r = obj.opt.shape.get<PT::Sphere>().radius;
-            }
-            write_material(ai_mat, obj.material.opt, r);
+            write_material(ai_mat, obj.material.opt, obj.opt.shape_type, obj.opt.shape);
 
             if(obj.armature.has_bones()) {
 
@@ -34,11 +34,10 @@ template<typename R, typename U> void Undo::action(R&& redo, U&& undo) {
     action(std::make_unique<Action<R, U>>(std::move(redo), std::move(undo)));
 }
 
-void Undo::update_mesh_full(Scene_ID id, Halfedge_Mesh&& old_mesh) {
+void Undo::update_mesh_full(Scene_ID id, Halfedge_Mesh::Snapshot&& old_mesh) {
 
     Scene_Object& obj = scene.get_obj(id);
-    Halfedge_Mesh new_mesh;
-    obj.copy_mesh(new_mesh);
+    Halfedge_Mesh::Snapshot new_mesh = obj.snapshot_mesh();
 
     action(
         [id, this, nm = std::move(new_mesh)]() mutable {
@@ -306,8 +305,7 @@ void Undo::update_object(Scene_ID id, Scene_Object::Options old) {
 
     if(obj.opt.shape_type != PT::Shape_Type::none && old.shape_type == PT::Shape_Type::none) {
 
-        Halfedge_Mesh old_mesh;
-        obj.copy_mesh(old_mesh);
+        Halfedge_Mesh::Snapshot old_mesh = obj.snapshot_mesh();
 
         action(
             [id, this, no = obj.opt]() {
@@ -48,15 +48,16 @@ template<typename T> class MeshOp : public Action_Base {
         auto sel = obj.set_mesh(mesh, eid);
         op(obj.get_mesh(), sel);
         obj.get_mesh().do_erase();
+        obj.set_mesh_dirty();
     }
     Scene& scene;
     Scene_ID id;
     unsigned int eid;
     T op;
-    Halfedge_Mesh mesh;
+    Halfedge_Mesh::Snapshot mesh;
 
 public:
-    MeshOp(Scene& s, Scene_ID i, unsigned int e, Halfedge_Mesh&& m, T&& t)
+    MeshOp(Scene& s, Scene_ID i, unsigned int e, Halfedge_Mesh::Snapshot&& m, T&& t)
         : scene(s), id(i), eid(e), op(t), mesh(std::move(m)) {
     }
     ~MeshOp() = default;
@@ -92,13 +93,13 @@ public:
     void update_particles(Scene_ID id, Scene_Particles::Options old);
 
     template<typename T>
-    void update_mesh(Scene_ID id, Halfedge_Mesh&& old, unsigned int e_id, T&& op) {
+    void update_mesh(Scene_ID id, Halfedge_Mesh::Snapshot&& old, unsigned int e_id, T&& op) {
         std::stack<std::unique_ptr<Action_Base>> empty;
         redos.swap(empty);
         undos.push(std::make_unique<MeshOp<T>>(scene, id, e_id, std::move(old), std::move(op)));
         total_actions++;
     }
-    void update_mesh_full(Scene_ID id, Halfedge_Mesh&& old_mesh);
+    void update_mesh_full(Scene_ID id, Halfedge_Mesh::Snapshot&& old_mesh);
 
     void anim_clear_light(Scene_ID id, float t);
     void anim_clear_object(Scene_ID id, float t);
@@ -1,13 +1,24 @@
 
 #include "../rays/bvh.h"
 #include "debug.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <stack>
+#include <type_traits>
 
 namespace PT {
 
+// Whether Primitive implements clip(), which the spatial split build requires
+template<typename Primitive, typename = void> struct BVH_Can_Clip : std::false_type {};
+template<typename Primitive>
+struct BVH_Can_Clip<Primitive, std::void_t<decltype(std::declval<const Primitive&>().clip(BBox()))>>
+    : std::true_type {};
+
 // construct BVH hierarchy given a vector of prims
 template<typename Primitive>
-void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size) {
+void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size,
+                           BVH_Builder builder, Thread_Pool* pool) {
 
     // NOTE (PathTracer):
     // This BVH is parameterized on the type of the primitive it contains. This allows
@@ -20,9 +31,23 @@ void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size)
     //      Trace hit(const Ray& ray) const;
     // Hence, you may call bbox() and hit() on any value of type Primitive.
 
-    // Keep these two lines of code in your solution. They clear the list of nodes and
-    // initialize member variable 'primitives' as a vector of the scene prims
+    // Keep these lines as well - they hand off to the alternative builders
+    if(builder == BVH_Builder::linear) {
+        build_linear(std::move(prims), max_leaf_size, pool);
+        return;
+    }
+    if constexpr(BVH_Can_Clip<Primitive>::value) {
+        if(builder == BVH_Builder::spatial) {
+            build_spatial(std::move(prims), max_leaf_size);
+            return;
+        }
+    }
+
+    // Keep these lines of code in your solution. They clear the list of nodes, reset
+    // the refit quality monitor and initialize member variable 'primitives' as a
+    // vector of the scene prims
     nodes.clear();
+    built_cost = refit_cost = 0.0f;
     primitives = std::move(prims);
 
     // TODO (PathTracer): Task 3
@@ -111,27 +136,814 @@ void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size)
     nodes[node_addr_r].bbox = split_rightBox;
     nodes[node_addr_r].start = startr;
     nodes[node_addr_r].size = ranger;
+
+    // Keep this line - it records the cost that refit() compares against
+    built_cost = refit_baseline();
 }
 
 template<typename Primitive>
 Trace BVH<Primitive>::hit(const Ray& ray) const {
 
+    // The traversal below does the work; each leaf it reaches tests its primitives in turn
+    return hit(ray, [this](const Ray& r, size_t start, size_t size) {
+        Trace ret;
+        for(size_t i = start; i < start + size; i++) {
+            ret = Trace::min(ret, primitives[i].hit(r));
+        }
+        return ret;
+    });
+}
+
+template<typename Primitive>
+template<typename Leaf_Hit>
+Trace BVH<Primitive>::hit(const Ray& ray, const Leaf_Hit& leaf_hit) const {
+
     // TODO (PathTracer): Task 3
     // Implement ray - BVH intersection test. A ray intersects
     // with a BVH aggregate if and only if it intersects a primitive in
     // the BVH that is not an aggregate.
 
-    // The starter code simply iterates through all the primitives.
-    // Again, remember you can use hit() on any Primitive value.
+    // Test the primitives of each leaf you reach with leaf_hit(ray, node.start, node.size),
+    // which returns the closest hit among them. hit(ray) above tests them one by one with
+    // Primitive::hit, while Tri_Mesh tests several triangles at once.
+
+    // The starter code simply visits every leaf.
 
     Trace ret;
-    for(const Primitive& prim : primitives) {
-        Trace hit = prim.hit(ray);
-        ret = Trace::min(ret, hit);
+    for(const Node& node : nodes) {
+        if(!node.is_leaf()) continue;
+        ret = Trace::min(ret, leaf_hit(ray, node.start, node.size));
     }
     return ret;
 }
 
+template<typename Primitive>
+void BVH<Primitive>::build_spatial(std::vector<Primitive>&& prims, size_t max_leaf_size,
+                                   float max_duplication) {
+
+    // NOTE: Spatial split BVH (Stich et al. 2009)
+    // In addition to the binned object splits of the SAH build, each node also considers
+    // splitting space with a plane, which cuts the primitives straddling it into two
+    // references - one per child. This greatly reduces node overlap for long, thin
+    // triangles at the cost of duplicated primitive references.
+    //
+    // Besides bbox() and hit(), this requires the Primitive interface to implement:
+    //      BBox clip(const BBox& box) const;
+    // returning the bounds of the part of the primitive contained in box.
+
+    nodes.clear();
+    built_cost = refit_cost = 0.0f;
+    primitives.clear();
+    root_idx = 0;
+
+    if(prims.empty()) return;
+
+    struct Ref {
+        BBox box;
+        size_t prim;
+    };
+    struct Task {
+        size_t node, depth;
+        std::vector<Ref> refs;
+    };
+    struct Split {
+        float cost = std::numeric_limits<float>::infinity();
+        int axis = 0;
+        size_t bin = 0, bins = 0;
+        bool spatial = false;
+        BBox lbox, rbox;
+    };
+
+    const size_t n_bins = spatial_bins;
+    const size_t budget = (size_t)(max_duplication * prims.size());
+    size_t n_refs = prims.size();
+
+    BBox root_box;
+    std::vector<Ref> root_refs(prims.size());
+    for(size_t i = 0; i < prims.size(); i++) {
+        root_refs[i] = {prims[i].bbox(), i};
+        root_box.enclose(root_refs[i].box);
+    }
+    const float root_area = root_box.surface_area();
+
+    auto bounds = [](const std::vector<Ref>& refs) {
+        BBox box;
+        for(const Ref& r : refs) box.enclose(r.box);
+        return box;
+    };
+    auto overlap = [](const BBox& l, const BBox& r) {
+        BBox box(hmax(l.min, r.min), hmin(l.max, r.max));
+        return box.surface_area();
+    };
+
+    // Binned SAH over reference centroids
+    auto object_split = [&](const std::vector<Ref>& refs, const BBox& box) {
+        Split best;
+
+        BBox cbox;
+        for(const Ref& r : refs) cbox.enclose(r.box.center());
+
+        for(int a = 0; a < 3; a++) {
+            float extent = cbox.max[a] - cbox.min[a];
+            if(extent <= 0.0f) continue;
+
+            std::vector<BBox> bin_box(n_bins);
+            std::vector<size_t> bin_count(n_bins, 0);
+            for(const Ref& r : refs) {
+                size_t b = (size_t)(n_bins * (r.box.center()[a] - cbox.min[a]) / extent);
+                b = std::min(b, n_bins - 1);
+                bin_box[b].enclose(r.box);
+                bin_count[b]++;
+            }
+
+            std::vector<BBox> right_box(n_bins);
+            std::vector<size_t> right_count(n_bins, 0);
+            for(size_t b = n_bins - 1; b > 0; b--) {
+                right_box[b] = bin_box[b];
+                right_count[b] = bin_count[b];
+                if(b + 1 < n_bins) {
+                    right_box[b].enclose(right_box[b + 1]);
+                    right_count[b] += right_count[b + 1];
+                }
+            }
+
+            BBox left_box;
+            size_t left_count = 0;
+            for(size_t b = 1; b < n_bins; b++) {
+                left_box.enclose(bin_box[b - 1]);
+                left_count += bin_count[b - 1];
+                if(!left_count || !right_count[b]) continue;
+
+                float cost = 1.0f + (left_box.surface_area() * left_count +
+                                     right_box[b].surface_area() * right_count[b]) /
+                                        box.surface_area();
+                if(cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = a;
+                    best.bin = b;
+                    best.spatial = false;
+                    best.lbox = left_box;
+                    best.rbox = right_box[b];
+                }
+            }
+        }
+        return best;
+    };
+
+    // Binned SAH over space, clipping references into each bin they touch
+    auto spatial_split = [&](const std::vector<Ref>& refs, const BBox& box) {
+        Split best;
+
+        // Clipping dominates the build time, and small nodes don't benefit from many bins
+        const size_t s_bins = std::clamp(refs.size(), size_t(4), n_bins);
+
+        for(int a = 0; a < 3; a++) {
+            float extent = box.max[a] - box.min[a];
+            if(extent <= 0.0f) continue;
+            float width = extent / s_bins;
+
+            auto bin_of = [&](float x) {
+                return std::min((size_t)(std::max(x - box.min[a], 0.0f) / width), s_bins - 1);
+            };
+
+            std::vector<BBox> bin_box(s_bins);
+            std::vector<size_t> enter(s_bins, 0), exit(s_bins, 0);
+            for(const Ref& r : refs) {
+                size_t first = bin_of(r.box.min[a]), last = bin_of(r.box.max[a]);
+                if(first == last) {
+                    bin_box[first].enclose(r.box);
+                } else {
+                    for(size_t b = first; b <= last; b++) {
+                        BBox slab = r.box;
+                        slab.min[a] = std::max(slab.min[a], box.min[a] + b * width);
+                        slab.max[a] = std::min(slab.max[a], box.min[a] + (b + 1) * width);
+                        bin_box[b].enclose(prims[r.prim].clip(slab));
+                    }
+                }
+                enter[first]++;
+                exit[last]++;
+            }
+
+            std::vector<BBox> right_box(s_bins);
+            std::vector<size_t> right_count(s_bins, 0);
+            for(size_t b = s_bins - 1; b > 0; b--) {
+                right_box[b] = bin_box[b];
+                right_count[b] = exit[b];
+                if(b + 1 < s_bins) {
+                    right_box[b].enclose(right_box[b + 1]);
+                    right_count[b] += right_count[b + 1];
+                }
+            }
+
+            BBox left_box;
+            size_t left_count = 0;
+            for(size_t b = 1; b < s_bins; b++) {
+                left_box.enclose(bin_box[b - 1]);
+                left_count += enter[b - 1];
+                if(!left_count || !right_count[b]) continue;
+
+                size_t duplicates = left_count + right_count[b] - refs.size();
+                if(n_refs - prims.size() + duplicates > budget) continue;
+
+                float cost = 1.0f + (left_box.surface_area() * left_count +
+                                     right_box[b].surface_area() * right_count[b]) /
+                                        box.surface_area();
+                if(cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = a;
+                    best.bin = b;
+                    best.bins = s_bins;
+                    best.spatial = true;
+                    best.lbox = left_box;
+                    best.rbox = right_box[b];
+                }
+            }
+        }
+        return best;
+    };
+
+    std::vector<Primitive> out;
+    out.reserve(prims.size());
+
+    std::stack<Task> tasks;
+    tasks.push({new_node(root_box), 0, std::move(root_refs)});
+
+    while(!tasks.empty()) {
+
+        Task task = std::move(tasks.top());
+        tasks.pop();
+
+        std::vector<Ref>& refs = task.refs;
+        BBox box = bounds(refs);
+        nodes[task.node].bbox = box;
+
+        auto make_leaf = [&]() {
+            Node& node = nodes[task.node];
+            node.start = out.size();
+            node.size = refs.size();
+            for(const Ref& r : refs) out.push_back(prims[r.prim]);
+        };
+
+        if(refs.size() <= max_leaf_size || task.depth >= spatial_max_depth ||
+           box.surface_area() <= 0.0f) {
+            make_leaf();
+            continue;
+        }
+
+        Split split = object_split(refs, box);
+
+        // Only try spatial splits where the object split children overlap significantly
+        if(n_refs - prims.size() < budget &&
+           (split.cost == std::numeric_limits<float>::infinity() ||
+            overlap(split.lbox, split.rbox) / root_area > 1e-5f)) {
+            Split ssplit = spatial_split(refs, box);
+            if(ssplit.cost < split.cost) split = ssplit;
+        }
+
+        if(split.cost == std::numeric_limits<float>::infinity()) {
+            make_leaf();
+            continue;
+        }
+
+        std::vector<Ref> left, right;
+        int a = split.axis;
+
+        if(split.spatial) {
+            float pos = box.min[a] + split.bin * (box.max[a] - box.min[a]) / split.bins;
+            for(const Ref& r : refs) {
+                if(r.box.max[a] <= pos) {
+                    left.push_back(r);
+                } else if(r.box.min[a] >= pos) {
+                    right.push_back(r);
+                } else {
+                    BBox lbox = r.box, rbox = r.box;
+                    lbox.max[a] = pos;
+                    rbox.min[a] = pos;
+                    lbox = prims[r.prim].clip(lbox);
+                    rbox = prims[r.prim].clip(rbox);
+                    if(!lbox.empty()) left.push_back({lbox, r.prim});
+                    if(!rbox.empty()) right.push_back({rbox, r.prim});
+                }
+            }
+        } else {
+            BBox cbox;
+            for(const Ref& r : refs) cbox.enclose(r.box.center());
+            float extent = cbox.max[a] - cbox.min[a];
+            for(const Ref& r : refs) {
+                size_t b = (size_t)(n_bins * (r.box.center()[a] - cbox.min[a]) / extent);
+                if(std::min(b, n_bins - 1) < split.bin) {
+                    left.push_back(r);
+                } else {
+                    right.push_back(r);
+                }
+            }
+        }
+
+        // Clipping may leave a side empty; there is nothing left to split then
+        if(left.empty() || right.empty()) {
+            make_leaf();
+            continue;
+        }
+
+        n_refs += left.size() + right.size() - refs.size();
+
+        size_t l = new_node(), r = new_node();
+        nodes[task.node].l = l;
+        nodes[task.node].r = r;
+        tasks.push({r, task.depth + 1, std::move(right)});
+        tasks.push({l, task.depth + 1, std::move(left)});
+    }
+
+    primitives = std::move(out);
+    built_cost = refit_baseline();
+}
+
+template<typename Primitive>
+void BVH<Primitive>::build_linear(std::vector<Primitive>&& prims, size_t max_leaf_size,
+                                  Thread_Pool* pool, bool optimize) {
+
+    // NOTE: Linear BVH (Lauterbach et al. 2009, Karras & Aila 2013)
+    // Primitive centroids are quantized onto a 30 bit Morton curve and radix sorted,
+    // which places nearby primitives next to each other. The hierarchy then splits
+    // each range of codes where their highest differing bit changes. Optionally, each
+    // node is afterwards re-split by trying every binary tree over a small treelet of
+    // its descendants and keeping the one with the lowest SAH cost.
+
+    nodes.clear();
+    built_cost = refit_cost = 0.0f;
+    primitives.clear();
+    root_idx = 0;
+
+    if(prims.empty()) return;
+
+    const size_t n = prims.size();
+    const size_t leaf_size = std::max(max_leaf_size, size_t(1));
+    assert(n <= std::numeric_limits<uint32_t>::max());
+
+    // Runs f(chunk, begin, end) over [0, n), on the pool if there is one
+    const size_t chunk = pool ? linear_grain : n;
+    const size_t n_chunks = (n + chunk - 1) / chunk;
+    auto for_chunks = [&](auto&& f) {
+        if(n_chunks == 1) {
+            f(size_t(0), size_t(0), n);
+            return;
+        }
+        pool->parallel_for(0, n, chunk, [&f, chunk](size_t begin, size_t end) {
+            f(begin / chunk, begin, end);
+        });
+    };
+
+    struct Key {
+        uint32_t code, prim;
+    };
+    std::vector<Key> keys(n);
+    std::vector<BBox> boxes(n);
+
+    {
+        std::vector<BBox> chunk_bounds(n_chunks);
+        for_chunks([&](size_t c, size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                boxes[i] = prims[i].bbox();
+                chunk_bounds[c].enclose(boxes[i].center());
+            }
+        });
+
+        BBox cbox;
+        for(const BBox& box : chunk_bounds) cbox.enclose(box);
+        Vec3 extent = cbox.max - cbox.min;
+        Vec3 scale;
+        for(int a = 0; a < 3; a++) scale[a] = extent[a] > 0.0f ? 1024.0f / extent[a] : 0.0f;
+
+        // Spread the low 10 bits of v out to every third bit
+        auto expand = [](uint32_t v) {
+            v = (v * 0x00010001u) & 0xFF0000FFu;
+            v = (v * 0x00000101u) & 0x0F00F00Fu;
+            v = (v * 0x00000011u) & 0xC30C30C3u;
+            v = (v * 0x00000005u) & 0x49249249u;
+            return v;
+        };
+
+        for_chunks([&](size_t, size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                Vec3 q = (boxes[i].center() - cbox.min) * scale;
+                uint32_t code = 0;
+                for(int a = 0; a < 3; a++) {
+                    code |= expand((uint32_t)clamp(q[a], 0.0f, 1023.0f)) << (2 - a);
+                }
+                keys[i] = {code, (uint32_t)i};
+            }
+        });
+    }
+
+    // LSD radix sort, 8 bits per pass. Each chunk histograms its own keys, so the
+    // exclusive scan over (digit, chunk) gives every chunk its own output range and
+    // keeps the sort stable.
+    {
+        std::vector<Key> tmp(n);
+        std::vector<size_t> counts(n_chunks * 256);
+
+        for(uint32_t shift = 0; shift < 30; shift += 8) {
+            std::fill(counts.begin(), counts.end(), 0);
+            for_chunks([&](size_t c, size_t begin, size_t end) {
+                size_t* count = &counts[c * 256];
+                for(size_t i = begin; i < end; i++) count[(keys[i].code >> shift) & 0xff]++;
+            });
+
+            size_t sum = 0;
+            for(size_t d = 0; d < 256; d++) {
+                for(size_t c = 0; c < n_chunks; c++) {
+                    size_t count = counts[c * 256 + d];
+                    counts[c * 256 + d] = sum;
+                    sum += count;
+                }
+            }
+
+            for_chunks([&](size_t c, size_t begin, size_t end) {
+                size_t* offset = &counts[c * 256];
+                for(size_t i = begin; i < end; i++) {
+                    tmp[offset[(keys[i].code >> shift) & 0xff]++] = keys[i];
+                }
+            });
+            std::swap(keys, tmp);
+        }
+    }
+
+    {
+        std::vector<BBox> sorted(n);
+        for_chunks([&](size_t, size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) sorted[i] = boxes[keys[i].prim];
+        });
+        boxes = std::move(sorted);
+    }
+
+    primitives.reserve(n);
+    for(const Key& key : keys) {
+        primitives.push_back(std::move(prims[key.prim]));
+    }
+    prims.clear();
+
+    // Split a range of sorted keys where its highest differing bit flips; ranges
+    // of identical codes are simply halved
+    auto split = [&](size_t begin, size_t end) {
+        uint32_t diff = keys[begin].code ^ keys[end - 1].code;
+        if(!diff) return (begin + end) / 2;
+        uint32_t bit = 1u << 29;
+        while(!(diff & bit)) bit >>= 1;
+        auto mid = std::partition_point(keys.begin() + begin, keys.begin() + end,
+                                        [bit](const Key& k) { return !(k.code & bit); });
+        return (size_t)(mid - keys.begin());
+    };
+
+    struct Subtree {
+        size_t node, begin, end;
+    };
+    std::vector<Subtree> deferred;
+
+    // Emits the hierarchy over [begin, end) into out[idx]. Ranges of at most cut
+    // primitives are left for later in deferred, with invalid bounds.
+    auto emit = [&](auto& self, std::vector<Node>& out, size_t idx, size_t begin, size_t end,
+                    size_t cut) -> void {
+        out[idx].start = begin;
+        out[idx].size = end - begin;
+        out[idx].l = out[idx].r = 0;
+
+        if(end - begin <= leaf_size) {
+            out[idx].bbox.reset();
+            for(size_t i = begin; i < end; i++) out[idx].bbox.enclose(boxes[i]);
+            return;
+        }
+        if(end - begin <= cut) {
+            deferred.push_back({idx, begin, end});
+            return;
+        }
+
+        size_t mid = split(begin, end);
+        size_t l = out.size();
+        out.resize(l + 2);
+        out[idx].l = l;
+        out[idx].r = l + 1;
+        self(self, out, l, begin, mid, cut);
+        self(self, out, l + 1, mid, end, cut);
+        out[idx].bbox = out[l].bbox;
+        out[idx].bbox.enclose(out[l + 1].bbox);
+    };
+
+    // Treelet restructuring: grow a treelet below idx by repeatedly expanding its
+    // largest interior leaf, then find the cheapest binary tree over those leaves
+    // by dynamic programming over all subsets.
+    auto restructure = [](std::vector<Node>& out, std::vector<float>& cost, size_t idx) {
+        constexpr size_t max_leaves = treelet_leaves;
+        size_t leaves[max_leaves], inner[max_leaves - 1];
+        size_t n_leaves = 2, n_inner = 1;
+        leaves[0] = out[idx].l;
+        leaves[1] = out[idx].r;
+        inner[0] = idx;
+
+        while(n_leaves < max_leaves) {
+            size_t expand = n_leaves;
+            float area = -1.0f;
+            for(size_t i = 0; i < n_leaves; i++) {
+                const Node& node = out[leaves[i]];
+                if(!node.is_leaf() && node.bbox.surface_area() > area) {
+                    area = node.bbox.surface_area();
+                    expand = i;
+                }
+            }
+            if(expand == n_leaves) break;
+            size_t node = leaves[expand];
+            inner[n_inner++] = node;
+            leaves[expand] = out[node].l;
+            leaves[n_leaves++] = out[node].r;
+        }
+        if(n_leaves < 3) return;
+
+        const size_t n_sets = size_t(1) << n_leaves;
+        BBox box[size_t(1) << max_leaves];
+        float set_cost[size_t(1) << max_leaves];
+        size_t partition[size_t(1) << max_leaves] = {};
+
+        auto leaf_of = [](size_t set) {
+            size_t i = 0;
+            while(!(set & (size_t(1) << i))) i++;
+            return i;
+        };
+
+        for(size_t s = 1; s < n_sets; s++) {
+            if(!(s & (s - 1))) {
+                box[s] = out[leaves[leaf_of(s)]].bbox;
+                set_cost[s] = cost[leaves[leaf_of(s)]];
+                continue;
+            }
+            // Each partition is visited once, as the half containing the lowest leaf
+            size_t low = s & (~s + 1);
+            box[s] = box[low];
+            box[s].enclose(box[s ^ low]);
+            set_cost[s] = std::numeric_limits<float>::infinity();
+            for(size_t p = (s - 1) & s; p; p = (p - 1) & s) {
+                if(!(p & low)) continue;
+                float c = set_cost[p] + set_cost[s ^ p];
+                if(c < set_cost[s]) {
+                    set_cost[s] = c;
+                    partition[s] = p;
+                }
+            }
+            set_cost[s] += box[s].surface_area();
+        }
+
+        const size_t all = n_sets - 1;
+        if(!(set_cost[all] < cost[idx] * (1.0f - 1e-5f))) return;
+
+        // Rebuild the treelet in place, reusing its interior nodes
+        size_t next = 0;
+        auto rebuild = [&](auto& self, size_t s) -> size_t {
+            if(!(s & (s - 1))) return leaves[leaf_of(s)];
+            size_t node = inner[next++];
+            size_t l = self(self, partition[s]);
+            size_t r = self(self, s ^ partition[s]);
+            out[node].l = l;
+            out[node].r = r;
+            out[node].bbox = box[s];
+            cost[node] = set_cost[s];
+            return node;
+        };
+        rebuild(rebuild, all);
+    };
+
+    // Optimizes interior nodes below limit, children before their parents
+    auto optimize_treelets = [&restructure](std::vector<Node>& out, size_t root, size_t limit) {
+        std::vector<size_t> order;
+        std::stack<size_t> tstack;
+        tstack.push(root);
+        while(!tstack.empty()) {
+            size_t idx = tstack.top();
+            tstack.pop();
+            order.push_back(idx);
+            if(!out[idx].is_leaf()) {
+                tstack.push(out[idx].l);
+                tstack.push(out[idx].r);
+            }
+        }
+
+        std::vector<float> cost(out.size());
+        for(auto idx = order.rbegin(); idx != order.rend(); idx++) {
+            const Node& node = out[*idx];
+            float area = node.bbox.surface_area();
+            if(node.is_leaf()) {
+                cost[*idx] = area * node.size;
+                continue;
+            }
+            cost[*idx] = area + cost[node.l] + cost[node.r];
+            if(*idx < limit) restructure(out, cost, *idx);
+        }
+    };
+
+    // The top of the tree is emitted here; with a pool, subtrees are emitted (and
+    // optimized) in parallel and spliced in afterwards
+    nodes.resize(1);
+    emit(emit, nodes, root_idx, 0, n, pool ? linear_grain : 0);
+    const size_t n_top = nodes.size();
+
+    std::vector<std::vector<Node>> subtrees(deferred.size());
+    if(!deferred.empty()) {
+        pool->parallel_for(0, deferred.size(), 1, [&](size_t i, size_t) {
+            std::vector<Node>& sub = subtrees[i];
+            sub.resize(1);
+            emit(emit, sub, 0, deferred[i].begin, deferred[i].end, 0);
+            if(optimize) optimize_treelets(sub, 0, sub.size());
+        });
+    }
+
+    for(size_t i = 0; i < deferred.size(); i++) {
+        const std::vector<Node>& sub = subtrees[i];
+        size_t base = nodes.size() - 1;
+        auto relocate = [base](Node node) {
+            if(!node.is_leaf()) {
+                node.l += base;
+                node.r += base;
+            }
+            return node;
+        };
+        nodes[deferred[i].node] = relocate(sub[0]);
+        for(size_t c = 1; c < sub.size(); c++) nodes.push_back(relocate(sub[c]));
+    }
+
+    // Children of top nodes always have larger indices
+    for(size_t i = n_top; i-- > 0;) {
+        Node& node = nodes[i];
+        if(node.is_leaf()) continue;
+        node.bbox = nodes[node.l].bbox;
+        node.bbox.enclose(nodes[node.r].bbox);
+    }
+
+    if(!optimize) {
+        built_cost = refit_baseline();
+        return;
+    }
+    optimize_treelets(nodes, root_idx, n_top);
+
+    // Restructuring moves subtrees around, so reorder primitives to make each
+    // node's range contiguous again
+    std::vector<Primitive> ordered;
+    ordered.reserve(n);
+    auto relink = [&](auto& self, size_t idx) -> void {
+        Node& node = nodes[idx];
+        if(node.is_leaf()) {
+            size_t start = ordered.size();
+            for(size_t i = node.start; i < node.start + node.size; i++) {
+                ordered.push_back(std::move(primitives[i]));
+            }
+            node.start = start;
+            return;
+        }
+        self(self, node.l);
+        self(self, node.r);
+        node.start = nodes[node.l].start;
+        node.size = nodes[node.l].size + nodes[node.r].size;
+    };
+    relink(relink, root_idx);
+    primitives = std::move(ordered);
+    built_cost = refit_baseline();
+}
+
+template<typename Primitive> void BVH<Primitive>::refit(Thread_Pool* pool) {
+
+    if(nodes.empty()) return;
+
+    // Order nodes such that children always come after their parents
+    std::vector<size_t> order, leaves;
+    order.reserve(nodes.size());
+
+    std::stack<size_t> tstack;
+    tstack.push(root_idx);
+    while(!tstack.empty()) {
+        size_t idx = tstack.top();
+        tstack.pop();
+        order.push_back(idx);
+
+        const Node& node = nodes[idx];
+        if(node.is_leaf()) {
+            leaves.push_back(idx);
+        } else {
+            tstack.push(node.l);
+            tstack.push(node.r);
+        }
+    }
+
+    // Leaves only depend on their own primitives, so they can be refit independently
+    auto refit_leaves = [this, &leaves](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            Node& node = nodes[leaves[i]];
+            node.bbox.reset();
+            for(size_t p = node.start; p < node.start + node.size; p++) {
+                node.bbox.enclose(primitives[p].bbox());
+            }
+        }
+    };
+
+    if(pool && leaves.size() > refit_grain) {
+        pool->parallel_for(0, leaves.size(), refit_grain, refit_leaves);
+    } else {
+        refit_leaves(0, leaves.size());
+    }
+
+    // Interior nodes are then updated from the bottom up
+    for(auto idx = order.rbegin(); idx != order.rend(); idx++) {
+        Node& node = nodes[*idx];
+        if(node.is_leaf()) continue;
+        node.bbox = nodes[node.l].bbox;
+        node.bbox.enclose(nodes[node.r].bbox);
+    }
+
+    refit_cost = sah_cost();
+}
+
+template<typename Primitive> float BVH<Primitive>::sah_cost() const {
+    return sah_cost([this](size_t idx) { return nodes[idx].bbox; });
+}
+
+template<typename Primitive>
+template<typename Box_Of>
+float BVH<Primitive>::sah_cost(const Box_Of& box_of) const {
+
+    if(nodes.empty()) return 0.0f;
+
+    float root_area = box_of(root_idx).surface_area();
+    if(root_area <= 0.0f) return 0.0f;
+
+    // Unit traversal and intersection costs; only ratios between trees are meaningful
+    float cost = 0.0f;
+    for(size_t idx = 0; idx < nodes.size(); idx++) {
+        float p = box_of(idx).surface_area() / root_area;
+        cost += nodes[idx].is_leaf() ? p * nodes[idx].size : p;
+    }
+    return cost;
+}
+
+template<typename Primitive> float BVH<Primitive>::refit_baseline() const {
+
+    if(nodes.empty()) return 0.0f;
+
+    // The bounds a refit would compute for the primitives as they are now: leaves enclose
+    // their whole primitives (which spatial splits clip) and interior nodes their children
+    std::vector<BBox> boxes(nodes.size());
+    std::vector<size_t> order;
+    order.reserve(nodes.size());
+    std::stack<size_t> tstack;
+    tstack.push(root_idx);
+    while(!tstack.empty()) {
+        size_t idx = tstack.top();
+        tstack.pop();
+        order.push_back(idx);
+        if(!nodes[idx].is_leaf()) {
+            tstack.push(nodes[idx].l);
+            tstack.push(nodes[idx].r);
+        }
+    }
+
+    for(auto idx = order.rbegin(); idx != order.rend(); idx++) {
+        const Node& node = nodes[*idx];
+        if(node.is_leaf()) {
+            for(size_t p = node.start; p < node.start + node.size; p++) {
+                boxes[*idx].enclose(primitives[p].bbox());
+            }
+        } else {
+            boxes[*idx] = boxes[node.l];
+            boxes[*idx].enclose(boxes[node.r]);
+        }
+    }
+
+    return sah_cost([&boxes](size_t idx) { return boxes[idx]; });
+}
+
+template<typename Primitive> bool BVH<Primitive>::needs_rebuild(float max_cost_ratio) const {
+    return built_cost > 0.0f && refit_cost > max_cost_ratio * built_cost;
+}
+
+template<typename Primitive> std::vector<Primitive>& BVH<Primitive>::edit_primitives() {
+    return primitives;
+}
+
+template<typename Primitive>
+const std::vector<Primitive>& BVH<Primitive>::get_primitives() const {
+    return primitives;
+}
+
+template<typename Primitive>
+template<typename F>
+void BVH<Primitive>::for_each_leaf(const F& f) const {
+    for(const Node& node : nodes) {
+        if(node.is_leaf()) f(node.start, node.size);
+    }
+}
+
+template<typename Primitive> size_t BVH<Primitive>::n_nodes() const {
+    return nodes.size();
+}
+
+template<typename Primitive> size_t BVH<Primitive>::bytes() const {
+    return nodes.capacity() * sizeof(Node) + primitives.capacity() * sizeof(Primitive);
+}
+
 template<typename Primitive>
 BVH<Primitive>::BVH(std::vector<Primitive>&& prims, size_t max_leaf_size) {
     build(std::move(prims), max_leaf_size);
@@ -143,6 +955,8 @@ BVH<Primitive> BVH<Primitive>::copy() const {
     ret.nodes = nodes;
     ret.primitives = primitives;
     ret.root_idx = root_idx;
+    ret.built_cost = built_cost;
+    ret.refit_cost = refit_cost;
     return ret;
 }
 
@@ -171,12 +985,14 @@ BBox BVH<Primitive>::bbox() const {
 template<typename Primitive>
 std::vector<Primitive> BVH<Primitive>::destructure() {
     nodes.clear();
+    built_cost = refit_cost = 0.0f;
     return std::move(primitives);
 }
 
 template<typename Primitive>
 void BVH<Primitive>::clear() {
     nodes.clear();
+    built_cost = refit_cost = 0.0f;
     primitives.clear();
 }
 
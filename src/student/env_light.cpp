@@ -24,12 +24,13 @@ Light_Sample Env_Map::sample() const {
     return ret;
 }
 
-Spectrum Env_Map::sample_direction(Vec3 dir) const {
+Spectrum Env_Map::sample_direction(Vec3 dir, float footprint) const {
 
     // TODO (PathTracer): Task 7
     // Find the incoming light along a given direction by finding the corresponding
     // place in the enviornment image. You should bi-linearly interpolate the value
     // between the 4 image pixels nearest to the exact direction.
+    // Tip: image.lookup interpolates for you, and footprint can choose its mip level.
     return Spectrum();
 }
 
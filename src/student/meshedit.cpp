@@ -1,9 +1,8 @@
 
 #include <queue>
-#include <set>
-#include <unordered_map>
 
 #include "../geometry/halfedge.h"
+#include "../util/thread_pool.h"
 #include "debug.h"
 
 /* Note on local operation return types:
@@ -639,34 +638,35 @@ void Halfedge_Mesh::triangulate() {
         the original mesh, we can nicely store the new vertex *positions* as
         attributes on vertices, edges, and faces of the original mesh. These positions
         can then be conveniently copied into the new, subdivided mesh.
-        This is what you will implement in linear_subdivide_positions() and
-        catmullclark_subdivide_positions().
-
-  Steps II-IV are provided (see Halfedge_Mesh::subdivide()), but are still detailed
-  here:
-
-  Step II: Assign a unique index (starting at 0) to each vertex, edge, and
-        face in the original mesh. These indices will be the indices of the
-        vertices in the new (subdivided mesh).  They do not have to be assigned
-        in any particular order, so long as no index is shared by more than one
-        mesh element, and the total number of indices is equal to V+E+F, i.e.,
-        the total number of vertices plus edges plus faces in the original mesh.
-        Basically we just need a one-to-one mapping between original mesh elements
-        and subdivided mesh vertices.
-
-  Step III: Build a list of quads in the new (subdivided) mesh, as tuples of
-        the element indices defined above. In other words, each new quad should be
-        of the form (i,j,k,l), where i,j,k and l are four of the indices stored on
-        our original mesh elements.  Note that it is essential to get the orientation
-        right here: (i,j,k,l) is not the same as (l,k,j,i).  Indices of new faces
-        should circulate in the same direction as old faces (think about the right-hand
-        rule).
-
-  Step IV: Pass the list of vertices and quads to a routine that clears
-        the internal data for this halfedge mesh, and builds new halfedge data from
-        scratch, using the two lists.
+        This is what you will implement in linear_subdivide_positions(),
+        catmullclark_subdivide_positions() and loop_subdivide_positions().
+
+  Step II is provided (see Halfedge_Mesh::subdivide()), but is still detailed here:
+
+  Step II: Build the new mesh. Every element of the original mesh gets a vertex
+        in the new one, numbered by the element's index (vertices first, then
+        edges, then faces), and since the new faces are always laid out the same
+        way (one quad per corner of each old face, or four triangles per old
+        triangle for Loop), their halfedges can be numbered from the old ones too.
+        So rather than listing the new faces as tuples of vertex indices and
+        building a mesh from that list, subdivide() allocates all of the new
+        elements at once and links them up directly, in parallel.
 */
 
+/*
+    subdivide() calls the functions below on a compacted mesh, so each element array can
+    be walked by index and split between threads. Each call of f must only write to the
+    element it is given.
+*/
+template<typename T, typename F> static void parallel_each(Element_Array<T>& elements, F&& f) {
+    Thread_Pool::shared().parallel_for(0, elements.slots(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            auto elem = elements.at(i);
+            if(elem != elements.end()) f(elem);
+        }
+    });
+}
+
 /*
     Compute new vertex positions for a mesh that splits each polygon
     into quads (by inserting a vertex at the face midpoint and each
@@ -686,15 +686,9 @@ void Halfedge_Mesh::linear_subdivide_positions() {
     // of the original vertex positions to Face::new_pos. Note
     // that in general, NOT all faces will be triangles!
 
-    for(auto v = vertices_begin(); v != vertices_end(); v++) {
-        v->new_pos = v->pos;
-    }
-    for(auto e = edges_begin(); e != edges_end(); e++) {
-        e->new_pos = e->center();
-    }
-    for(auto f = faces_begin(); f != faces_end(); f++) {
-        f->new_pos = f->center();
-    }
+    parallel_each(vertices, [](VertexRef v) { v->new_pos = v->pos; });
+    parallel_each(edges, [](EdgeRef e) { e->new_pos = e->center(); });
+    parallel_each(faces, [](FaceRef f) { f->new_pos = f->center(); });
 }
 /*
     Compute new vertex positions for a mesh that splits each polygon
@@ -714,139 +708,68 @@ void Halfedge_Mesh::catmullclark_subdivide_positions() {
     // slightly more involved, using the Catmull-Clark subdivision
     // rules. (These rules are outlined in the Developer Manual.)
 
-    // Faces
-    for (auto f = faces_begin(); f != faces_end(); f++) {
-		f->new_pos = f->center();
-	}
+    // Faces first: the edge and vertex rules both use the face points
+    parallel_each(faces, [](FaceRef f) { f->new_pos = f->center(); });
     // Edges
-    for (auto e = edges_begin(); e != edges_end(); e++) {
+    parallel_each(edges, [](EdgeRef e) {
         auto f1 = e->halfedge()->face();
         auto f2 = e->halfedge()->twin()->face();
         auto v1 = e->halfedge()->vertex();
         auto v2 = e->halfedge()->twin()->vertex();
         e->new_pos = (f1->new_pos + f2->new_pos + v1->pos + v2->pos) / 4.0f;
-	}
+    });
     // Vertices
-    for (auto v = vertices_begin(); v != vertices_end(); v++) {
-		    auto he = v->halfedge();
-		    float N = v->degree();
-            float n = 1.0f / N;
-		    Vec3 faceSum = Vec3(0, 0, 0);
-		    Vec3 edgeSum = Vec3(0, 0, 0);
-            do {
-			    faceSum += he->face()->new_pos;
-			    edgeSum += he->edge()->center();
-			    he = he->twin()->next();
-		    } while (he != v->halfedge());
-            faceSum *= n;
-            edgeSum *= n;
-		    v->new_pos = (faceSum + 2 * edgeSum + (N - 3) * v->pos) * n;
-    }
+    parallel_each(vertices, [](VertexRef v) {
+        auto he = v->halfedge();
+        float N = v->degree();
+        float n = 1.0f / N;
+        Vec3 faceSum = Vec3(0, 0, 0);
+        Vec3 edgeSum = Vec3(0, 0, 0);
+        do {
+            faceSum += he->face()->new_pos;
+            edgeSum += he->edge()->center();
+            he = he->twin()->next();
+        } while(he != v->halfedge());
+        faceSum *= n;
+        edgeSum *= n;
+        v->new_pos = (faceSum + 2 * edgeSum + (N - 3) * v->pos) * n;
+    });
 }
 
 /*
-        This routine should increase the number of triangles in the mesh
-        using Loop subdivision. Note: this is will only be called on triangle meshes.
+    Compute new vertex positions for a mesh that splits each triangle
+    into four (by inserting a vertex at each edge midpoint), using the
+    Loop subdivision rules. Note: this will only be called on triangle
+    meshes without boundary.
 */
-void Halfedge_Mesh::loop_subdivide() {
-
-    // Compute new positions for all the vertices in the input mesh, using
-    // the Loop subdivision rule, and store them in Vertex::new_pos.
-    // -> At this point, we also want to mark each vertex as being a vertex of the
-    //    original mesh. Use Vertex::is_new for this.
-    // -> Next, compute the updated vertex positions associated with edges, and
-    //    store it in Edge::new_pos.
-    // -> Next, we're going to split every edge in the mesh, in any order.  For
-    //    future reference, we're also going to store some information about which
-    //    subdivided edges come from splitting an edge in the original mesh, and
-    //    which edges are new, by setting the flag Edge::is_new. Note that in this
-    //    loop, we only want to iterate over edges of the original mesh.
-    //    Otherwise, we'll end up splitting edges that we just split (and the
-    //    loop will never end!)
-    // -> Now flip any new edge that connects an old and new vertex.
-    // -> Finally, copy the new vertex positions into final Vertex::pos.
+void Halfedge_Mesh::loop_subdivide_positions() {
 
     // Each vertex and edge of the original surface can be associated with a
-    // vertex in the new (subdivided) surface.
-    // Therefore, our strategy for computing the subdivided vertex locations is to
-    // *first* compute the new positions
-    // using the connectivity of the original (coarse) mesh; navigating this mesh
-    // will be much easier than navigating
-    // the new subdivided (fine) mesh, which has more elements to traverse.  We
-    // will then assign vertex positions in
-    // the new mesh based on the values we computed for the original mesh.
-
-    // Compute updated positions for all the vertices in the original mesh, using
-    // the Loop subdivision rule.
-
-    // Next, compute the updated vertex positions associated with edges.
-
-    // Next, we're going to split every edge in the mesh, in any order. For
-    // future reference, we're also going to store some information about which
-    // subdivided edges come from splitting an edge in the original mesh, and
-    // which edges are new.
-    // In this loop, we only want to iterate over edges of the original
-    // mesh---otherwise, we'll end up splitting edges that we just split (and
-    // the loop will never end!)
-
-    // Finally, flip any new edge that connects an old and new vertex.
-
-    // Copy the updated vertex positions to the subdivided mesh.
-
-    size_t edge_count = edges.size();
-    for(auto e = edges_begin(); e != edges_end(); e++) {
-    	auto v1 = e->halfedge()->vertex();
-    	auto v2 = e->halfedge()->twin()->vertex();
-    	auto v3 = e->halfedge()->next()->twin()->vertex();
-    	auto v4 = e->halfedge()->twin()->next()->twin()->vertex();
-    	e->new_pos = (3.0f / 8.0f) * (v1->pos + v2->pos) + (1.0f / 8.0f) * (v3->pos + v4->pos);
-    }
-    for (auto v = vertices_begin(); v != vertices_end(); v++) {
-        v->is_new = false;
+    // vertex in the new (subdivided) surface. subdivide() builds the new
+    // triangles itself (see Halfedge_Mesh::build_loop_subdivision()), so all
+    // that is left here is to compute those positions, using the connectivity
+    // of the original (coarse) mesh.
+
+    // Edge points: 3/8 of each endpoint, 1/8 of the two opposite vertices
+    parallel_each(edges, [](EdgeRef e) {
+        auto v1 = e->halfedge()->vertex();
+        auto v2 = e->halfedge()->twin()->vertex();
+        auto v3 = e->halfedge()->next()->twin()->vertex();
+        auto v4 = e->halfedge()->twin()->next()->twin()->vertex();
+        e->new_pos = (3.0f / 8.0f) * (v1->pos + v2->pos) + (1.0f / 8.0f) * (v3->pos + v4->pos);
+    });
+    // Updated positions of the original vertices
+    parallel_each(vertices, [](VertexRef v) {
         float N = v->degree();
         float u = N > 3 ? 3.0f / (8.0f * N) : 3.0f / 16.0f; // Adjust weights based on degree
         Vec3 sum = Vec3(0, 0, 0);
         auto he = v->halfedge();
         do {
-            sum += he->vertex()->pos;
-            he = he->next()->twin();
+            sum += he->twin()->vertex()->pos;
+            he = he->twin()->next();
         } while(he != v->halfedge());
-
-        // Calculate the updated position of the original vertex
         v->new_pos = (1.0f - N * u) * v->pos + u * sum;
-	}
-
-    auto e = edges_begin();
-    for(size_t i = 0; i < edge_count; i++) {
-        EdgeRef nextEdge = e;
-        nextEdge++;
-
-        auto new_vert = split_edge(e).value();
-        new_vert->is_new = true;
-        new_vert->new_pos = e->new_pos;
-        HalfedgeRef he = new_vert->halfedge();
-        he->edge()->is_new = false;
-        he = he->twin()->next();
-        he->edge()->is_new = true;
-        he = he->twin()->next();
-        he->edge()->is_new = false;
-        he = he->twin()->next();
-        he->edge()->is_new = true;
-        e = nextEdge;
-    }
-    do_erase();
-    for (auto e = edges_begin(); e != edges_end(); e++) {
-        if (e->is_new) {
-			auto v1 = e->halfedge()->vertex();
-			auto v2 = e->halfedge()->twin()->vertex();
-            if (v1->is_new != v2->is_new) {
-				flip_edge(e);
-			}
-		}
-	}
-    for (auto v = vertices_begin(); v != vertices_end(); v++) {
-		v->pos = v->new_pos;
-	}
+    });
 }
 
 /*
@@ -876,221 +799,380 @@ bool Halfedge_Mesh::isotropic_remesh() {
     return false;
 }
 
-/* Helper type for quadric simplification */
-struct Edge_Record {
-    Edge_Record() {
+/* Helper type for quadric simplification
+
+   A quadric is a symmetric 4x4 matrix K, so only the ten entries of its
+   upper triangle are stored (row by row):
+
+      q[0] q[1] q[2] q[3]
+           q[4] q[5] q[6]
+                q[7] q[8]
+                     q[9]
+
+   The entries are doubles: on a finely tessellated surface the error of a collapse
+   is many orders of magnitude below d^2, and in floats it would be lost to round-off.
+*/
+struct Quadric {
+    Quadric() = default;
+
+    // The quadric K = vv^T of the plane v = (n, d), i.e. dot(n, x) + d = 0
+    Quadric(Vec3 n, double d) {
+        double v[4] = {n.x, n.y, n.z, d};
+        for(int i = 0, k = 0; i < 4; i++) {
+            for(int j = i; j < 4; j++) q[k++] = v[i] * v[j];
+        }
     }
-    Edge_Record(std::unordered_map<Halfedge_Mesh::VertexRef, Mat4>& vertex_quadrics,
-                Halfedge_Mesh::EdgeRef e)
-        : edge(e) {
-
-        // Compute the combined quadric from the edge endpoints.
-        // -> Build the 3x3 linear system whose solution minimizes the quadric error
-        //    associated with these two endpoints.
-        // -> Use this system to solve for the optimal position, and store it in
-        //    Edge_Record::optimal.
-        // -> Also store the cost associated with collapsing this edge in
-        //    Edge_Record::cost.
-        Mat4 quad1 = vertex_quadrics[e->halfedge()->vertex()];
-        Mat4 quad2 = vertex_quadrics[e->halfedge()->twin()->vertex()];
-        Mat4 Q = quad1 + quad2;
-        Vec3 b = -Vec3(Q[0][3], Q[1][3], Q[2][3]);
-        Q[0][3] = 0;
-        Q[1][3] = 0;
-        Q[2][3] = 0;
-
-        optimal = Q.inverse() * b;
-        // cost is optimal transpose * Q * optimal
-        cost = dot(optimal, Q * optimal);
+
+    Quadric& operator+=(const Quadric& K) {
+        for(int i = 0; i < 10; i++) q[i] += K.q[i];
+        return *this;
+    }
+    Quadric operator+(const Quadric& K) const {
+        Quadric r = *this;
+        return r += K;
+    }
+
+    // x^T K x, with x in homogeneous coordinates
+    double error(Vec3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return x * (q[0] * x + 2.0 * (q[1] * y + q[2] * z + q[3])) +
+               y * (q[4] * y + 2.0 * (q[5] * z + q[6])) + z * (q[7] * z + 2.0 * q[8]) + q[9];
     }
-    Halfedge_Mesh::EdgeRef edge;
-    Vec3 optimal;
+
+    // Solves the 3x3 system Ax = b for the point minimizing the error, where A is the
+    // upper-left block of K and b minus its last column. Returns false if A is (nearly)
+    // singular, as it is wherever the planes summed into K are (nearly) parallel.
+    bool minimizer(Vec3& x) const {
+        double a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], i = q[7];
+        double c0 = e * i - f * f, c1 = c * f - b * i, c2 = b * f - c * e;
+        double det = a * c0 + b * c1 + c * c2;
+        double trace = a + e + i;
+        if(!(std::abs(det) > 1e-6 * trace * trace * trace)) return false;
+        double r0 = -q[3], r1 = -q[6], r2 = -q[8];
+        x.x = (float)((c0 * r0 + c1 * r1 + c2 * r2) / det);
+        x.y = (float)((c1 * r0 + (a * i - c * c) * r1 + (b * c - a * f) * r2) / det);
+        x.z = (float)((c2 * r0 + (b * c - a * f) * r1 + (a * e - b * b) * r2) / det);
+        return true;
+    }
+
+    double q[10] = {};
+};
+
+/* Helper type for quadric simplification: the cost of collapsing an edge, which is
+   referred to by its index in the element array */
+struct Edge_Record {
     float cost;
+    uint32_t edge;
 };
 
-/* Comparison operator for Edge_Records so std::set will properly order them */
+/* Comparison operator for Edge_Records, ordering ties by edge so the result is
+   reproducible */
 bool operator<(const Edge_Record& r1, const Edge_Record& r2) {
     if(r1.cost != r2.cost) {
         return r1.cost < r2.cost;
     }
-    Halfedge_Mesh::EdgeRef e1 = r1.edge;
-    Halfedge_Mesh::EdgeRef e2 = r2.edge;
-    return &*e1 < &*e2;
+    return r1.edge < r2.edge;
 }
 
 /** Helper type for quadric simplification
  *
- * A PQueue is a minimum-priority queue that
- * allows elements to be both inserted and removed from the
- * queue.  Together, one can easily change the priority of
- * an item by removing it, and re-inserting the same item
- * but with a different priority.  A priority queue, for
- * those who don't remember or haven't seen it before, is a
- * data structure that always keeps track of the item with
- * the smallest priority or "score," even as new elements
- * are inserted and removed.  Priority queues are often an
- * essential component of greedy algorithms, where one wants
- * to iteratively operate on the current "best" element.
- *
- * PQueue is templated on the type T of the object
- * being queued.  For this reason, T must define a comparison
- * operator of the form
- *
- *    bool operator<( const T& t1, const T& t2 )
- *
- * which returns true if and only if t1 is considered to have a
- * lower priority than t2.
- *
- * Basic use of a PQueue might look
- * something like this:
- *
- *    // initialize an empty queue
- *    PQueue<myItemType> queue;
- *
- *    // add some items (which we assume have been created
- *    // elsewhere, each of which has its priority stored as
- *    // some kind of internal member variable)
- *    queue.insert( item1 );
- *    queue.insert( item2 );
- *    queue.insert( item3 );
- *
- *    // get the highest priority item currently in the queue
- *    myItemType highestPriorityItem = queue.top();
- *
- *    // remove the highest priority item, automatically
- *    // promoting the next-highest priority item to the top
- *    queue.pop();
- *
- *    myItemType nextHighestPriorityItem = queue.top();
- *
- *    // Etc.
- *
- *    // We can also remove an item, making sure it is no
- *    // longer in the queue (note that this item may already
- *    // have been removed, if it was the 1st or 2nd-highest
- *    // priority item!)
- *    queue.remove( item2 );
- *
+ * An Edge_Queue is a 4-ary min-heap of Edge_Records that also keeps track of
+ * where in the heap the record of each edge is. This way the cost of an edge
+ * can be changed in place (moving it up or down the heap as needed), instead of
+ * removing its old record and inserting a new one, and there is never more than
+ * one record per edge.
  */
-template<class T> struct PQueue {
-    void insert(const T& item) {
-        queue.insert(item);
+struct Edge_Queue {
+    static constexpr uint32_t none = UINT32_MAX;
+
+    // Heapifies the records in linear time; there may be at most one per edge
+    Edge_Queue(std::vector<Edge_Record>&& records, size_t n_edges)
+        : heap(std::move(records)), slot(n_edges, none) {
+        for(size_t i = 0; i < heap.size(); i++) slot[heap[i].edge] = (uint32_t)i;
+        for(size_t i = heap.size() / 4 + 1; i-- > 0;) {
+            if(i < heap.size()) down(i);
+        }
+    }
+
+    bool empty() const {
+        return heap.empty();
+    }
+    const Edge_Record& top() const {
+        return heap[0];
     }
-    void remove(const T& item) {
-        if(queue.find(item) != queue.end()) {
-            queue.erase(item);
+    void pop() {
+        remove(heap[0].edge);
+    }
+
+    // Makes room for edges with indices below n_edges
+    void grow(size_t n_edges) {
+        if(slot.size() < n_edges) slot.resize(n_edges, none);
+    }
+
+    // Inserts the record, or replaces the one already queued for its edge
+    void update(const Edge_Record& record) {
+        uint32_t i = slot[record.edge];
+        if(i == none) {
+            i = (uint32_t)heap.size();
+            heap.push_back(record);
+            slot[record.edge] = i;
+        } else {
+            heap[i] = record;
+            down(i);
         }
+        up(i);
     }
-    const T& top(void) const {
-        return *(queue.begin());
+    void remove(uint32_t edge) {
+        if(edge >= slot.size()) return;
+        uint32_t i = slot[edge];
+        if(i == none) return;
+        slot[edge] = none;
+        Edge_Record last = heap.back();
+        heap.pop_back();
+        if(i == heap.size()) return;
+        heap[i] = last;
+        slot[last.edge] = i;
+        down(i);
+        up(slot[last.edge]);
     }
-    void pop(void) {
-        queue.erase(queue.begin());
+
+private:
+    void up(size_t i) {
+        Edge_Record r = heap[i];
+        while(i > 0) {
+            size_t parent = (i - 1) / 4;
+            if(!(r < heap[parent])) break;
+            place(i, heap[parent]);
+            i = parent;
+        }
+        place(i, r);
     }
-    size_t size() {
-        return queue.size();
+    void down(size_t i) {
+        Edge_Record r = heap[i];
+        size_t n = heap.size();
+        while(4 * i + 1 < n) {
+            size_t first = 4 * i + 1, child = first;
+            for(size_t c = first + 1; c < std::min(first + 4, n); c++) {
+                if(heap[c] < heap[child]) child = c;
+            }
+            if(!(heap[child] < r)) break;
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, r);
+    }
+    void place(size_t i, const Edge_Record& r) {
+        heap[i] = r;
+        slot[r.edge] = (uint32_t)i;
     }
 
-    std::set<T> queue;
+    std::vector<Edge_Record> heap;
+    std::vector<uint32_t> slot;
 };
 
+/*
+    Mesh simplification down to about a quarter of the faces of the input.
+*/
+bool Halfedge_Mesh::simplify() {
+    return simplify((n_faces() - n_boundaries()) / 4);
+}
+
 /*
     Mesh simplification. Note that this function returns success in a similar
     manner to the local operations, except with only a boolean value.
     (e.g. you may want to return false if you can't simplify the mesh any
     further without destroying it.)
+
+    Edges are collapsed cheapest first until at most target_faces faces are left,
+    or until the cheapest collapse would cost more than max_error. Edges touching the
+    boundary are kept, as are edges whose collapse would tear or fold the surface, so
+    the mesh may end up with more faces than asked for.
 */
-bool Halfedge_Mesh::simplify() {
-    if (edges.size() < 3) {
-		return false;
-	}
-    std::unordered_map<VertexRef, Mat4> vertex_quadrics;
-    std::unordered_map<FaceRef, Mat4> face_quadrics;
-    std::unordered_map<EdgeRef, Edge_Record> edge_records;
-    PQueue<Edge_Record> edge_queue;
-    // Compute initial quadrics for each face by simply writing the plane equation
-    // for the face in homogeneous coordinates. These quadrics should be stored
-    // in face_quadrics
-    // -> Compute an initial quadric for each vertex as the sum of the quadrics
-    //    associated with the incident faces, storing it in vertex_quadrics
-    // -> Build a priority queue of edges according to their quadric error cost,
-    //    i.e., by building an Edge_Record for each edge and sticking it in the
-    //    queue. You may want to use the above PQueue<Edge_Record> for this.
-    // -> Until we reach the target edge budget, collapse the best edge. Remember
-    //    to remove from the queue any edge that touches the collapsing edge
-    //    BEFORE it gets collapsed, and add back into the queue any edge touching
-    //    the collapsed vertex AFTER it's been collapsed. Also remember to assign
-    //    a quadric to the collapsed vertex, and to pop the collapsed edge off the
-    //    top of the queue.
-    for (auto f = faces_begin(); f != faces_end(); f++)
-    {
-		Vec3 normal = f->normal();
-		Vec3 point = f->center();
-		float d = -dot(normal, point);
-        Mat4 quadric = outer(Vec4(normal, d), Vec4(normal, d));
-		face_quadrics[f] = quadric;
-	}
-    for (auto v = vertices_begin(); v != vertices_end(); v++)
+bool Halfedge_Mesh::simplify(Size target_faces, float max_error) {
+    return simplify({target_faces}, max_error, [](size_t) { return true; });
+}
+
+/*
+    Mesh simplification through several decreasing face counts in one go, calling
+    reached(i) once the mesh is down to targets[i] faces (or is as simple as it gets).
+    Simplification stops early if reached returns false.
+*/
+bool Halfedge_Mesh::simplify(const std::vector<Size>& targets, float max_error,
+                             const std::function<bool(size_t)>& reached) {
+
+    // Quadric simplification is for triangle meshes only
+    for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+        if(!f->is_boundary() && f->degree() != 3) return false;
+    }
+    compact();
+
+    // The quadric of each vertex, by element index: the sum of the quadrics of the
+    // planes of its faces, and later of the vertices collapsed into it. Vertices on the
+    // boundary stay where they are, and since only edges away from it are collapsed,
+    // no other vertex ever comes to lie on it.
+    std::vector<Quadric> quadrics(vertices.slots());
+    std::vector<uint8_t> on_boundary(vertices.slots(), 0);
     {
-        Mat4 quadric = Mat4();
-        auto he = v->halfedge();
-        do {
-            quadric += face_quadrics[he->face()];
-			he = he->twin()->next();
-		} while (he != v->halfedge());
-        vertex_quadrics[v] = quadric;
+        std::vector<Quadric> face_quadrics(faces.slots());
+        parallel_each(faces, [&](FaceRef f) {
+            if(f->is_boundary()) return;
+            Vec3 n = f->normal();
+            face_quadrics[f.index()] = Quadric(n, -dot(n, f->center()));
+        });
+        parallel_each(vertices, [&](VertexRef v) {
+            Quadric K;
+            HalfedgeRef h = v->halfedge();
+            do {
+                K += face_quadrics[h->face().index()];
+                h = h->twin()->next();
+            } while(h != v->halfedge());
+            quadrics[v.index()] = K;
+            on_boundary[v.index()] = v->on_boundary();
+        });
     }
-    for (auto e = edges_begin(); e != edges_end(); e++)
+
+    // Where each edge would collapse to
+    std::vector<Vec3> optimal(edges.slots());
+
+    // Finds the optimal point and cost of collapsing an edge, or returns false if the
+    // edge stays because it touches the boundary
+    auto plan = [&](EdgeRef e, Edge_Record& record) {
+        VertexRef v1 = e->halfedge()->vertex(), v2 = e->halfedge()->twin()->vertex();
+        if(on_boundary[v1.index()] || on_boundary[v2.index()]) return false;
+
+        Quadric K = quadrics[v1.index()] + quadrics[v2.index()];
+        Vec3 mid = e->center(), x;
+        // A point far off the edge is as likely to be the result of round-off
+        // as of a sharp feature, so in that case fall back to the best point on it
+        if(!K.minimizer(x) || (x - mid).norm_squared() > 4.0f * e->length() * e->length()) {
+            x = mid;
+            for(Vec3 p : {v1->pos, v2->pos}) {
+                if(K.error(p) < K.error(x)) x = p;
+            }
+        }
+        optimal[e.index()] = x;
+        record = {(float)std::max(K.error(x), 0.0), (uint32_t)e.index()};
+        return true;
+    };
+
+    std::vector<Edge_Record> records(edges.slots());
     {
-		edge_records[e] = Edge_Record(vertex_quadrics, e);
-        edge_queue.insert(edge_records[e]);
-	}
+        std::vector<uint8_t> queued(edges.slots(), 0);
+        parallel_each(edges, [&](EdgeRef e) { queued[e.index()] = plan(e, records[e.index()]); });
 
-    int i = 0;
-    int target = edges.size() * 0.25;
-    while(edges.size() > target)
-	{
-        Edge_Record best = edge_queue.top();
-        edge_queue.pop();
-        auto e = best.edge;
-        Vec3 optimal = best.optimal;
-        auto v1 = e->halfedge()->vertex();
-        auto v2 = e->halfedge()->twin()->vertex();
-        Mat4 Q = vertex_quadrics[v1] + vertex_quadrics[v2];
-        vertex_quadrics.erase(v1);
-        vertex_quadrics.erase(v2);
-        auto he = v1->halfedge();
+        size_t n = 0;
+        for(size_t i = 0; i < records.size(); i++) {
+            if(queued[i]) records[n++] = records[i];
+        }
+        records.resize(n);
+    }
+    Edge_Queue queue(std::move(records), edges.slots());
+
+    // Marks the neighbors of a vertex for the link condition, by vertex index
+    std::vector<uint32_t> seen(vertices.slots(), 0);
+    uint32_t tag = 0;
+
+    auto valence = [](VertexRef v) {
+        unsigned int n = 0;
+        HalfedgeRef h = v->halfedge();
         do {
-            edge_queue.remove(edge_records[he->edge()]);
-            edge_records.erase(he->edge());
-            he = he->twin()->next();
-		} while (he != v1->halfedge());
-        he = v2->halfedge();
+            n++;
+            h = h->twin()->next();
+        } while(h != v->halfedge());
+        return n;
+    };
+
+    // Whether collapsing e to x keeps the surface a manifold without folds: the two
+    // endpoints share no neighbors but the two opposite the edge (which must not be
+    // left with only two edges), and no remaining face around them turns over.
+    auto can_collapse = [&](EdgeRef e, Vec3 x) {
+        HalfedgeRef he1 = e->halfedge(), he2 = he1->twin();
+        VertexRef v1 = he1->vertex(), v2 = he2->vertex();
+        VertexRef o1 = he1->next()->next()->vertex(), o2 = he2->next()->next()->vertex();
+        if(o1 == o2 || valence(o1) <= 3 || valence(o2) <= 3) return false;
+
+        tag++;
+        HalfedgeRef h = v1->halfedge();
         do {
-            auto temp = he->edge();
-            auto er = edge_records[temp];
-            edge_queue.remove(er);
-            edge_records.erase(temp);
-            he = he->twin()->next();
-        } while (he != v2->halfedge());
-        //validate();
-        i++;
-        if(i == 16) 
-            i = i;
-        auto newVert = collapse_edge_erase(e).value();
-        //newVert->pos = optimal;
-        // todo: null value handling
-
-        vertex_quadrics[newVert] = Q;
-        he = newVert->halfedge();
-        //validate();
+            seen[h->twin()->vertex().index()] = tag;
+            h = h->twin()->next();
+        } while(h != v1->halfedge());
+        int shared = 0;
+        h = v2->halfedge();
+        do {
+            if(seen[h->twin()->vertex().index()] == tag) shared++;
+            h = h->twin()->next();
+        } while(h != v2->halfedge());
+        if(shared != 2) return false;
+
+        for(VertexRef v : {v1, v2}) {
+            h = v->halfedge();
+            do {
+                FaceRef f = h->face();
+                if(f != he1->face() && f != he2->face()) {
+                    Vec3 a = h->next()->vertex()->pos, b = h->next()->next()->vertex()->pos;
+                    Vec3 before = cross(a - v->pos, b - v->pos);
+                    Vec3 after = cross(a - x, b - x);
+                    if(dot(before, after) <= 0.0f) return false;
+                }
+                h = h->twin()->next();
+            } while(h != v->halfedge());
+        }
+        return true;
+    };
+
+    // Each collapse takes out the two triangles on either side of the edge
+    Size n_left = faces.size() - n_boundaries();
+    size_t next = 0;
+    bool stopped = false;
+    while(next < targets.size() && !stopped) {
+
+        if(n_left <= targets[next]) {
+            stopped = !reached(next++);
+            continue;
+        }
+        if(queue.empty() || queue.top().cost > max_error) break;
+
+        Edge_Record best = queue.top();
+        queue.pop();
+
+        // Edges taken out by a collapse are left in the queue until they come up
+        EdgeRef e = edges.at(best.edge);
+        if(e == edges.end()) continue;
+
+        Vec3 x = optimal[best.edge];
+        if(!can_collapse(e, x)) continue;
+
+        Quadric K = quadrics[e->halfedge()->vertex().index()] +
+                    quadrics[e->halfedge()->twin()->vertex().index()];
+        std::optional<VertexRef> collapsed = collapse_edge_erase(e);
+        if(!collapsed.has_value()) break;
+        n_left -= 2;
+
+        VertexRef v = collapsed.value();
+        v->pos = x;
+        if(quadrics.size() < vertices.slots()) {
+            quadrics.resize(vertices.slots());
+            on_boundary.resize(vertices.slots(), 0);
+            seen.resize(vertices.slots(), 0);
+        }
+        if(optimal.size() < edges.slots()) {
+            optimal.resize(edges.slots());
+            queue.grow(edges.slots());
+        }
+        quadrics[v.index()] = K;
+        on_boundary[v.index()] = 0;
+
+        // Every edge left around v has a new endpoint, and so a new cost
+        HalfedgeRef h = v->halfedge();
         do {
-            auto er = Edge_Record(vertex_quadrics, he->edge());
-			edge_records[he->edge()] = er;
-			edge_queue.insert(edge_records[he->edge()]);
-			he = he->twin()->next();
-		} while (he != newVert->halfedge());
+            Edge_Record record;
+            if(plan(h->edge(), record)) queue.update(record);
+            h = h->twin()->next();
+        } while(h != v->halfedge());
     }
+    while(next < targets.size() && !stopped) stopped = !reached(next++);
+
     // Note: if you erase elements in a local operation, they will not be actually deleted
     // until do_erase or validate are called. This is to facilitate checking
     // for dangling references to elements that will be erased.
@@ -42,7 +42,10 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
     Trace hit = scene.hit(ray);
     if(!hit.hit) {
         if(env_light.has_value()) {
-            return env_light.value().sample_direction(ray.dir);
+            // Camera rays see the environment through a cone about a pixel wide, so they
+            // can use a prefiltered lookup instead of aliasing on high resolution maps
+            float footprint = ray.depth ? 0.0f : Radians(camera.get_fov()) / out_h;
+            return env_light.value().sample_direction(ray.dir, footprint);
         }
         return {};
     }
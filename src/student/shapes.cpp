@@ -4,7 +4,8 @@
 
 namespace PT {
 
-const char* Shape_Type_Names[(int)Shape_Type::count] = {"None", "Sphere"};
+const char* Shape_Type_Names[(int)Shape_Type::count] = {"None", "Sphere", "Box",
+                                                        "Cylinder", "Disk", "Plane"};
 
 BBox Sphere::bbox() const {
 
@@ -1,7 +1,11 @@
 
 #include "../rays/tri_mesh.h"
+#include "../rays/bvh_cache.h"
 #include "debug.h"
 
+#include <climits>
+#include <unordered_map>
+
 namespace PT {
 
 BBox Triangle::bbox() const {
@@ -46,37 +50,317 @@ Trace Triangle::hit(const Ray& ray) const {
     return ret;
 }
 
+BBox Triangle::clip(const BBox& box) const {
+
+    // Sutherland-Hodgman: clip the triangle against each face of the box in turn.
+    // Each plane adds at most one vertex, so the polygon never exceeds 9 vertices.
+    Vec3 buf[2][9];
+    Vec3* poly = buf[0];
+    Vec3* next = buf[1];
+    size_t n = 3;
+    poly[0] = vertex_list[v0].position;
+    poly[1] = vertex_list[v1].position;
+    poly[2] = vertex_list[v2].position;
+
+    for(int a = 0; a < 3; a++) {
+        for(int side = 0; side < 2; side++) {
+
+            float plane = side ? box.max[a] : box.min[a];
+            auto dist = [&](const Vec3& p) { return side ? plane - p[a] : p[a] - plane; };
+
+            // Most planes don't cut the polygon at all
+            bool inside = true;
+            for(size_t i = 0; i < n && inside; i++) {
+                inside = dist(poly[i]) >= 0.0f;
+            }
+            if(inside) continue;
+
+            size_t m = 0;
+            for(size_t i = 0; i < n; i++) {
+                const Vec3& cur = poly[i];
+                const Vec3& nxt = poly[(i + 1) % n];
+                float dc = dist(cur), dn = dist(nxt);
+
+                if(dc >= 0.0f) next[m++] = cur;
+                if((dc >= 0.0f) != (dn >= 0.0f)) {
+                    Vec3 p = cur + (nxt - cur) * (dc / (dc - dn));
+                    p[a] = plane;
+                    next[m++] = p;
+                }
+            }
+
+            if(m == 0) return BBox();
+            n = m;
+            std::swap(poly, next);
+        }
+    }
+
+    BBox ret;
+    for(size_t i = 0; i < n; i++) {
+        ret.enclose(poly[i]);
+    }
+    return BBox(hmax(ret.min, box.min), hmin(ret.max, box.max));
+}
+
 Triangle::Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2)
     : vertex_list(verts), v0(v0), v1(v1), v2(v2) {
 }
 
-void Tri_Mesh::build(const GL::Mesh& mesh) {
+void Tri_Mesh::build(const GL::Mesh& mesh, BVH_Builder bvh_builder, bool compress_verts) {
 
     verts.clear();
+    packed_verts.clear();
     triangles.clear();
+    packed.clear();
+    builder = bvh_builder;
+
+    std::vector<Tri_Mesh_Vert> mesh_verts;
+    std::vector<Triangle> tris;
+    weld(mesh, mesh_verts, tris);
+    topology = topology_of(tris);
 
-    for(const auto& v : mesh.verts()) {
-        verts.push_back({v.pos, v.norm});
+    // Linear builds are cheaper than a cache round trip, and cached BVHs bound the
+    // original positions rather than quantized ones
+    BVH_Cache& cache = BVH_Cache::get();
+    bool cached = cache.enabled() && builder != BVH_Builder::linear && !compress_verts;
+    uint64_t key = 0;
+    if(cached) {
+        key = cache.key(mesh, builder, 4);
+        if(cache.load(key, *this)) {
+            packed.build(triangles);
+            return;
+        }
     }
 
-    const auto& idxs = mesh.indices();
+    if(compress_verts) {
+        // Build over the decoded positions, so that the BVH bounds exactly what is hit
+        compress(mesh_verts);
+        for(const Tri_Mesh_Packed_Vert& v : packed_verts) {
+            verts.push_back({decode_position(v), Vec3{}});
+        }
+    } else {
+        verts = std::move(mesh_verts);
+    }
+
+    for(Triangle& tri : tris) {
+        tri.vertex_list = verts.data();
+    }
+
+    triangles.build(std::move(tris), 4, builder);
+
+    if(compress_verts) {
+        // Only the indices of the triangles are used from here on
+        verts.clear();
+        verts.shrink_to_fit();
+        for(Triangle& tri : triangles.edit_primitives()) {
+            tri.vertex_list = nullptr;
+        }
+        return;
+    }
 
+    packed.build(triangles);
+
+    if(cached) cache.store(key, *this);
+}
+
+bool Tri_Mesh::refit(const GL::Mesh& mesh) {
+
+    std::vector<Tri_Mesh_Vert> mesh_verts;
     std::vector<Triangle> tris;
+    weld(mesh, mesh_verts, tris);
+
+    size_t n_verts = compressed() ? packed_verts.size() : verts.size();
+    if(mesh_verts.size() != n_verts || topology_of(tris) != topology) {
+        return false;
+    }
+
+    // Quantization is relative to the mesh bounds, which have likely moved
+    if(compressed()) {
+        build(mesh, builder, true);
+        return true;
+    }
+
+    // Triangles reference verts by pointer, so update it in place
+    std::copy(mesh_verts.begin(), mesh_verts.end(), verts.begin());
+
+    triangles.refit(&Thread_Pool::shared());
+    if(triangles.needs_rebuild()) {
+        build(mesh, builder);
+    } else {
+        packed.build(triangles);
+    }
+    return true;
+}
+
+void Tri_Mesh::weld(const GL::Mesh& mesh, std::vector<Tri_Mesh_Vert>& out,
+                    std::vector<Triangle>& tris) {
+
+    const auto& mverts = mesh.verts();
+    const auto& idxs = mesh.indices();
+
+    struct Vec3_Hash {
+        size_t operator()(Vec3 v) const {
+            std::hash<float> h;
+            return h(v.x) ^ (h(v.y) * 31) ^ (h(v.z) * 961);
+        }
+    };
+
+    // Vertices of flat triangles are shared by position, since their normals aren't used.
+    // Any other vertex is only deduplicated by index, so that it keeps its own normal.
+    // Flat triangles may reuse those, but vertices made for flat triangles are kept out
+    // of the index remap, so welding never changes what a smooth triangle is given.
+    constexpr unsigned int none = UINT_MAX;
+    std::vector<unsigned int> remap(mverts.size(), none);
+    std::unordered_map<Vec3, unsigned int, Vec3_Hash> shared;
+
+    auto vert = [&](GL::Mesh::Index i, bool flat) {
+        if(flat) {
+            auto entry = shared.find(mverts[i].pos);
+            if(entry != shared.end()) return entry->second;
+        }
+        if(remap[i] != none) return remap[i];
+        unsigned int idx = (unsigned int)out.size();
+        out.push_back({mverts[i].pos, mverts[i].norm});
+        if(!flat) remap[i] = idx;
+        shared.emplace(mverts[i].pos, idx);
+        return idx;
+    };
+
+    tris.reserve(idxs.size() / 3);
     for(size_t i = 0; i < idxs.size(); i += 3) {
-        tris.push_back(Triangle(verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]));
+
+        const GL::Mesh::Vert& a = mverts[idxs[i]];
+        const GL::Mesh::Vert& b = mverts[idxs[i + 1]];
+        const GL::Mesh::Vert& c = mverts[idxs[i + 2]];
+
+        // A triangle is flat if all its vertex normals are its geometric normal. Flipped
+        // ones are wound the other way, so the geometric normal still faces the same side.
+        float facing = 0.0f;
+        if(a.norm == b.norm && a.norm == c.norm) {
+            facing = dot(a.norm, cross(b.pos - a.pos, c.pos - a.pos).unit());
+        }
+        bool flat = std::abs(facing) > 0.9999f;
+
+        Triangle tri(nullptr, vert(idxs[i], flat), vert(idxs[i + 1], flat),
+                     vert(idxs[i + 2], flat));
+        if(flat && facing < 0.0f) std::swap(tri.v1, tri.v2);
+        tri.flat = flat;
+        tris.push_back(tri);
     }
+}
+
+size_t Tri_Mesh::topology_of(const std::vector<Triangle>& tris) {
+
+    // FNV-1a over the welded index buffer
+    size_t hash = 14695981039346656037ull;
+    for(const Triangle& tri : tris) {
+        for(unsigned int i : {tri.v0, tri.v1, tri.v2, (unsigned int)tri.flat}) {
+            hash = (hash ^ i) * 1099511628211ull;
+        }
+    }
+    return hash ^ tris.size();
+}
+
+void Tri_Mesh::compress(const std::vector<Tri_Mesh_Vert>& mesh_verts) {
+
+    BBox box;
+    for(const Tri_Mesh_Vert& v : mesh_verts) {
+        box.enclose(v.position);
+    }
+
+    constexpr uint64_t quant_max = (1 << 21) - 1;
+    quant_min = box.min;
+    quant_step = (box.max - box.min) / (float)quant_max;
+
+    packed_verts.reserve(mesh_verts.size());
+    for(const Tri_Mesh_Vert& v : mesh_verts) {
+        uint64_t q = 0;
+        for(int a = 0; a < 3; a++) {
+            float f =
+                quant_step[a] > 0.0f ? (v.position[a] - quant_min[a]) / quant_step[a] : 0.0f;
+            uint64_t qa = (uint64_t)std::clamp(std::round(f), 0.0f, (float)quant_max);
+            q |= qa << (21 * a);
+        }
+        packed_verts.push_back({{(uint32_t)q, (uint32_t)(q >> 32)}, encode_normal(v.normal)});
+    }
+}
 
-    triangles.build(std::move(tris), 4);
+Vec3 Tri_Mesh::decode_position(const Tri_Mesh_Packed_Vert& v) const {
+    constexpr uint64_t mask = (1 << 21) - 1;
+    uint64_t q = (uint64_t)v.position[1] << 32 | v.position[0];
+    Vec3 p((float)(q & mask), (float)(q >> 21 & mask), (float)(q >> 42 & mask));
+    return quant_min + quant_step * p;
 }
 
-Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh) {
-    build(mesh);
+Vec3 Tri_Mesh::position(unsigned int v) const {
+    return compressed() ? decode_position(packed_verts[v]) : verts[v].position;
+}
+
+uint32_t Tri_Mesh::encode_normal(Vec3 n) {
+
+    // Project onto the octahedron |x| + |y| + |z| = 1 and fold its lower half over the upper
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if(l1 == 0.0f) return 0;
+
+    float x = n.x / l1, y = n.y / l1;
+    if(n.z < 0.0f) {
+        float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+
+    auto snorm = [](float f) {
+        return (uint32_t)(int32_t)std::round(std::clamp(f, -1.0f, 1.0f) * 32767.0f) & 0xffff;
+    };
+    return snorm(x) | snorm(y) << 16;
+}
+
+Vec3 Tri_Mesh::decode_normal(uint32_t n) {
+
+    float x = (float)(int16_t)(n & 0xffff) / 32767.0f;
+    float y = (float)(int16_t)(n >> 16) / 32767.0f;
+    float z = 1.0f - std::abs(x) - std::abs(y);
+    if(z < 0.0f) {
+        float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    return Vec3(x, y, z).unit();
+}
+
+Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh, BVH_Builder builder, bool compress) {
+    build(mesh, builder, compress);
+}
+
+const BVH<Triangle>& Tri_Mesh::bvh() const {
+    return triangles;
+}
+
+bool Tri_Mesh::compressed() const {
+    return !packed_verts.empty();
+}
+
+size_t Tri_Mesh::bytes() const {
+    return verts.capacity() * sizeof(Tri_Mesh_Vert) +
+           packed_verts.capacity() * sizeof(Tri_Mesh_Packed_Vert) + triangles.bytes() +
+           packed.bytes();
 }
 
 Tri_Mesh Tri_Mesh::copy() const {
     Tri_Mesh ret;
     ret.verts = verts;
+    ret.packed_verts = packed_verts;
+    ret.quant_min = quant_min;
+    ret.quant_step = quant_step;
     ret.triangles = triangles.copy();
+    ret.builder = builder;
+    ret.topology = topology;
+    ret.packed = packed;
+    for(Triangle& tri : ret.triangles.edit_primitives()) {
+        tri.vertex_list = ret.verts.data();
+    }
     return ret;
 }
 
@@ -85,10 +369,69 @@ BBox Tri_Mesh::bbox() const {
 }
 
 Trace Tri_Mesh::hit(const Ray& ray) const {
-    Trace t = triangles.hit(ray);
+
+    // Leaves are tested on the packed copy of the triangles (or on vertices decoded on the
+    // fly), which only records where the closest hit is; its shading normal is looked up
+    // once at the end
+    Tri_Pack::Hit closest;
+    bool decode = compressed();
+    Trace t = triangles.hit(ray, [&](const Ray& r, size_t start, size_t size) {
+        Trace ret;
+        ret.origin = r.point;
+        if(decode ? hit_compressed(r, start, size, closest)
+                  : packed.hit(r, start, size, closest)) {
+            ret.hit = true;
+            ret.distance = closest.t;
+            ret.position = r.at(closest.t);
+        }
+        return ret;
+    });
+    if(!t.hit) return t;
+
+    const Triangle& tri = triangles.get_primitives()[closest.tri];
+    t.distance = closest.t;
+    t.position = ray.at(closest.t);
+    if(tri.flat) {
+        Vec3 p0 = position(tri.v0), p1 = position(tri.v1), p2 = position(tri.v2);
+        t.normal = cross(p1 - p0, p2 - p0).unit();
+        return t;
+    }
+
+    Vec3 n0, n1, n2;
+    if(decode) {
+        n0 = decode_normal(packed_verts[tri.v0].normal);
+        n1 = decode_normal(packed_verts[tri.v1].normal);
+        n2 = decode_normal(packed_verts[tri.v2].normal);
+    } else {
+        n0 = verts[tri.v0].normal;
+        n1 = verts[tri.v1].normal;
+        n2 = verts[tri.v2].normal;
+    }
+    t.normal = ((1.0f - closest.u - closest.v) * n0 + closest.u * n1 + closest.v * n2).unit();
     return t;
 }
 
+bool Tri_Mesh::hit_compressed(const Ray& ray, size_t start, size_t size,
+                              Tri_Pack::Hit& closest) const {
+
+    const std::vector<Triangle>& tris = triangles.get_primitives();
+
+    bool found = false;
+    for(size_t i = 0; i < size; i += Tri_Pack::width) {
+
+        size_t n = std::min(size - i, Tri_Pack::width);
+        Vec3 leaf[Tri_Pack::width][3];
+        for(size_t j = 0; j < n; j++) {
+            const Triangle& tri = tris[start + i + j];
+            leaf[j][0] = decode_position(packed_verts[tri.v0]);
+            leaf[j][1] = decode_position(packed_verts[tri.v1]);
+            leaf[j][2] = decode_position(packed_verts[tri.v2]);
+        }
+        found |= Tri_Pack::hit(ray, leaf, n, (uint32_t)(start + i), closest);
+    }
+    return found;
+}
+
 size_t Tri_Mesh::visualize(GL::Lines& lines, GL::Lines& active, size_t level,
                            const Mat4& trans) const {
     return triangles.visualize(lines, active, level, trans);
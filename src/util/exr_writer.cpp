@@ -0,0 +1,117 @@
+
+#include "exr_writer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sf_libs/tinyexr.h>
+
+const char* EXR_Compression_Names[(int)EXR_Compression::count] = {"None", "ZIP", "PIZ"};
+
+EXR_Writer::~EXR_Writer() {
+    poll(true);
+}
+
+void EXR_Writer::write(std::string file, size_t w, size_t h, std::vector<EXR_Layer>&& layers,
+                       EXR_Options opt) {
+    pending.push_back(std::async(std::launch::async,
+                                 [file, w, h, layers = std::move(layers), opt]() {
+                                     return write_now(file, w, h, layers, opt);
+                                 }));
+}
+
+std::string EXR_Writer::poll(bool wait) {
+
+    std::string err;
+    for(auto it = pending.begin(); it != pending.end();) {
+        if(wait || it->wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            std::string e = it->get();
+            if(!e.empty()) err = e;
+            it = pending.erase(it);
+        } else {
+            it++;
+        }
+    }
+    return err;
+}
+
+bool EXR_Writer::busy() const {
+    return !pending.empty();
+}
+
+std::string EXR_Writer::write_now(std::string file, size_t w, size_t h,
+                                  const std::vector<EXR_Layer>& layers, EXR_Options opt) {
+
+    struct Channel {
+        std::string name;
+        const EXR_Layer* layer;
+        size_t idx;
+    };
+
+    std::vector<Channel> channels;
+    for(const EXR_Layer& layer : layers) {
+        size_t n = layer.channels.size();
+        if(layer.data.size() != w * h * n) return "EXR layer " + layer.name + " has wrong size.";
+        for(size_t i = 0; i < n; i++) {
+            std::string name = layer.name.empty() ? layer.channels[i]
+                                                  : layer.name + "." + layer.channels[i];
+            if(name.size() > 255) return "EXR channel name " + name + " is too long.";
+            channels.push_back({name, &layer, i});
+        }
+    }
+    if(channels.empty()) return "No EXR channels to write.";
+
+    // Readers expect channels sorted by name
+    std::sort(channels.begin(), channels.end(),
+              [](const Channel& l, const Channel& r) { return l.name < r.name; });
+
+    // EXR stores channels separately and rows from the top down
+    size_t n = channels.size();
+    std::vector<std::vector<float>> planes(n, std::vector<float>(w * h));
+    for(size_t c = 0; c < n; c++) {
+        const EXR_Layer& layer = *channels[c].layer;
+        size_t stride = layer.channels.size(), idx = channels[c].idx;
+        for(size_t y = 0; y < h; y++) {
+            const float* src = &layer.data[(h - y - 1) * w * stride];
+            float* dst = &planes[c][y * w];
+            for(size_t x = 0; x < w; x++) dst[x] = src[x * stride + idx];
+        }
+    }
+
+    std::vector<EXRChannelInfo> infos(n);
+    std::vector<int> pixel_types(n, TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<int> requested(n, opt.half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<unsigned char*> images(n);
+    for(size_t c = 0; c < n; c++) {
+        std::memset(&infos[c], 0, sizeof(EXRChannelInfo));
+        std::memcpy(infos[c].name, channels[c].name.c_str(), channels[c].name.size() + 1);
+        images[c] = (unsigned char*)planes[c].data();
+    }
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    header.num_channels = (int)n;
+    header.channels = infos.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = requested.data();
+    switch(opt.compression) {
+    case EXR_Compression::none: header.compression_type = TINYEXR_COMPRESSIONTYPE_NONE; break;
+    case EXR_Compression::piz: header.compression_type = TINYEXR_COMPRESSIONTYPE_PIZ; break;
+    default: header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP; break;
+    }
+
+    EXRImage image;
+    InitEXRImage(&image);
+    image.num_channels = (int)n;
+    image.images = images.data();
+    image.width = (int)w;
+    image.height = (int)h;
+
+    const char* err = nullptr;
+    if(SaveEXRImageToFile(&image, &header, file.c_str(), &err) != TINYEXR_SUCCESS) {
+        std::string err_s = err ? err : "Failed to write EXR.";
+        if(err) FreeEXRErrorMessage(err);
+        return err_s;
+    }
+    return {};
+}
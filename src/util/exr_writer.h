@@ -0,0 +1,47 @@
+
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+
+/// A named group of float channels in an EXR file. Pixels are interleaved and rows run
+/// from the bottom up, as in HDR_Image.
+struct EXR_Layer {
+    /// Channels of the unnamed layer are written as-is, others as name.channel
+    std::string name;
+    std::vector<std::string> channels;
+    std::vector<float> data;
+};
+
+enum class EXR_Compression : int { none, zip, piz, count };
+extern const char* EXR_Compression_Names[(int)EXR_Compression::count];
+
+struct EXR_Options {
+    bool half = false;
+    EXR_Compression compression = EXR_Compression::zip;
+};
+
+/// Writes EXR files on background threads so that compression and disk IO don't hold up
+/// rendering. Destroying the writer waits for pending files.
+class EXR_Writer {
+public:
+    EXR_Writer() = default;
+    EXR_Writer(const EXR_Writer& src) = delete;
+    ~EXR_Writer();
+
+    void operator=(const EXR_Writer& src) = delete;
+
+    void write(std::string file, size_t w, size_t h, std::vector<EXR_Layer>&& layers,
+               EXR_Options opt);
+    /// Returns the error of any finished write that failed. If wait is set, first waits
+    /// for all pending writes.
+    std::string poll(bool wait = false);
+    bool busy() const;
+
+    static std::string write_now(std::string file, size_t w, size_t h,
+                                 const std::vector<EXR_Layer>& layers, EXR_Options opt);
+
+private:
+    std::vector<std::future<std::string>> pending;
+};
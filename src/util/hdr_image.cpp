@@ -1,16 +1,155 @@
 
 #include "hdr_image.h"
 #include "../lib/log.h"
+#include "thread_pool.h"
+
+#include <cstring>
 
 #include <sf_libs/stb_image.h>
 #include <sf_libs/tinyexr.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HDR_IMAGE_SIMD
+#endif
+
+namespace {
+
+// Tonemapping computes 1 - exp(-v * exposure) and applies gamma for every channel, which
+// dominated the cost of displaying renders with std::exp and std::pow. These versions
+// reduce to a short polynomial: exp2 has relative error below 3e-6 and log2 absolute error
+// below 1e-7, far under the half step of an 8 bit output.
+
+const float exp2_c[] = {0.6931472f, 0.2402265f, 0.05550411f, 0.009618129f, 0.001333356f};
+const float ln_to_log2 = 1.4426950f;
+const float sqrt_2 = 1.4142135f;
+
+#ifdef HDR_IMAGE_SIMD
+
+using Lanes = __m128;
+
+// 2^x for x in [-126, 0]
+inline Lanes exp2_lanes(Lanes x) {
+    __m128i n = _mm_cvtps_epi32(x);
+    Lanes f = _mm_sub_ps(x, _mm_cvtepi32_ps(n));
+    Lanes p = _mm_set1_ps(exp2_c[4]);
+    for(int i = 3; i >= 0; i--) {
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exp2_c[i]));
+    }
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+    __m128i scale = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+// log2(x) for x in [0, 1]
+inline Lanes log2_lanes(Lanes x) {
+    __m128i bits = _mm_castps_si128(x);
+    Lanes e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    __m128i mant = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                _mm_set1_epi32(0x3f800000));
+    Lanes m = _mm_castsi128_ps(mant);
+
+    // Keep m in [sqrt(2)/2, sqrt(2)) so the series below converges quickly
+    Lanes big = _mm_cmpgt_ps(m, _mm_set1_ps(sqrt_2));
+    m = _mm_sub_ps(m, _mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+    e = _mm_add_ps(e, _mm_and_ps(big, _mm_set1_ps(1.0f)));
+
+    Lanes s = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+    Lanes s2 = _mm_mul_ps(s, s);
+    Lanes p = _mm_add_ps(_mm_mul_ps(s2, _mm_set1_ps(1.0f / 7.0f)), _mm_set1_ps(1.0f / 5.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(1.0f / 3.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(1.0f));
+    Lanes ln = _mm_mul_ps(_mm_mul_ps(s, _mm_set1_ps(2.0f)), p);
+    return _mm_add_ps(e, _mm_mul_ps(ln, _mm_set1_ps(ln_to_log2)));
+}
+
+// Tonemap four channel values to bytes
+inline void tonemap_lanes(const float* in, float scale, unsigned char* out) {
+    Lanes a = _mm_mul_ps(_mm_loadu_ps(in), _mm_set1_ps(scale));
+    a = _mm_min_ps(a, _mm_setzero_ps());
+    a = _mm_max_ps(a, _mm_set1_ps(-126.0f));
+    Lanes x = _mm_sub_ps(_mm_set1_ps(1.0f), exp2_lanes(a));
+    Lanes y = exp2_lanes(_mm_mul_ps(log2_lanes(x), _mm_set1_ps(1.0f / GAMMA)));
+    __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(255.0f)),
+                                            _mm_set1_ps(0.5f)));
+    b = _mm_packs_epi32(b, b);
+    b = _mm_packus_epi16(b, b);
+    int packed = _mm_cvtsi128_si32(b);
+    std::memcpy(out, &packed, 4);
+}
+
+#endif
+
+inline float exp2_scalar(float x) {
+    float n = std::nearbyint(x), f = x - n;
+    float p = exp2_c[4];
+    for(int i = 3; i >= 0; i--) p = p * f + exp2_c[i];
+    p = p * f + 1.0f;
+    uint32_t bits = (uint32_t)((int)n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, 4);
+    return p * scale;
+}
+
+inline float log2_scalar(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, 4);
+    float e = (float)((int)(bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    std::memcpy(&m, &bits, 4);
+    if(m > sqrt_2) {
+        m *= 0.5f;
+        e += 1.0f;
+    }
+    float s = (m - 1.0f) / (m + 1.0f), s2 = s * s;
+    float ln = 2.0f * s * (1.0f + s2 * (1.0f / 3.0f + s2 * (1.0f / 5.0f + s2 * (1.0f / 7.0f))));
+    return e + ln * ln_to_log2;
+}
+
+inline unsigned char tonemap_scalar(float v, float scale) {
+    float a = v * scale;
+    a = a < 0.0f ? std::max(a, -126.0f) : 0.0f;
+    float y = exp2_scalar(log2_scalar(1.0f - exp2_scalar(a)) * (1.0f / GAMMA));
+    return (unsigned char)(int)(y * 255.0f + 0.5f);
+}
+
+// Tonemap n pixels to RGBA
+void tonemap_span(const Spectrum* in, size_t n, float exposure, unsigned char* out) {
+
+    static_assert(sizeof(Spectrum) == 3 * sizeof(float), "Spectrum must be three floats");
+    const float* channels = &in->r;
+    float scale = -exposure * ln_to_log2;
+
+    const size_t batch = 64;
+    unsigned char rgb[3 * batch];
+    for(size_t i = 0; i < n; i += batch) {
+        size_t count = 3 * std::min(batch, n - i);
+        const float* src = channels + 3 * i;
+        size_t c = 0;
+#ifdef HDR_IMAGE_SIMD
+        for(; c + 4 <= count; c += 4) tonemap_lanes(src + c, scale, rgb + c);
+#endif
+        for(; c < count; c++) rgb[c] = tonemap_scalar(src[c], scale);
+
+        unsigned char* dst = out + 4 * i;
+        for(size_t p = 0; p < count / 3; p++) {
+            dst[4 * p] = rgb[3 * p];
+            dst[4 * p + 1] = rgb[3 * p + 1];
+            dst[4 * p + 2] = rgb[3 * p + 2];
+            dst[4 * p + 3] = 255;
+        }
+    }
+}
+
+} // namespace
+
 HDR_Image::HDR_Image() : w(0), h(0) {
 }
 
-HDR_Image::HDR_Image(size_t w, size_t h) : w(w), h(h) {
+HDR_Image::HDR_Image(size_t w, size_t h) {
     assert(w > 0 && h > 0);
-    pixels.resize(w * h);
+    resize(w, h);
 }
 
 HDR_Image HDR_Image::copy() const {
@@ -18,7 +157,6 @@ HDR_Image HDR_Image::copy() const {
     ret.resize(w, h);
     ret.pixels.insert(ret.pixels.begin(), pixels.begin(), pixels.end());
     ret.last_path = last_path;
-    ret.dirty = true;
     ret.exposure = exposure;
     return ret;
 }
@@ -32,9 +170,18 @@ void HDR_Image::resize(size_t _w, size_t _h) {
     h = _h;
     pixels.clear();
     pixels.resize(w * h);
+    size_t tiles_x = (w + dirty_tile - 1) / dirty_tile;
+    size_t tiles_y = (h + dirty_tile - 1) / dirty_tile;
+    dirty_tiles.assign(tiles_x * tiles_y, 0);
     dirty = true;
 }
 
+void HDR_Image::mark(size_t x, size_t y) {
+    size_t tiles_x = (w + dirty_tile - 1) / dirty_tile;
+    dirty_tiles[(y / dirty_tile) * tiles_x + x / dirty_tile] = 1;
+    dirty_any = true;
+}
+
 void HDR_Image::clear(Spectrum color) {
     for(auto& s : pixels) s = color;
     dirty = true;
@@ -42,7 +189,7 @@ void HDR_Image::clear(Spectrum color) {
 
 Spectrum& HDR_Image::at(size_t i) {
     assert(i < w * h);
-    dirty = true;
+    mark(i % w, i / w);
     return pixels[i];
 }
 
@@ -54,7 +201,7 @@ Spectrum HDR_Image::at(size_t i) const {
 Spectrum& HDR_Image::at(size_t x, size_t y) {
     assert(x < w && y < h);
     size_t idx = y * w + x;
-    dirty = true;
+    mark(x, y);
     return pixels[idx];
 }
 
@@ -144,13 +291,52 @@ void HDR_Image::tonemap(float e) const {
         dirty = true;
     }
 
-    if(!dirty) return;
+    if(dirty) {
+        tonemap_to(tonemapped, e);
+        render_tex.image((int)w, (int)h, tonemapped.data());
+        std::fill(dirty_tiles.begin(), dirty_tiles.end(), 0);
+        dirty = dirty_any = false;
+        return;
+    }
+    if(!dirty_any) return;
 
-    std::vector<unsigned char> data;
-    tonemap_to(data, e);
-    render_tex.image((int)w, (int)h, data.data());
+    size_t tiles_x = (w + dirty_tile - 1) / dirty_tile;
+    std::vector<size_t> tiles;
+    for(size_t i = 0; i < dirty_tiles.size(); i++) {
+        if(dirty_tiles[i]) tiles.push_back(i);
+    }
 
-    dirty = false;
+    // Output rows are flipped, so tile rows [y0, y1) land on texture rows [h - y1, h - y0)
+    Thread_Pool::shared().parallel_for(0, tiles.size(), 4, [&](size_t begin, size_t end) {
+        for(size_t t = begin; t < end; t++) {
+            size_t x0 = (tiles[t] % tiles_x) * dirty_tile, y0 = (tiles[t] / tiles_x) * dirty_tile;
+            size_t x1 = std::min(x0 + dirty_tile, w), y1 = std::min(y0 + dirty_tile, h);
+            for(size_t y = y0; y < y1; y++) {
+                tonemap_span(&pixels[y * w + x0], x1 - x0, e,
+                             &tonemapped[4 * ((h - y - 1) * w + x0)]);
+            }
+        }
+    });
+
+    // Upload each horizontal run of dirty tiles as one region
+    for(size_t ty = 0; ty * dirty_tile < h; ty++) {
+        size_t y0 = ty * dirty_tile, y1 = std::min(y0 + dirty_tile, h);
+        for(size_t tx = 0; tx < tiles_x;) {
+            if(!dirty_tiles[ty * tiles_x + tx]) {
+                tx++;
+                continue;
+            }
+            size_t run = tx;
+            while(run < tiles_x && dirty_tiles[ty * tiles_x + run]) {
+                dirty_tiles[ty * tiles_x + run++] = 0;
+            }
+            size_t x0 = tx * dirty_tile, x1 = std::min(run * dirty_tile, w);
+            render_tex.update((int)x0, (int)(h - y1), (int)(x1 - x0), (int)(y1 - y0), (int)w,
+                              &tonemapped[4 * ((h - y1) * w + x0)]);
+            tx = run;
+        }
+    }
+    dirty_any = false;
 }
 
 const GL::Tex2D& HDR_Image::get_texture(float e) const {
@@ -166,24 +352,9 @@ void HDR_Image::tonemap_to(std::vector<unsigned char>& data, float e) const {
 
     if(data.size() != w * h * 4) data.resize(w * h * 4);
 
-    for(size_t j = 0; j < h; j++) {
-        for(size_t i = 0; i < w; i++) {
-
-            size_t pidx = (h - j - 1) * w + i;
-            const Spectrum& sample = pixels[pidx];
-
-            float r = 1.0f - std::exp(-sample.r * exposure);
-            float g = 1.0f - std::exp(-sample.g * exposure);
-            float b = 1.0f - std::exp(-sample.b * exposure);
-
-            Spectrum out(r, g, b);
-            out.make_srgb();
-
-            size_t didx = 4 * (j * w + i);
-            data[didx] = (unsigned char)std::round(out.r * 255.0f);
-            data[didx + 1] = (unsigned char)std::round(out.g * 255.0f);
-            data[didx + 2] = (unsigned char)std::round(out.b * 255.0f);
-            data[didx + 3] = 255;
+    Thread_Pool::shared().parallel_for(0, h, 64, [&](size_t begin, size_t end) {
+        for(size_t j = begin; j < end; j++) {
+            tonemap_span(&pixels[(h - j - 1) * w], w, e, &data[4 * j * w]);
         }
-    }
+    });
 }
@@ -36,12 +36,20 @@ public:
 
 private:
     void tonemap(float exposure = 0.0f) const;
+    void mark(size_t x, size_t y);
+
+    /// Writes are tracked in square tiles of this many pixels so that only changed tiles
+    /// are tonemapped and uploaded again
+    static const inline size_t dirty_tile = 64;
 
     size_t w, h;
     std::string last_path;
     std::vector<Spectrum> pixels;
 
     mutable GL::Tex2D render_tex;
+    mutable std::vector<unsigned char> tonemapped;
+    mutable std::vector<unsigned char> dirty_tiles;
     mutable float exposure = 1.0f;
     mutable bool dirty = true;
+    mutable bool dirty_any = false;
 };
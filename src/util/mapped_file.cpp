@@ -0,0 +1,118 @@
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <utility>
+
+Mapped_File::Mapped_File(Mapped_File&& src) {
+    *this = std::move(src);
+}
+
+Mapped_File::~Mapped_File() {
+    close();
+}
+
+Mapped_File& Mapped_File::operator=(Mapped_File&& src) {
+    close();
+    std::swap(_data, src._data);
+    std::swap(_size, src._size);
+#ifdef _WIN32
+    std::swap(file, src.file);
+    std::swap(mapping, src.mapping);
+#endif
+    return *this;
+}
+
+std::string Mapped_File::open(std::string path) {
+
+    close();
+
+#ifdef _WIN32
+
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(f == INVALID_HANDLE_VALUE) return "Failed to open file.";
+
+    LARGE_INTEGER fsize;
+    if(!GetFileSizeEx(f, &fsize) || fsize.QuadPart == 0) {
+        CloseHandle(f);
+        return "Empty file.";
+    }
+
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!m) {
+        CloseHandle(f);
+        return "Failed to map file.";
+    }
+
+    void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if(!view) {
+        CloseHandle(m);
+        CloseHandle(f);
+        return "Failed to map file.";
+    }
+
+    file = f;
+    mapping = m;
+    _data = (const unsigned char*)view;
+    _size = (size_t)fsize.QuadPart;
+
+#else
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return "Failed to open file.";
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return "Empty file.";
+    }
+
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(view == MAP_FAILED) return "Failed to map file.";
+
+    _data = (const unsigned char*)view;
+    _size = (size_t)st.st_size;
+
+#endif
+
+    return {};
+}
+
+void Mapped_File::close() {
+
+    if(!_data) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    mapping = file = nullptr;
+#else
+    munmap((void*)_data, _size);
+#endif
+
+    _data = nullptr;
+    _size = 0;
+}
+
+bool Mapped_File::is_open() const {
+    return _data != nullptr;
+}
+
+const unsigned char* Mapped_File::data() const {
+    return _data;
+}
+
+size_t Mapped_File::size() const {
+    return _size;
+}
@@ -0,0 +1,31 @@
+
+#pragma once
+
+#include <string>
+
+/// Read-only memory mapping of an entire file
+class Mapped_File {
+public:
+    Mapped_File() = default;
+    Mapped_File(const Mapped_File& src) = delete;
+    Mapped_File(Mapped_File&& src);
+    ~Mapped_File();
+
+    Mapped_File& operator=(const Mapped_File& src) = delete;
+    Mapped_File& operator=(Mapped_File&& src);
+
+    std::string open(std::string file);
+    void close();
+
+    bool is_open() const;
+    const unsigned char* data() const;
+    size_t size() const;
+
+private:
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
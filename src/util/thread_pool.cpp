@@ -2,71 +2,292 @@
 #include "thread_pool.h"
 #include "../util/rand.h"
 
-Thread_Pool::Thread_Pool(size_t threads) {
-    start(threads);
+namespace {
+
+// The pool and queue owned by the current thread, if it is a worker
+thread_local Thread_Pool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+// Priority of the task being run by the current thread
+thread_local Priority running_priority = Priority::interactive;
+
+// Xorshift state for picking steal victims; must be non-zero
+thread_local uint32_t steal_state = 0x9e3779b9u;
+
+size_t random_index(size_t n) {
+    steal_state ^= steal_state << 13;
+    steal_state ^= steal_state >> 17;
+    steal_state ^= steal_state << 5;
+    return steal_state % n;
 }
 
-Thread_Pool::~Thread_Pool() {
-    stop();
+} // namespace
+
+Task_Group::Task_Group(Thread_Pool& pool)
+    : pool(pool), priority(Thread_Pool::current_priority()) {
+}
+
+Task_Group::Task_Group(Thread_Pool& pool, Priority priority, Cancel_Token token)
+    : pool(pool), priority(priority), token(std::move(token)) {
+}
+
+Task_Group::~Task_Group() {
+    wait_pending();
 }
 
-void Thread_Pool::start(size_t threads) {
-    n_threads = threads;
-    stop_now = false;
-    stop_when_done = false;
-    for(size_t i = 0; i < threads; i++)
-        workers.emplace_back([this] {
+void Task_Group::wait() {
+    wait_pending();
+    rethrow();
+}
+
+void Task_Group::cancel_and_wait() {
+
+    cancel();
+    pool.drop_queued(this);
+
+    // Running tasks are expected to notice the cancellation and return early
+    {
+        std::unique_lock<std::mutex> lock(pool.sleep_mut);
+        pool.sleeping_waiters++;
+        pool.waiter_cond.wait(lock, [this]() { return pending.load() == 0; });
+        pool.sleeping_waiters--;
+    }
+    rethrow();
+}
+
+void Task_Group::rethrow() {
+    std::exception_ptr err;
+    {
+        std::lock_guard<std::mutex> lock(error_mut);
+        std::swap(err, error);
+    }
+    if(err) std::rethrow_exception(err);
+}
+
+void Task_Group::wait_pending() {
+    // Only help with work at least as urgent as ours, so waiting on an interactive group
+    // never ends up running a whole render epoch
+    while(pending.load() > 0) {
+        if(pool.run_one(priority)) continue;
+        pool.sleep_until(priority, [this]() { return pending.load() == 0; }, false);
+    }
+}
+
+void Task_Group::finish() {
+    // The group may be destroyed as soon as pending reaches zero, so don't touch it after
+    Thread_Pool& p = pool;
+    if(pending.fetch_sub(1) == 1) p.wake_waiters();
+}
+
+Thread_Pool::Thread_Pool(size_t threads) : all(*this, Priority((int)Priority::count - 1)) {
+
+    threads = std::max(threads, size_t(1));
+    for(size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Worker_Queue>());
+    }
+    for(size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this, i] {
             RNG::seed();
-            for(;;) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this] {
-                        return this->stop_now || this->stop_when_done || !this->tasks.empty();
-                    });
-                    if(this->stop_now || (this->stop_when_done && this->tasks.empty())) return;
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }
-                task();
+            current_pool = this;
+            current_queue = i;
+            steal_state = (uint32_t)(i + 1) * 0x9e3779b9u;
+            while(!stopping) {
+                if(run_one(all.priority)) continue;
+                sleep_until(all.priority, [this]() { return stopping.load(); }, true);
             }
         });
+    }
 }
 
-void Thread_Pool::clear() {
+Thread_Pool::~Thread_Pool() {
     stop();
-    start(n_threads);
 }
 
-void Thread_Pool::wait() {
+Thread_Pool& Thread_Pool::shared() {
+    static Thread_Pool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+Priority Thread_Pool::current_priority() {
+    return running_priority;
+}
 
+void Thread_Pool::spawn(Task&& task, Task_Group* group, Priority priority) {
+
+    // Tasks spawned by a running task while the pool stops are dropped
+    if(stopping) return;
+
+    all.pending++;
+    if(group) group->pending++;
+
+    // Workers push onto their own queue so nested tasks stay local; other threads spread
+    // their tasks over all queues
+    size_t idx = current_pool == this ? current_queue : next_queue++ % queues.size();
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop_when_done = true;
+        Worker_Queue& q = *queues[idx];
+        std::lock_guard<std::mutex> lock(q.mut);
+        q.entries[(int)priority].push_back({std::move(task), group, priority});
+        queued[(int)priority]++;
     }
+    wake_workers(false);
+    wake_waiters();
+}
 
-    condition.notify_all();
-    for(std::thread& worker : workers) {
-        worker.join();
+bool Thread_Pool::has_queued(Priority lowest) const {
+    for(int p = 0; p <= (int)lowest; p++) {
+        if(queued[p].load() > 0) return true;
     }
-    workers.clear();
+    return false;
+}
+
+bool Thread_Pool::try_pop(Entry& entry, Priority lowest) {
+
+    for(int p = 0; p <= (int)lowest; p++) {
+
+        if(queued[p].load() == 0) continue;
 
-    start(n_threads);
+        // Newest task from our own queue first...
+        if(current_pool == this) {
+            Worker_Queue& q = *queues[current_queue];
+            std::lock_guard<std::mutex> lock(q.mut);
+            if(!q.entries[p].empty()) {
+                entry = std::move(q.entries[p].back());
+                q.entries[p].pop_back();
+                queued[p]--;
+                return true;
+            }
+        }
+
+        // ...then the oldest task of another queue, starting from a random one
+        size_t n = queues.size();
+        size_t start = random_index(n);
+        for(size_t i = 0; i < n; i++) {
+            Worker_Queue& q = *queues[(start + i) % n];
+            std::lock_guard<std::mutex> lock(q.mut);
+            if(!q.entries[p].empty()) {
+                entry = std::move(q.entries[p].front());
+                q.entries[p].pop_front();
+                queued[p]--;
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
-void Thread_Pool::stop() {
+bool Thread_Pool::run_one(Priority lowest) {
+    Entry entry;
+    if(!try_pop(entry, lowest)) return false;
+    execute(entry);
+    return true;
+}
 
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop_now = true;
+void Thread_Pool::yield() {
+    int p = (int)running_priority;
+    while(p > 0 && run_one(Priority(p - 1))) {
     }
+}
+
+void Thread_Pool::execute(Entry& entry) {
+
+    // Tasks of a cancelled group are skipped, but still count as finished
+    Task_Group* group = entry.group;
+    if(!group || !group->cancelled()) {
+        Priority outer = running_priority;
+        running_priority = entry.priority;
+        if(group) {
+            try {
+                entry.task();
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(group->error_mut);
+                if(!group->error) group->error = std::current_exception();
+            }
+        } else {
+            entry.task();
+        }
+        running_priority = outer;
+    }
+
+    // Release whatever the task captured before anyone waiting on it wakes up
+    entry.task = Task();
+    if(group) group->finish();
+    all.finish();
+}
+
+void Thread_Pool::sleep_until(Priority lowest, const std::function<bool()>& ready,
+                              bool worker) {
+    std::atomic<size_t>& sleeping = worker ? sleeping_workers : sleeping_waiters;
+    std::condition_variable& cond = worker ? worker_cond : waiter_cond;
+
+    std::unique_lock<std::mutex> lock(sleep_mut);
+    sleeping++;
+    cond.wait(lock, [&]() { return has_queued(lowest) || ready(); });
+    sleeping--;
+}
+
+// Sleepers register before checking their condition, so if there are none, any thread
+// about to sleep will see the change that prompted the wake up
+
+void Thread_Pool::wake_workers(bool broadcast) {
+    if(sleeping_workers.load() == 0) return;
+    { std::lock_guard<std::mutex> lock(sleep_mut); }
+    if(broadcast)
+        worker_cond.notify_all();
+    else
+        worker_cond.notify_one();
+}
+
+void Thread_Pool::wake_waiters() {
+    if(sleeping_waiters.load() == 0) return;
+    { std::lock_guard<std::mutex> lock(sleep_mut); }
+    waiter_cond.notify_all();
+}
+
+void Thread_Pool::drop_queued(Task_Group* group) {
+    for(auto& q : queues) {
+        for(int p = 0; p < n_priorities; p++) {
+            std::deque<Entry> dropped;
+            {
+                std::lock_guard<std::mutex> lock(q->mut);
+                std::deque<Entry>& entries = q->entries[p];
+                if(!group) {
+                    std::swap(dropped, entries);
+                } else {
+                    std::deque<Entry> kept;
+                    for(Entry& entry : entries) {
+                        (entry.group == group ? dropped : kept).push_back(std::move(entry));
+                    }
+                    std::swap(kept, entries);
+                }
+                queued[p] -= dropped.size();
+            }
+            for(Entry& entry : dropped) {
+                entry.task = Task();
+                if(entry.group) entry.group->finish();
+                all.finish();
+            }
+        }
+    }
+}
+
+void Thread_Pool::clear() {
+    drop_queued();
+    all.wait_pending();
+}
+
+void Thread_Pool::wait() {
+    all.wait_pending();
+}
+
+void Thread_Pool::stop() {
+
+    if(stopping.exchange(true)) return;
 
-    condition.notify_all();
+    wake_workers(true);
     for(std::thread& worker : workers) {
         worker.join();
     }
     workers.clear();
 
-    std::queue<std::function<void()>> empty;
-    std::swap(tasks, empty);
+    drop_queued();
 }
@@ -1,50 +1,285 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 #include "../lib/log.h"
 
+class Thread_Pool;
+
+// Move-only type-erased void() callable. Small callables (e.g. lambdas capturing a few
+// references, or a packaged_task) are stored inline, so spawning them does not allocate.
+class Task {
+public:
+    Task() = default;
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F&& f) {
+        using T = std::decay_t<F>;
+        if constexpr(fits_inline<T>) {
+            new(storage) T(std::forward<F>(f));
+            ops = &inline_ops<T>;
+        } else {
+            new(storage) T*(new T(std::forward<F>(f)));
+            ops = &heap_ops<T>;
+        }
+    }
+    ~Task() {
+        reset();
+    }
+
+    Task(Task&& src) noexcept {
+        *this = std::move(src);
+    }
+    Task& operator=(Task&& src) noexcept {
+        if(this == &src) return *this;
+        reset();
+        if(src.ops) {
+            src.ops->move(storage, src.storage);
+            ops = src.ops;
+            src.ops = nullptr;
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    explicit operator bool() const {
+        return ops != nullptr;
+    }
+    void operator()() {
+        ops->call(storage);
+    }
+
+private:
+    struct Ops {
+        void (*call)(void*);
+        // Move-constructs dst from src and destroys src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    static constexpr size_t inline_size = 48;
+    template<typename T>
+    static constexpr bool fits_inline = sizeof(T) <= inline_size &&
+                                        alignof(T) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<T>;
+
+    template<typename T>
+    static constexpr Ops inline_ops = {[](void* p) { (*static_cast<T*>(p))(); },
+                                       [](void* dst, void* src) {
+                                           new(dst) T(std::move(*static_cast<T*>(src)));
+                                           static_cast<T*>(src)->~T();
+                                       },
+                                       [](void* p) { static_cast<T*>(p)->~T(); }};
+    template<typename T>
+    static constexpr Ops heap_ops = {[](void* p) { (**static_cast<T**>(p))(); },
+                                     [](void* dst, void* src) {
+                                         new(dst) T*(*static_cast<T**>(src));
+                                     },
+                                     [](void* p) { delete *static_cast<T**>(p); }};
+
+    void reset() {
+        if(ops) ops->destroy(storage);
+        ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+    const Ops* ops = nullptr;
+};
+
+// Scheduling classes, most urgent first. Queued tasks of a more urgent class are always
+// picked first, and long-running tasks call Thread_Pool::yield() to let them in early.
+enum class Priority : int { interactive, simulation, render, count };
+
+// Cooperative cancellation flag. Copies share the same flag, so one can be handed to the
+// tasks doing some work while another is kept to cancel it.
+class Cancel_Token {
+public:
+    Cancel_Token() : flag(std::make_shared<std::atomic<bool>>(false)) {
+    }
+
+    void cancel() {
+        flag->store(true);
+    }
+    void reset() {
+        flag->store(false);
+    }
+    bool cancelled() const {
+        return flag->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+// A set of tasks that can be waited on together. Tasks may run more tasks in the same
+// or another group, and waiting executes queued work rather than blocking, so groups may
+// be nested inside tasks. The first exception thrown by a task is rethrown by wait().
+// Once the group's token is cancelled, its tasks that have not started yet are skipped.
+class Task_Group {
+public:
+    // Tasks run at the priority of the task creating the group, or interactive if the
+    // group is created outside the pool
+    explicit Task_Group(Thread_Pool& pool);
+    Task_Group(Thread_Pool& pool, Priority priority, Cancel_Token token = {});
+    ~Task_Group();
+
+    Task_Group(const Task_Group&) = delete;
+    Task_Group& operator=(const Task_Group&) = delete;
+
+    template<typename F> void run(F&& f);
+    void wait();
+    // Cancels the group, drops its queued tasks and waits for its running ones. Unlike
+    // wait(), this sleeps rather than helping, so it never picks up unrelated work.
+    void cancel_and_wait();
+
+    void cancel() {
+        token.cancel();
+    }
+    bool cancelled() const {
+        return token.cancelled();
+    }
+
+private:
+    void finish();
+    void wait_pending();
+    void rethrow();
+
+    Thread_Pool& pool;
+    Priority priority;
+    Cancel_Token token;
+    std::atomic<size_t> pending = 0;
+    std::mutex error_mut;
+    std::exception_ptr error;
+
+    friend class Thread_Pool;
+};
+
+// Work-stealing thread pool: each worker owns a deque per priority, pushing and popping
+// its own tasks at the back and stealing from the front of a random other worker once it
+// runs dry. Tasks spawned from outside the pool are spread round-robin over the workers.
 class Thread_Pool {
 public:
     Thread_Pool(size_t threads);
     ~Thread_Pool();
 
+    // The pool shared by the whole application, with one worker per hardware thread
+    static Thread_Pool& shared();
+
+    // Drops queued tasks and joins the workers; the pool can not be used afterwards
     void stop();
+    // Waits for every task spawned so far, including ones they spawn in turn
     void wait();
+    // Drops queued tasks and waits for the running ones to finish
     void clear();
 
+    // Runs queued tasks more urgent than the calling task, if there are any
+    void yield();
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // Priority of the task running on this thread (interactive outside of tasks)
+    static Priority current_priority();
+
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args)
-        -> std::future<typename std::invoke_result<F, Args...>::type> {
+        -> std::future<typename std::invoke_result<F, Args...>::type>;
 
-        using return_type = typename std::invoke_result<F, Args...>::type;
-        assert(!stop_now && !stop_when_done);
+    // Calls f(begin, end) over sub-ranges of [begin, end) of at most grain items each,
+    // returning once all of them have finished
+    template<typename F> void parallel_for(size_t begin, size_t end, size_t grain, F&& f);
 
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+private:
+    static constexpr int n_priorities = (int)Priority::count;
 
-        std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            tasks.emplace([task]() { (*task)(); });
-        }
-        condition.notify_one();
-        return res;
-    }
+    struct Entry {
+        Task task;
+        Task_Group* group = nullptr;
+        Priority priority = Priority::interactive;
+    };
+    struct Worker_Queue {
+        std::mutex mut;
+        std::deque<Entry> entries[n_priorities];
+    };
 
-private:
-    void start(size_t);
-    size_t n_threads;
-    bool stop_now = true;
-    bool stop_when_done = true;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
+    void spawn(Task&& task, Task_Group* group, Priority priority);
+    void execute(Entry& entry);
+    bool has_queued(Priority lowest) const;
+    bool try_pop(Entry& entry, Priority lowest);
+    bool run_one(Priority lowest);
+    void sleep_until(Priority lowest, const std::function<bool()>& ready, bool worker);
+    void wake_workers(bool all);
+    void wake_waiters();
+    // Drops the queued tasks of group, or of every group if null
+    void drop_queued(Task_Group* group = nullptr);
+
+    std::vector<std::unique_ptr<Worker_Queue>> queues;
     std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
+    std::atomic<size_t> next_queue = 0;
+    std::atomic<size_t> queued[n_priorities] = {};
+    std::atomic<bool> stopping = false;
+
+    // Workers and threads waiting on a group sleep on separate conditions, since a waiter
+    // may not be able to take the task that woke it
+    std::mutex sleep_mut;
+    std::condition_variable worker_cond, waiter_cond;
+    std::atomic<size_t> sleeping_workers = 0, sleeping_waiters = 0;
+
+    // Every task also counts toward this group, so wait() can use it
+    Task_Group all;
+
+    friend class Task_Group;
 };
+
+template<typename F> void Task_Group::run(F&& f) {
+    if(token.cancelled()) return;
+    pool.spawn(Task(std::forward<F>(f)), this, priority);
+}
+
+template<class F, class... Args>
+auto Thread_Pool::enqueue(F&& f, Args&&... args)
+    -> std::future<typename std::invoke_result<F, Args...>::type> {
+
+    using return_type = typename std::invoke_result<F, Args...>::type;
+    assert(!stopping);
+
+    std::packaged_task<return_type()> task(
+        [f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            return std::apply(f, std::move(args));
+        });
+
+    std::future<return_type> res = task.get_future();
+    spawn(Task(std::move(task)), nullptr, current_priority());
+    return res;
+}
+
+template<typename F> void Thread_Pool::parallel_for(size_t begin, size_t end, size_t grain, F&& f) {
+
+    if(begin >= end) return;
+    grain = std::max(grain, size_t(1));
+
+    // The calling thread takes the last range itself, then helps with the rest
+    Task_Group group(*this);
+    size_t last = begin + (end - begin - 1) / grain * grain;
+    for(size_t b = begin; b < last; b += grain) {
+        group.run([&f, b, grain]() { f(b, b + grain); });
+    }
+    f(last, end);
+    group.wait();
+}
@@ -0,0 +1,319 @@
+
+#include "tiled_image.h"
+#include "../lib/log.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char tile_magic[8] = {'C', '3', 'D', 'T', 'E', 'X', '\0', '\0'};
+const uint32_t tile_version = 1;
+const size_t max_levels = 64;
+// Level sizes come from the file, so they are bounded before computing byte counts from them
+const uint64_t max_dim = uint64_t(1) << 20;
+
+struct Tile_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t tile_size;
+    uint32_t levels;
+    uint32_t padding;
+};
+
+struct Tile_Level {
+    uint64_t w, h, offset;
+};
+
+std::string cache_dir;
+
+size_t level_bytes(size_t w, size_t h) {
+    const size_t n = Tiled_Image::tile_size;
+    return ((w + n - 1) / n) * ((h + n - 1) / n) * n * n * 3 * sizeof(float);
+}
+
+} // namespace
+
+Tiled_Image::Tiled_Image(const HDR_Image& image) {
+    owned = convert(image);
+    attach(owned.data(), owned.size());
+    source = image.loaded_from();
+}
+
+void Tiled_Image::configure_cache(std::string dir) {
+    cache_dir = dir;
+    if(dir.empty()) return;
+
+    std::error_code err;
+    fs::create_directories(dir, err);
+    if(err) {
+        warn("Failed to create texture cache directory %s: %s", dir.c_str(),
+             err.message().c_str());
+        cache_dir.clear();
+    }
+}
+
+std::string Tiled_Image::load_from(std::string file) {
+
+    mips.clear();
+    owned.clear();
+    map.close();
+    source.clear();
+
+    // Cache entries are named after the source file's path, size, and modification time,
+    // so editing the source simply misses the old entry
+    std::string entry;
+    if(!cache_dir.empty()) {
+        std::error_code err;
+        fs::path path = fs::absolute(file, err);
+        auto time = fs::last_write_time(path, err);
+        auto bytes = err ? 0 : fs::file_size(path, err);
+        if(!err) {
+            std::stringstream key, name;
+            key << path.string() << "|" << time.time_since_epoch().count() << "|" << bytes;
+            name << std::hex << std::hash<std::string>()(key.str()) << ".tex";
+            entry = (fs::path(cache_dir) / name.str()).string();
+            if(open(entry).empty()) {
+                source = file;
+                return {};
+            }
+        }
+    }
+
+    std::vector<unsigned char> data;
+    {
+        HDR_Image image;
+        std::string err = image.load_from(file);
+        if(!err.empty()) return err;
+        data = convert(image);
+    }
+    source = file;
+
+    if(!entry.empty()) {
+        // Write to a temporary file first so readers never see a partial entry
+        std::stringstream tmp;
+        tmp << entry << "." << std::this_thread::get_id() << ".tmp";
+
+        std::ofstream out(tmp.str(), std::ios::binary | std::ios::trunc);
+        out.write((const char*)data.data(), data.size());
+        out.close();
+
+        std::error_code err;
+        if(out) fs::rename(tmp.str(), entry, err);
+        if(!out || err) {
+            fs::remove(tmp.str(), err);
+            warn("Failed to write texture cache entry %s", entry.c_str());
+        } else if(open(entry).empty()) {
+            return {};
+        }
+    }
+
+    owned = std::move(data);
+    return attach(owned.data(), owned.size());
+}
+
+std::string Tiled_Image::open(std::string file) {
+
+    std::string err = map.open(file);
+    if(!err.empty()) return err;
+
+    err = attach(map.data(), map.size());
+    if(!err.empty()) {
+        // Stale or corrupt entries are removed so they get rebuilt
+        map.close();
+        std::error_code fs_err;
+        fs::remove(file, fs_err);
+        warn("Discarding invalid texture cache entry %s", file.c_str());
+    }
+    return err;
+}
+
+std::string Tiled_Image::attach(const unsigned char* data, size_t size) {
+
+    mips.clear();
+    if(size < sizeof(Tile_Header)) return "Truncated tiled image.";
+
+    Tile_Header header;
+    std::memcpy(&header, data, sizeof(Tile_Header));
+    if(std::memcmp(header.magic, tile_magic, sizeof(tile_magic)) ||
+       header.version != tile_version || header.tile_size != tile_size || !header.levels ||
+       header.levels > max_levels) {
+        return "Invalid tiled image header.";
+    }
+    if(size < sizeof(Tile_Header) + header.levels * sizeof(Tile_Level)) {
+        return "Truncated tiled image.";
+    }
+
+    for(size_t i = 0; i < header.levels; i++) {
+        Tile_Level level;
+        std::memcpy(&level, data + sizeof(Tile_Header) + i * sizeof(Tile_Level),
+                    sizeof(Tile_Level));
+        if(!level.w || !level.h || level.w >= max_dim || level.h >= max_dim ||
+           (i && (level.w > (mips.back().w + 1) / 2 || level.h > (mips.back().h + 1) / 2))) {
+            mips.clear();
+            return "Invalid tiled image header.";
+        }
+        if(level.offset % sizeof(float) || level.offset > size ||
+           level_bytes(level.w, level.h) > size - level.offset) {
+            mips.clear();
+            return "Truncated tiled image.";
+        }
+        size_t tiles_x = (level.w + tile_size - 1) / tile_size;
+        mips.push_back({level.w, level.h, tiles_x, (const float*)(data + level.offset)});
+    }
+    return {};
+}
+
+std::vector<unsigned char> Tiled_Image::convert(const HDR_Image& image) {
+
+    std::vector<std::pair<size_t, size_t>> dims;
+    {
+        auto [w, h] = image.dimension();
+        if(!w || !h) return {};
+        dims.push_back({w, h});
+        while(w > 1 || h > 1) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            dims.push_back({w, h});
+        }
+    }
+
+    size_t offset = sizeof(Tile_Header) + dims.size() * sizeof(Tile_Level);
+    std::vector<unsigned char> data(offset);
+
+    Tile_Header header = {};
+    std::memcpy(header.magic, tile_magic, sizeof(tile_magic));
+    header.version = tile_version;
+    header.tile_size = (uint32_t)tile_size;
+    header.levels = (uint32_t)dims.size();
+    std::memcpy(data.data(), &header, sizeof(Tile_Header));
+
+    for(size_t i = 0; i < dims.size(); i++) {
+        Tile_Level level = {dims[i].first, dims[i].second, offset};
+        std::memcpy(data.data() + sizeof(Tile_Header) + i * sizeof(Tile_Level), &level,
+                    sizeof(Tile_Level));
+        offset += level_bytes(dims[i].first, dims[i].second);
+    }
+    data.resize(offset);
+
+    // Each level is box filtered from the one above it, which only needs to be kept
+    // around untiled until the next level is done
+    std::vector<Spectrum> prev, next;
+    for(size_t i = 0; i < dims.size(); i++) {
+
+        auto [w, h] = dims[i];
+        next.resize(w * h);
+        if(i == 0) {
+            for(size_t j = 0; j < w * h; j++) next[j] = image.at(j);
+        } else {
+            auto [pw, ph] = dims[i - 1];
+            for(size_t y = 0; y < h; y++) {
+                size_t y0 = 2 * y, y1 = std::min(2 * y + 1, ph - 1);
+                for(size_t x = 0; x < w; x++) {
+                    size_t x0 = 2 * x, x1 = std::min(2 * x + 1, pw - 1);
+                    next[y * w + x] = (prev[y0 * pw + x0] + prev[y0 * pw + x1] +
+                                       prev[y1 * pw + x0] + prev[y1 * pw + x1]) *
+                                      0.25f;
+                }
+            }
+        }
+
+        Tile_Level level;
+        std::memcpy(&level, data.data() + sizeof(Tile_Header) + i * sizeof(Tile_Level),
+                    sizeof(Tile_Level));
+        float* texels = (float*)(data.data() + level.offset);
+        size_t tiles_x = (w + tile_size - 1) / tile_size;
+        for(size_t y = 0; y < h; y++) {
+            for(size_t x = 0; x < w; x++) {
+                size_t tile = (y / tile_size) * tiles_x + x / tile_size;
+                size_t idx = tile * tile_size * tile_size + (y % tile_size) * tile_size +
+                             x % tile_size;
+                const Spectrum& s = next[y * w + x];
+                texels[3 * idx] = s.r;
+                texels[3 * idx + 1] = s.g;
+                texels[3 * idx + 2] = s.b;
+            }
+        }
+        std::swap(prev, next);
+    }
+    return data;
+}
+
+std::string Tiled_Image::loaded_from() const {
+    return source;
+}
+
+size_t Tiled_Image::levels() const {
+    return mips.size();
+}
+
+std::pair<size_t, size_t> Tiled_Image::dimension(size_t level) const {
+    if(level >= mips.size()) return {0, 0};
+    return {mips[level].w, mips[level].h};
+}
+
+size_t Tiled_Image::level_below(size_t max_w) const {
+    size_t level = 0;
+    while(level + 1 < mips.size() && mips[level].w > max_w) level++;
+    return level;
+}
+
+Spectrum Tiled_Image::at(size_t level, size_t x, size_t y) const {
+    assert(level < mips.size());
+    const Level& l = mips[level];
+    assert(x < l.w && y < l.h);
+    size_t tile = (y / tile_size) * l.tiles_x + x / tile_size;
+    size_t idx = tile * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size;
+    const float* t = l.texels + 3 * idx;
+    return Spectrum(t[0], t[1], t[2]);
+}
+
+Spectrum Tiled_Image::bilinear(size_t level, Vec2 uv) const {
+
+    const Level& l = mips[level];
+    float fx = uv.x * l.w - 0.5f, fy = uv.y * l.h - 0.5f;
+    float x0 = std::floor(fx), y0 = std::floor(fy);
+    float tx = fx - x0, ty = fy - y0;
+
+    auto col = [w = (long long)l.w](float x) { return (size_t)(((long long)x % w + w) % w); };
+    auto row = [h = l.h](float y) { return (size_t)std::clamp(y, 0.0f, (float)(h - 1)); };
+    size_t xa = col(x0), xb = col(x0 + 1.0f), ya = row(y0), yb = row(y0 + 1.0f);
+
+    Spectrum bottom = at(level, xa, ya) * (1.0f - tx) + at(level, xb, ya) * tx;
+    Spectrum top = at(level, xa, yb) * (1.0f - tx) + at(level, xb, yb) * tx;
+    return bottom * (1.0f - ty) + top * ty;
+}
+
+Spectrum Tiled_Image::lookup(Vec2 uv, float level) const {
+
+    if(mips.empty()) return {};
+
+    level = std::clamp(level, 0.0f, (float)(mips.size() - 1));
+    size_t l = (size_t)level;
+    float t = level - l;
+
+    Spectrum s = bilinear(l, uv);
+    if(t > 0.0f && l + 1 < mips.size()) {
+        s = s * (1.0f - t) + bilinear(l + 1, uv) * t;
+    }
+    return s;
+}
+
+HDR_Image Tiled_Image::level_copy(size_t level) const {
+
+    if(level >= mips.size()) return {};
+
+    auto [w, h] = dimension(level);
+    HDR_Image ret(w, h);
+    for(size_t y = 0; y < h; y++) {
+        for(size_t x = 0; x < w; x++) {
+            ret.at(x, y) = at(level, x, y);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,62 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "../lib/spectrum.h"
+#include "hdr_image.h"
+#include "mapped_file.h"
+
+/// Read-only, mip-mapped float image stored in square tiles. Images loaded from disk are
+/// converted once into a cache file that is memory-mapped, so only the tiles that lookups
+/// actually touch are ever paged in.
+class Tiled_Image {
+public:
+    Tiled_Image() = default;
+    explicit Tiled_Image(const HDR_Image& image);
+    Tiled_Image(const Tiled_Image& src) = delete;
+    Tiled_Image(Tiled_Image&& src) = default;
+    ~Tiled_Image() = default;
+
+    Tiled_Image& operator=(const Tiled_Image& src) = delete;
+    Tiled_Image& operator=(Tiled_Image&& src) = default;
+
+    /// Where converted images are kept. If empty, images are converted on every load and
+    /// held in memory.
+    static void configure_cache(std::string dir);
+
+    std::string load_from(std::string file);
+    std::string loaded_from() const;
+
+    size_t levels() const;
+    std::pair<size_t, size_t> dimension(size_t level = 0) const;
+    /// Finest level that is at most max_w texels wide
+    size_t level_below(size_t max_w) const;
+
+    Spectrum at(size_t level, size_t x, size_t y) const;
+    /// Trilinear lookup at uv in [0,1]^2, with rows ordered as in HDR_Image. Wraps in u
+    /// and clamps in v, which is what lat-long environment maps need.
+    Spectrum lookup(Vec2 uv, float level = 0.0f) const;
+
+    HDR_Image level_copy(size_t level) const;
+
+    static const inline size_t tile_size = 32;
+
+private:
+    struct Level {
+        size_t w, h, tiles_x;
+        const float* texels;
+    };
+
+    std::string open(std::string file);
+    std::string attach(const unsigned char* data, size_t size);
+    Spectrum bilinear(size_t level, Vec2 uv) const;
+    static std::vector<unsigned char> convert(const HDR_Image& image);
+
+    std::vector<Level> mips;
+    std::vector<unsigned char> owned;
+    Mapped_File map;
+    std::string source;
+};